@@ -12,7 +12,7 @@ fi
 
 BUILD_DIR="build/$BOARD"
 
-unset PL_MCUBOOT_SUPPORTED PL_MCUBOOT_OPTS
+unset PL_MCUBOOT_SUPPORTED PL_MCUBOOT_OPTS PL_NETCORE_BOARD
 
 # TODO: Figure out the provisioning partition offset/size from the dts directly.
 if [[ "$BOARD" == "microdash" ]]; then
@@ -55,6 +55,13 @@ elif [[ "$BOARD" == "particle_xenon" ]]; then
     -DCONFIG_BOOT_USB_DFU_DETECT_PORT=\"GPIO_0\"
     -DCONFIG_BOOT_USB_DFU_DETECT_PIN=11
   "
+elif [[ "$BOARD" == "nrf5340dk_nrf5340_cpuapp" ]]; then
+  PL_PYOCD_TYPE=nrf5340
+
+  # The Bluetooth controller runs on the network core, which needs its own image.
+  PL_NETCORE_BOARD=nrf5340dk_nrf5340_cpunet
+
+  PL_MCUBOOT_SUPPORTED=0
 elif [[ "$BOARD" == "pl_bluepill" ]]; then
   PL_PYOCD_TYPE=stm32f103c8
 
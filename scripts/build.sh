@@ -59,3 +59,16 @@ if [[ "${PL_SKIP_PL-}" != 1 ]]; then
     cp "$BUILD_DIR/pl/zephyr/zephyr.hex" "$BUILD_DIR/pl.hex"
   fi
 fi
+
+if [[ -n "${PL_NETCORE_BOARD-}" && "${PL_SKIP_NETCORE-}" != 1 ]]; then
+  # Build the Bluetooth controller for the network core.
+  if [ ! -d "$BUILD_DIR/netcore" ]; then
+    west build --cmake-only -d "$BUILD_DIR/netcore" -b "$PL_NETCORE_BOARD" \
+      -s "$ROOT/zephyr/samples/bluetooth/hci_rpmsg" -- \
+      -DOVERLAY_CONFIG="$(realpath "$ROOT/passinglink/boards/${PL_NETCORE_BOARD}_hci_rpmsg.conf")"
+  fi
+
+  west build -d "$BUILD_DIR/netcore"
+
+  cp "$BUILD_DIR/netcore/zephyr/zephyr.hex" "$BUILD_DIR/netcore.hex"
+fi
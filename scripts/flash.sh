@@ -19,3 +19,8 @@ fi
 if [[ "${PL_SKIP_PL-}" != 1 ]]; then
   pyocd flash -e sector -t $PL_PYOCD_TYPE "$BUILD_DIR/pl.hex"
 fi
+
+if [[ -n "${PL_NETCORE_BOARD-}" && "${PL_SKIP_NETCORE-}" != 1 ]]; then
+  # pyocd can't program the nRF5340 network core.
+  nrfjprog --coprocessor CP_NETWORK --program "$BUILD_DIR/netcore.hex" --sectorerase --reset
+fi
@@ -2,30 +2,131 @@
 
 #include <kernel.h>
 
+#include <init.h>
 #include <logging/log_ctrl.h>
 #include <power/reboot.h>
 
+#include "metrics/blackbox.h"
+#include "recovery.h"
+#include "shell_uart.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(arch);
+
+#if defined(NRF52840) || defined(NRF5340)
+uint32_t arch_cpu_freq = 64'000'000;
+#else
+uint32_t arch_cpu_freq = CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC;
+#endif
+
+// Until calibrated, assume the cost that spin() was originally tuned for.
+static uint32_t spin_cost_x16 = 7 * 16;
+
 #if defined(__arm__)
-void spin(uint32_t cycles) {
+static void spin_loop(uint32_t iterations) {
   asm volatile(
-    "loop:\n"
-    "subs %0, #7\n"
-    "bpl loop\n"
-    :  // No outputs.
-    : "r"(cycles));
+    "1:\n"
+    "subs %0, #1\n"
+    "bne 1b\n"
+    : "+r"(iterations)
+    :  // No inputs.
+    : "cc");
+}
+
+void spin(uint32_t cycles) {
+  uint32_t iterations = static_cast<uint64_t>(cycles) * 16 / spin_cost_x16 + 1;
+  spin_loop(iterations);
+}
+
+// Short enough to stay within a single tick on every board, so that no tick interrupt (or
+// SysTick wraparound, where that's the cycle counter) is pending while interrupts are locked.
+static constexpr uint32_t SPIN_CALIBRATION_ITERATIONS = 256;
+
+static uint32_t spin_calibrate() {
+  // Take the fastest of a few runs: the first one pays for filling the flash cache.
+  uint32_t best = UINT32_MAX;
+  for (int i = 0; i < 4; ++i) {
+    ScopedIRQLock lock;
+    uint32_t begin = get_cycle_count();
+    spin_loop(SPIN_CALIBRATION_ITERATIONS);
+    uint32_t cycles = get_cycle_count() - begin;
+    best = min(best, cycles);
+  }
+  uint32_t cost_x16 = (best * 16 + SPIN_CALIBRATION_ITERATIONS / 2) / SPIN_CALIBRATION_ITERATIONS;
+  return max<uint32_t>(1, cost_x16);
+}
+#endif
+
+// Count cycles across a whole number of ticks, starting and ending right on a tick boundary.
+static uint32_t cycles_calibrate(uint32_t ticks) {
+  int64_t start_tick = k_uptime_ticks();
+  while (k_uptime_ticks() == start_tick) {
+  }
+  uint32_t begin = get_cycle_count();
+
+  int64_t end_tick = start_tick + 1 + ticks;
+  while (k_uptime_ticks() < end_tick) {
+  }
+  return get_cycle_count() - begin;
 }
+
+static int arch_calibrate(const struct device*) {
+#if defined(NRF52840) || defined(NRF5340)
+  // Enable the trace unit so we can get a cycle count.
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 #endif
 
+  uint32_t ticks = k_ms_to_ticks_ceil32(4);
+  uint32_t cycles = cycles_calibrate(ticks);
+  uint32_t measured_freq = static_cast<uint64_t>(cycles) * CONFIG_SYS_CLOCK_TICKS_PER_SEC / ticks;
+
+#if defined(NRF52840) || defined(NRF5340)
+  // The CPU clock is independent of the tick, so the measurement is what counts. Anything wildly
+  // off means the cycle counter isn't running, though.
+  if (measured_freq < arch_cpu_freq / 2 || measured_freq > arch_cpu_freq * 2) {
+    LOG_ERR("measured CPU clock of %u Hz is implausible, using %u Hz", measured_freq,
+            arch_cpu_freq);
+  } else {
+    arch_cpu_freq = measured_freq;
+  }
+#else
+  // Measuring the timer against itself only serves as a sanity check.
+  arch_cpu_freq = sys_clock_hw_cycles_per_sec();
+#endif
+
+#if defined(__arm__)
+  spin_cost_x16 = spin_calibrate();
+#endif
+
+  LOG_INF("cycle counter runs at %u Hz (measured %u Hz), spin loop takes %u.%02u cycles",
+          arch_cpu_freq, measured_freq, spin_cost_x16 / 16, spin_cost_x16 % 16 * 100 / 16);
+  return 0;
+}
+
+SYS_INIT(arch_calibrate, POST_KERNEL, ARCH_CALIBRATION_PRIORITY);
+
 static void reboot_impl(k_work*) {
 #if defined(CONFIG_LOG)
-  while (log_buffered_cnt()) {
+  // Don't hold up recovery from a fault for the sake of logs, or reboot forever if they aren't
+  // being processed.
+  for (int i = 0; i < 200 && !recovery_pending() && log_buffered_cnt(); ++i) {
     k_sleep(K_MSEC(5));
   }
 
   // We've fed all of our log messages to the backend, but it still might take
-  // some time for that to be flushed out over the wire. Sleep for a bit more
-  // to give that some time to happen.
-  k_sleep(K_MSEC(5));
+  // some time for that to be flushed out over the wire.
+  if (!recovery_pending()) {
+#if defined(CONFIG_PASSINGLINK_SHELL_UART_ASYNC)
+    // The shell thread formats log messages at the lowest priority, so give it a chance to.
+    k_sleep(K_MSEC(1));
+    shell_uart_flush(K_MSEC(50));
+#else
+    k_sleep(K_MSEC(5));
+#endif
+  }
 #endif
 
   sys_reboot(SYS_REBOOT_WARM);
@@ -33,6 +134,8 @@ static void reboot_impl(k_work*) {
 K_WORK_DEFINE(reboot_work, reboot_impl);
 
 void reboot() {
+  blackbox_record(BlackboxEvent::Reboot);
+
   // We might be called from an ISR, schedule a reboot to happen.
   k_work_submit(&reboot_work);
 }
@@ -22,28 +22,39 @@
 #define NRF52840 1
 #endif
 
-#if defined(NRF52840)
+#if defined(NRF5340_XXAA_APPLICATION)
+#define NRF5340 1
+#endif
+
+#if defined(NRF52840) || defined(NRF5340)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-function"
 static uint32_t get_cycle_count() {
   return DWT->CYCCNT;
 }
-
-static uint32_t get_cpu_freq() {
-  return 64'000'000;
-}
 #else
 static uint32_t get_cycle_count() {
   return k_cycle_get_32();
 }
-
-static uint32_t get_cpu_freq() {
-  return sys_clock_hw_cycles_per_sec();
-}
 #pragma GCC diagnostic pop
 #endif
 
+// The rate of get_cycle_count(). On nRF, that's the CPU clock, which is nominally 64MHz (the
+// nRF5340 application core comes out of reset at 64MHz as well, and we leave it there), but really
+// depends on which oscillator it's running off of: it gets measured against the kernel tick at
+// boot. Elsewhere, the cycle count comes from the same timer as the tick.
+extern uint32_t arch_cpu_freq;
+
+inline uint32_t get_cpu_freq() {
+  return arch_cpu_freq;
+}
+
+// Runs early in POST_KERNEL, so that anything after it can count on get_cycle_count(),
+// get_cpu_freq() and spin().
+#define ARCH_CALIBRATION_PRIORITY 0
+
 #if defined(__arm__)
+// Busy-wait for at least this many get_cycle_count() cycles.
 void spin(uint32_t cycles);
 #endif
 
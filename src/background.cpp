@@ -0,0 +1,401 @@
+#include "background.h"
+
+#include <zephyr.h>
+
+#include <init.h>
+#include <logging/log_ctrl.h>
+#include <shell/shell.h>
+
+#include "arch.h"
+#include "output/usb/hid.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(background);
+
+K_SEM_DEFINE(background_wake, 0, 1);
+
+static BackgroundJob* queue_head;
+static BackgroundJob* queue_tail;
+static size_t queue_length;
+
+static BackgroundJob* current_job;
+static uint32_t chunk_begin;
+
+static void background_push(BackgroundJob* job) {
+  ScopedIRQLock lock;
+  if (job->queued) {
+    return;
+  }
+
+  job->queued = true;
+  job->next = nullptr;
+  if (queue_tail) {
+    queue_tail->next = job;
+  } else {
+    queue_head = job;
+  }
+  queue_tail = job;
+  ++queue_length;
+}
+
+static BackgroundJob* background_pop() {
+  ScopedIRQLock lock;
+  BackgroundJob* job = queue_head;
+  if (job) {
+    queue_head = job->next;
+    if (!queue_head) {
+      queue_tail = nullptr;
+    }
+    job->queued = false;
+    --queue_length;
+  }
+  return job;
+}
+
+void background_submit(BackgroundJob* job) {
+  background_push(job);
+  k_sem_give(&background_wake);
+}
+
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_LOG)
+// With the log processing thread disabled, log messages get handed to the backends from here, one
+// message per chunk.
+static bool background_flush_log(BackgroundJob*) {
+  while (log_process(false)) {
+    if (background_should_yield()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static BackgroundJob log_job("log", background_flush_log);
+#endif
+
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK)
+// The slack after a report: from the write, until the guard interval before the next one is due.
+struct BackgroundWindow {
+  uint32_t sequence;
+  uint32_t begin;
+  uint32_t end;
+};
+
+static uint32_t last_write_cycle;
+static uint32_t write_sequence;
+static uint32_t max_write_gap_cycles;
+
+static optional<BackgroundWindow> current_window;
+static uint32_t chunk_sequence;
+static atomic_t slice_running;
+
+struct BackgroundTraceEntry {
+  const char* job;
+
+  // The report after which the slice ran, or 0 if no reports were being written.
+  uint32_t sequence;
+
+  // Start of the slice, relative to the report write.
+  uint32_t offset_cycles;
+  uint32_t cycles;
+
+  // Cycles between the end of the slice and the end of the window: negative if it overran.
+  int32_t margin_cycles;
+
+  // Whether the job was run regardless of fit, after being deferred too many times.
+  bool forced;
+
+  // Whether a report was started while the slice was running.
+  bool overlapped;
+};
+
+static array<BackgroundTraceEntry, CONFIG_PASSINGLINK_BACKGROUND_TRACE_SIZE> trace;
+static uint32_t trace_count;
+static uint32_t slice_count;
+static uint32_t overlap_count;
+static uint32_t overrun_count;
+static uint32_t forced_count;
+
+static uint32_t background_ticks_to_cycles(uint32_t ticks) {
+  return static_cast<uint64_t>(ticks) * get_cpu_freq() / CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+}
+
+static uint32_t background_cycles_to_us(uint32_t cycles) {
+  return static_cast<uint64_t>(cycles) * 1'000'000 / get_cpu_freq();
+}
+
+void background_report_begin() {
+  if (atomic_get(&slice_running)) {
+    ScopedIRQLock lock;
+    ++overlap_count;
+    if (trace_count != 0) {
+      trace[(trace_count - 1) % trace.size()].overlapped = true;
+    }
+  }
+}
+
+void background_report_written() {
+  {
+    ScopedIRQLock lock;
+    uint32_t now = get_cycle_count();
+    if (write_sequence != 0) {
+      max_write_gap_cycles = max(max_write_gap_cycles, now - last_write_cycle);
+    }
+    last_write_cycle = now;
+    ++write_sequence;
+  }
+  k_sem_give(&background_wake);
+}
+
+uint32_t background_take_max_report_gap_us() {
+  uint32_t cycles;
+  {
+    ScopedIRQLock lock;
+    cycles = max_write_gap_cycles;
+    max_write_gap_cycles = 0;
+  }
+  return background_cycles_to_us(cycles);
+}
+
+// Returns the window after the latest report, if reports are still being written.
+static optional<BackgroundWindow> background_get_window() {
+  uint32_t interval_cycles = background_ticks_to_cycles(usb_hid_get_poll_interval_ticks());
+  uint32_t guard_cycles =
+    static_cast<uint64_t>(CONFIG_PASSINGLINK_BACKGROUND_GUARD_US) * get_cpu_freq() / 1'000'000;
+
+  BackgroundWindow window;
+  {
+    ScopedIRQLock lock;
+    window.sequence = write_sequence;
+    window.begin = last_write_cycle;
+  }
+
+  // Consider reports to have stopped if a few polls pass without one.
+  if (window.sequence == 0 || get_cycle_count() - window.begin > 4 * interval_cycles) {
+    return {};
+  }
+
+  window.end = window.begin + interval_cycles - min(guard_cycles, interval_cycles);
+  return window;
+}
+
+static bool background_fits(const BackgroundJob* job, uint32_t now) {
+  if (!current_window) {
+    return true;
+  }
+  int32_t remaining = static_cast<int32_t>(current_window->end - now);
+  return remaining > static_cast<int32_t>(job->chunk_cycles);
+}
+
+// Attribute the time since the previous chunk boundary to the current job, unless a report
+// preempted it in the meantime, which would inflate it.
+static uint32_t background_end_chunk(uint32_t now) {
+  uint32_t sequence;
+  {
+    ScopedIRQLock lock;
+    sequence = write_sequence;
+  }
+  if (sequence == chunk_sequence) {
+    current_job->chunk_cycles = max(current_job->chunk_cycles, now - chunk_begin);
+  }
+  chunk_begin = now;
+  chunk_sequence = sequence;
+  return now;
+}
+
+bool background_should_yield() {
+  if (!current_job) {
+    return false;
+  }
+  return !background_fits(current_job, background_end_chunk(get_cycle_count()));
+}
+
+bool background_has_time(uint32_t us) {
+  if (!current_window) {
+    return true;
+  }
+  uint32_t cycles = static_cast<uint64_t>(us) * get_cpu_freq() / 1'000'000;
+  int32_t remaining = static_cast<int32_t>(current_window->end - get_cycle_count());
+  return remaining > 0 && static_cast<uint32_t>(remaining) > cycles;
+}
+
+static void background_trace(BackgroundJob* job, uint32_t begin, uint32_t end, bool forced) {
+  BackgroundTraceEntry entry = {};
+  entry.job = job->name;
+  entry.cycles = end - begin;
+  entry.forced = forced;
+  if (current_window) {
+    entry.sequence = current_window->sequence;
+    entry.offset_cycles = begin - current_window->begin;
+    entry.margin_cycles = static_cast<int32_t>(current_window->end - end);
+  }
+
+  ScopedIRQLock lock;
+  ++slice_count;
+  overrun_count += entry.margin_cycles < 0;
+  forced_count += forced;
+  trace[trace_count++ % trace.size()] = entry;
+}
+
+// Run every queued job once, as far as the current window allows.
+static void background_run() {
+  current_window = background_get_window();
+  size_t count;
+  {
+    ScopedIRQLock lock;
+    count = queue_length;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    BackgroundJob* job = background_pop();
+    if (!job) {
+      break;
+    }
+
+    uint32_t begin = get_cycle_count();
+    bool forced = false;
+    if (!job->self_timed && !background_fits(job, begin)) {
+      if (++job->deferred_windows < CONFIG_PASSINGLINK_BACKGROUND_MAX_DEFER) {
+        background_push(job);
+        continue;
+      }
+
+      // Don't starve jobs whose chunks are longer than the window: run them at its start.
+      if (static_cast<int32_t>(begin - current_window->begin) >
+          static_cast<int32_t>(current_window->end - begin)) {
+        background_push(job);
+        continue;
+      }
+      forced = true;
+    }
+    job->deferred_windows = 0;
+
+    current_job = job;
+    chunk_begin = begin;
+    chunk_sequence = current_window ? current_window->sequence : write_sequence;
+    atomic_set(&slice_running, 1);
+    bool done = job->function(job);
+    atomic_set(&slice_running, 0);
+    uint32_t end = background_end_chunk(get_cycle_count());
+    current_job = nullptr;
+
+    background_trace(job, begin, end, forced);
+    if (!done) {
+      background_push(job);
+    }
+  }
+
+  // Outside of a window, keep going until everything's done.
+  if (!current_window && queue_length != 0) {
+    k_sem_give(&background_wake);
+  }
+}
+#else
+void background_report_begin() {}
+void background_report_written() {}
+
+bool background_should_yield() {
+  return false;
+}
+
+bool background_has_time(uint32_t) {
+  return true;
+}
+
+static void background_run() {
+  while (BackgroundJob* job = background_pop()) {
+    current_job = job;
+    bool done = job->function(job);
+    current_job = nullptr;
+    if (!done) {
+      background_push(job);
+    }
+  }
+}
+#endif
+
+static void background_thread_main(void*, void*, void*) {
+  while (true) {
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_LOG)
+    // Nothing wakes us up when a message gets logged, so check for them periodically, in case no
+    // reports are being written.
+    k_sem_take(&background_wake, K_MSEC(CONFIG_PASSINGLINK_BACKGROUND_LOG_INTERVAL_MS));
+#else
+    k_sem_take(&background_wake, K_FOREVER);
+#endif
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_LOG)
+    if (log_buffered_cnt() != 0) {
+      background_push(&log_job);
+    }
+#endif
+    background_run();
+  }
+}
+
+K_THREAD_DEFINE(background_thread, CONFIG_PASSINGLINK_BACKGROUND_STACK_SIZE,
+                background_thread_main, nullptr, nullptr, nullptr,
+                CONFIG_PASSINGLINK_BACKGROUND_PRIORITY, 0, 0);
+
+struct k_work_q background_work_q;
+K_THREAD_STACK_DEFINE(background_work_q_stack, CONFIG_PASSINGLINK_BACKGROUND_WORK_STACK_SIZE);
+
+static int background_work_q_init(const struct device*) {
+  k_work_q_start(&background_work_q, background_work_q_stack,
+                 K_THREAD_STACK_SIZEOF(background_work_q_stack), K_LOWEST_APPLICATION_THREAD_PRIO);
+  return 0;
+}
+
+SYS_INIT(background_work_q_init, POST_KERNEL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
+
+#if defined(CONFIG_SHELL) && defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK)
+static int cmd_background(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+    ScopedIRQLock lock;
+    trace_count = 0;
+    slice_count = 0;
+    overlap_count = 0;
+    overrun_count = 0;
+    forced_count = 0;
+    return 0;
+  } else if (argc != 1) {
+    shell_print(shell, "usage: background [clear]");
+    return 0;
+  }
+
+  array<BackgroundTraceEntry, CONFIG_PASSINGLINK_BACKGROUND_TRACE_SIZE> entries;
+  size_t count;
+  uint32_t slices, overlaps, overruns, forced;
+  {
+    ScopedIRQLock lock;
+    count = min<size_t>(trace_count, trace.size());
+    for (size_t i = 0; i < count; ++i) {
+      entries[i] = trace[(trace_count - count + i) % trace.size()];
+    }
+    slices = slice_count;
+    overlaps = overlap_count;
+    overruns = overrun_count;
+    forced = forced_count;
+  }
+
+  shell_print(shell, "background: poll interval %u us, guard %u us",
+              k_ticks_to_us_floor32(usb_hid_get_poll_interval_ticks()),
+              CONFIG_PASSINGLINK_BACKGROUND_GUARD_US);
+  shell_print(shell, "  %u slices, %u overlapped a report, %u overran the window, %u forced",
+              slices, overlaps, overruns, forced);
+  shell_print(shell, "  %-10s %8s %8s %8s %8s", "job", "report", "start", "us", "margin");
+  for (size_t i = 0; i < count; ++i) {
+    const BackgroundTraceEntry& entry = entries[i];
+    int32_t margin_us = entry.margin_cycles < 0
+                          ? -static_cast<int32_t>(background_cycles_to_us(-entry.margin_cycles))
+                          : static_cast<int32_t>(background_cycles_to_us(entry.margin_cycles));
+    shell_print(shell, "  %-10s %8u %8u %8u %8d%s%s", entry.job, entry.sequence,
+                background_cycles_to_us(entry.offset_cycles), background_cycles_to_us(entry.cycles),
+                margin_us, entry.forced ? " forced" : "", entry.overlapped ? " OVERLAP" : "");
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(background, NULL, "Trace background jobs against report windows",
+                   cmd_background);
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Background work that isn't latency sensitive (display blits, LED flashing, touchpad reads,
+// metrics, log flushing), run one job at a time from a single preemptible thread.
+//
+// With CONFIG_PASSINGLINK_BACKGROUND_SLACK, while reports are being written, jobs only get
+// dispatched in the slack right after a report is written, and have to be done
+// CONFIG_PASSINGLINK_BACKGROUND_GUARD_US before the next one is due. Long jobs are split into
+// slices: they should call background_should_yield() between chunks of work, and return false to
+// get resumed in a later window. When no reports are being written, jobs run as soon as they're
+// submitted.
+struct BackgroundJob {
+  // Returns true once the job is complete.
+  using Function = bool (*)(BackgroundJob* job);
+
+  constexpr BackgroundJob(const char* name, Function function, bool self_timed = false)
+      : name(name), function(function), self_timed(self_timed) {}
+
+  const char* name;
+  Function function;
+
+  // Jobs whose chunks take a known amount of time check background_has_time() themselves, instead
+  // of being timed by the scheduler, and are never forced into a window.
+  bool self_timed;
+
+  // Owned by the scheduler.
+  BackgroundJob* next = nullptr;
+  bool queued = false;
+
+  // The longest chunk of work seen between calls to background_should_yield().
+  uint32_t chunk_cycles = 0;
+
+  // Number of windows in a row that the job didn't fit into.
+  uint32_t deferred_windows = 0;
+};
+
+// Queue a job, if it isn't queued already. Can be called from an ISR.
+void background_submit(BackgroundJob* job);
+
+// Called by jobs between chunks of work: returns true if the job should return false, and pick
+// up where it left off in the next window. Always false outside of a job.
+bool background_should_yield();
+
+// Whether work that takes the given time would be done before the current window closes.
+// Always true when no reports are being written.
+bool background_has_time(uint32_t us);
+
+// Called by the HID code around every report write, to find the slack windows.
+void background_report_begin();
+void background_report_written();
+
+// A work queue at the lowest application priority, for work that's triggered from the report path
+// but can't be split into background job slices (menu rendering, status line redraws, freeing
+// input queues). The system work queue would do for that, but reports get built from it too.
+extern struct k_work_q background_work_q;
+
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK)
+// The longest time between two report writes since the previous call.
+uint32_t background_take_max_report_gap_us();
+#endif
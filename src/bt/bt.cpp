@@ -9,24 +9,91 @@
 #include <bluetooth/gatt.h>
 #include <bluetooth/uuid.h>
 
+#if defined(CONFIG_BT_SETTINGS)
+#include <settings/settings.h>
+#endif
+
 #include <logging/log.h>
+#include <shell/shell.h>
 
 #include "input/input.h"
 #include "opt/gundam.h"
+#include "types.h"
 #include "version.h"
 
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(bt);
 
+#if defined(CONFIG_PASSINGLINK_BT_RELAY_SOURCE)
+// Advertising resumes by itself when a connection drops, and its interval is most of the time it
+// takes for the dongle to get us back: advertise every 20-30ms.
+static const struct bt_le_adv_param pl_bt_adv_params = BT_LE_ADV_PARAM_INIT(
+  BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME, 0x0020, 0x0030, nullptr);
+#else
 static const struct bt_le_adv_param pl_bt_adv_params =
   BT_LE_ADV_PARAM_INIT(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME,
                        BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, nullptr);
+#endif
 
 static const struct bt_data pl_bt_adv_data[] = {
   BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+#if defined(CONFIG_PASSINGLINK_BT_RELAY_SOURCE)
+  // Only one 128-bit UUID fits: advertise the relay service, so that dongles can find us.
+  BT_DATA_BYTES(BT_DATA_UUID128_ALL, 0x00, 0x03, PL_BT_UUID_PREFIX),
+#else
   BT_DATA_BYTES(BT_DATA_UUID128_ALL, 0x00, 0x00, PL_BT_UUID_PREFIX),
+#endif
+};
+
+static BluetoothLinkStats link_stats;
+
+// Ask for the fastest link that BLE allows: 7.5ms interval, no peripheral latency.
+static const struct bt_le_conn_param pl_bt_conn_param = {
+  .interval_min = 6,
+  .interval_max = 6,
+  .latency = 0,
+  .timeout = 3200,
+};
+
+// If the central refuses that, settle for anything up to 15ms.
+static const struct bt_le_conn_param pl_bt_conn_param_fallback = {
+  .interval_min = 6,
+  .interval_max = 12,
+  .latency = 0,
+  .timeout = 3200,
 };
 
+static bool conn_param_fallback;
+
+// Connections that we initiated (the input relay's) are handled in relay.cpp.
+static bool bt_conn_is_peripheral(struct bt_conn* conn) {
+  struct bt_conn_info info;
+  return bt_conn_get_info(conn, &info) == 0 && info.role == BT_CONN_ROLE_SLAVE;
+}
+
+static void bt_request_conn_param(struct bt_conn* conn, const struct bt_le_conn_param* param) {
+  int rc = bt_conn_le_param_update(conn, param);
+  if (rc != 0) {
+    LOG_WRN("failed to update bluetooth connection parameters: rc = %d", rc);
+  }
+}
+
+static void bt_request_link_upgrade(struct bt_conn* conn) {
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+  int phy_rc = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+  if (phy_rc != 0) {
+    LOG_WRN("failed to request 2M PHY, staying on 1M: rc = %d", phy_rc);
+  }
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+  int len_rc = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+  if (len_rc != 0) {
+    LOG_WRN("failed to request data length extension: rc = %d", len_rc);
+  }
+#endif
+}
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 static struct bt_conn_cb connection_cbs = {
@@ -34,24 +101,132 @@ static struct bt_conn_cb connection_cbs = {
     [](struct bt_conn* conn, uint8_t err) {
       if (err) {
         LOG_ERR("connection failed (err 0x%02x)", err);
-      } else {
-        LOG_INF("connection succeeded");
-        struct bt_le_conn_param param = {
-          .interval_min = 6,
-          .interval_max = 6,
-          .latency = 0,
-          .timeout = 3200,
-        };
-        if (bt_conn_le_param_update(conn, &param) != 0) {
-          LOG_WRN("failed to update bluetooth connection parameters");
-        }
+        return;
+      }
+      if (!bt_conn_is_peripheral(conn)) {
+        return;
+      }
+
+      LOG_INF("connection succeeded");
+
+      struct bt_conn_info info;
+      if (bt_conn_get_info(conn, &info) == 0) {
+        link_stats = {};
+        link_stats.connected = true;
+        link_stats.interval = info.le.interval;
+        link_stats.latency = info.le.latency;
+        link_stats.timeout = info.le.timeout;
+        link_stats.tx_phy = BT_GAP_LE_PHY_1M;
+        link_stats.rx_phy = BT_GAP_LE_PHY_1M;
+        link_stats.tx_max_len = 27;
+        link_stats.rx_max_len = 27;
+        link_stats.notify_min_us = UINT32_MAX;
+      }
+
+      conn_param_fallback = false;
+      bt_request_conn_param(conn, &pl_bt_conn_param);
+      bt_request_link_upgrade(conn);
+    },
+  .disconnected =
+    [](struct bt_conn* conn, uint8_t reason) {
+      if (!bt_conn_is_peripheral(conn)) {
+        return;
       }
+      LOG_INF("connection terminated (reason 0x%02x)", reason);
+      link_stats.connected = false;
     },
-  .disconnected = [](struct bt_conn* conn,
-                     uint8_t reason) { LOG_INF("connection terminated (reason 0x%02x)", reason); },
+  .le_param_updated =
+    [](struct bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout) {
+      if (!bt_conn_is_peripheral(conn)) {
+        return;
+      }
+      LOG_INF("connection parameters updated: interval = %u, latency = %u, timeout = %u",
+              interval, latency, timeout);
+      link_stats.interval = interval;
+      link_stats.latency = latency;
+      link_stats.timeout = timeout;
+
+      if ((interval != pl_bt_conn_param.interval_max || latency != 0) && !conn_param_fallback) {
+        LOG_WRN("central refused 7.5ms connection interval, falling back");
+        conn_param_fallback = true;
+        bt_request_conn_param(conn, &pl_bt_conn_param_fallback);
+      }
+    },
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+  .le_phy_updated =
+    [](struct bt_conn* conn, struct bt_conn_le_phy_info* param) {
+      if (!bt_conn_is_peripheral(conn)) {
+        return;
+      }
+      LOG_INF("PHY updated: tx = %u, rx = %u", param->tx_phy, param->rx_phy);
+      link_stats.tx_phy = param->tx_phy;
+      link_stats.rx_phy = param->rx_phy;
+    },
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+  .le_data_len_updated =
+    [](struct bt_conn* conn, struct bt_conn_le_data_len_info* info) {
+      if (!bt_conn_is_peripheral(conn)) {
+        return;
+      }
+      LOG_INF("data length updated: tx = %u, rx = %u", info->tx_max_len, info->rx_max_len);
+      link_stats.tx_max_len = info->tx_max_len;
+      link_stats.rx_max_len = info->rx_max_len;
+    },
+#endif
 };
 #pragma GCC diagnostic pop
 
+BluetoothLinkStats bluetooth_get_link_stats() {
+  return link_stats;
+}
+
+static void bt_notify_sent(struct bt_conn* conn, void* user_data) {
+  uint32_t start = reinterpret_cast<uintptr_t>(user_data);
+  uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+  ++link_stats.notify_count;
+  link_stats.notify_last_us = us;
+  link_stats.notify_total_us += us;
+  link_stats.notify_min_us = min(link_stats.notify_min_us, us);
+  link_stats.notify_max_us = max(link_stats.notify_max_us, us);
+}
+
+int bluetooth_notify(struct bt_conn* conn, const struct bt_gatt_attr* attr, const void* data,
+                     uint16_t len) {
+  struct bt_gatt_notify_params params = {};
+  params.attr = attr;
+  params.data = data;
+  params.len = len;
+  params.func = bt_notify_sent;
+  params.user_data = reinterpret_cast<void*>(static_cast<uintptr_t>(k_cycle_get_32()));
+  return bt_gatt_notify_cb(conn, &params);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_btlink(const struct shell* shell, size_t argc, char** argv) {
+  BluetoothLinkStats stats = bluetooth_get_link_stats();
+  if (!stats.connected) {
+    shell_print(shell, "btlink: not connected");
+    return 0;
+  }
+
+  shell_print(shell, "interval: %u us, latency: %u, timeout: %u ms", stats.interval * 1250,
+              stats.latency, stats.timeout * 10);
+  shell_print(shell, "phy: tx = %u, rx = %u", stats.tx_phy, stats.rx_phy);
+  shell_print(shell, "data length: tx = %u, rx = %u", stats.tx_max_len, stats.rx_max_len);
+  if (stats.notify_count != 0) {
+    shell_print(shell, "notifications: %u, latency min = %u us, avg = %u us, max = %u us",
+                stats.notify_count, stats.notify_min_us,
+                static_cast<uint32_t>(stats.notify_total_us / stats.notify_count),
+                stats.notify_max_us);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(btlink, NULL, "Show negotiated Bluetooth link parameters", cmd_btlink);
+#endif
+
 void bluetooth_init() {
   int err = bt_enable(nullptr);
   if (err != 0) {
@@ -59,6 +234,14 @@ void bluetooth_init() {
     return;
   }
 
+#if defined(CONFIG_BT_SETTINGS)
+  // Restore the identity and bonds.
+  err = settings_load();
+  if (err != 0) {
+    LOG_ERR("settings_load failed: error = %d", err);
+  }
+#endif
+
   err = bt_set_name("Passing Link");
   if (err != 0) {
     LOG_ERR("bt_set_name failed: error = %d", err);
@@ -82,6 +265,10 @@ void bluetooth_init() {
 
   bt_conn_cb_register(&connection_cbs);
 
+#if defined(CONFIG_PASSINGLINK_BT_RELAY_RECEIVER)
+  bluetooth_relay_init();
+#endif
+
   err = bt_le_adv_start(&pl_bt_adv_params, pl_bt_adv_data, ARRAY_SIZE(pl_bt_adv_data), nullptr, 0);
   if (err) {
     LOG_ERR("advertising failed to start: error = %d", err);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+
 #if defined(CONFIG_PASSINGLINK_BT)
 
 // clang-format off
@@ -11,6 +13,45 @@
   0x4d, 0x21, 0x09, 0x12,
 // clang-format on
 
+struct bt_conn;
+struct bt_gatt_attr;
+
 void bluetooth_init();
 
+// Parameters negotiated with the central, and notification latency statistics.
+struct BluetoothLinkStats {
+  bool connected;
+
+  // Connection interval in units of 1.25ms, peripheral latency in events, timeout in 10ms.
+  uint16_t interval;
+  uint16_t latency;
+  uint16_t timeout;
+
+  // BT_GAP_LE_PHY_*
+  uint8_t tx_phy;
+  uint8_t rx_phy;
+
+  // Maximum link layer payload, in bytes.
+  uint16_t tx_max_len;
+  uint16_t rx_max_len;
+
+  // Time between queueing a notification and the controller reporting it as sent, in us.
+  uint32_t notify_count;
+  uint32_t notify_last_us;
+  uint32_t notify_min_us;
+  uint32_t notify_max_us;
+  uint64_t notify_total_us;
+};
+
+BluetoothLinkStats bluetooth_get_link_stats();
+
+// Send a notification, recording its latency in the link statistics.
+int bluetooth_notify(struct bt_conn* conn, const struct bt_gatt_attr* attr, const void* data,
+                     uint16_t len);
+
+#if defined(CONFIG_PASSINGLINK_BT_RELAY_RECEIVER)
+// Start looking for a stick to relay inputs from.
+void bluetooth_relay_init();
+#endif
+
 #endif
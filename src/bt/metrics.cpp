@@ -0,0 +1,243 @@
+#include <zephyr.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <bluetooth/uuid.h>
+
+#include "bt/bt.h"
+#include "metrics/metrics.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(bt_metrics);
+
+// Streams the report latency histogram, missed poll counters, and trace ring to subscribers.
+//
+// Every CONFIG_PASSINGLINK_BT_METRICS_INTERVAL_MS, a batch is sent to each subscribed connection:
+//   - one counters frame
+//   - the histogram, split across as many frames as the MTU requires
+//   - trace entries that haven't been sent yet, in at most CONFIG_PASSINGLINK_BT_METRICS_BATCH
+//     frames
+// Trace entries that don't fit are left for the next batch. Only the ones that get overwritten in
+// the ring before then are dropped, and their sequence numbers make the gap visible.
+//
+// Every notification starts with a MetricsFrameType byte, followed by a type-specific byte
+// (zero, the index of the first histogram bucket, or the number of trace entries), followed by
+// little endian payload.
+//
+// The streaming is done from a preemptible thread at the lowest application priority. The HID
+// work queue is cooperative, so it's never held up behind this: the system work queue would not
+// do, since a cooperative work item that's running can't be preempted by the HID queue.
+
+enum class MetricsFrameType : uint8_t {
+  Counters = 0,
+  Histogram = 1,
+  Trace = 2,
+};
+
+// Switching report timing strategies resets the counters, and restarts the trace sequence numbers
+// from zero, so every sample after a counters frame belongs to the strategy it's tagged with.
+struct __attribute__((packed)) MetricsCountersFrame {
+  uint8_t type;
+  uint8_t timing; // HidTiming::tag()
+  uint32_t reports;
+  uint32_t missed_polls;
+  uint16_t timing_delay_ticks;
+};
+
+struct __attribute__((packed)) MetricsTraceFrameEntry {
+  uint32_t sequence;
+  uint32_t tick;
+  uint16_t latency_ticks;
+  uint16_t missed_polls;
+};
+
+static constexpr size_t METRICS_FRAME_HEADER_SIZE = 2;
+
+// Notification payload sizes for the default 23 byte ATT MTU, and for the largest one we ask for.
+static constexpr size_t METRICS_FRAME_MIN_SIZE = 20;
+static constexpr size_t METRICS_FRAME_MAX_SIZE = 244;
+
+static struct bt_uuid_128 bt_metrics_svc_uuid = BT_UUID_INIT_128(0x00, 0x02, PL_BT_UUID_PREFIX);
+static struct bt_uuid_128 bt_metrics_stream_uuid = BT_UUID_INIT_128(0x01, 0x02, PL_BT_UUID_PREFIX);
+
+static atomic_t subscribed;
+
+// Only touched by the streaming thread: subscribing asks it to reset the cursor instead.
+static uint32_t trace_cursor;
+static atomic_t trace_cursor_reset;
+
+static void bt_metrics_ccc_changed(const struct bt_gatt_attr* attr, uint16_t value) {
+  bool enabled = value == BT_GATT_CCC_NOTIFY;
+  LOG_INF("metrics streaming %s", enabled ? "enabled" : "disabled");
+  atomic_set(&subscribed, enabled);
+
+  // Start the trace from whatever is currently in the ring.
+  atomic_set(&trace_cursor_reset, true);
+}
+
+static ssize_t bt_metrics_read(struct bt_conn* conn, const struct bt_gatt_attr* attr, void* buf,
+                               uint16_t len, uint16_t offset) {
+  MetricsCounters counters;
+  metrics_get_counters(&counters);
+
+  MetricsCountersFrame frame = {};
+  frame.type = static_cast<uint8_t>(MetricsFrameType::Counters);
+  frame.timing = counters.timing;
+  frame.reports = counters.reports;
+  frame.missed_polls = counters.missed_polls;
+  frame.timing_delay_ticks = counters.timing_delay_ticks;
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &frame, sizeof(frame));
+}
+
+// clang-format off
+BT_GATT_SERVICE_DEFINE(bt_metrics_svc,
+  BT_GATT_PRIMARY_SERVICE(&bt_metrics_svc_uuid),
+  BT_GATT_CHARACTERISTIC(
+    &bt_metrics_stream_uuid.uuid,
+    BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+#if CONFIG_PASSINGLINK_BT_AUTHENTICATION
+    BT_GATT_PERM_READ_ENCRYPT,
+#else
+    BT_GATT_PERM_READ,
+#endif
+    bt_metrics_read,
+    nullptr,
+    nullptr
+  ),
+  BT_GATT_CCC(
+    bt_metrics_ccc_changed,
+#if CONFIG_PASSINGLINK_BT_AUTHENTICATION
+    BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT
+#else
+    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE
+#endif
+  ),
+);
+// clang-format on
+
+static const struct bt_gatt_attr* bt_metrics_stream_attr = &bt_metrics_svc.attrs[2];
+
+struct MetricsBatch {
+  MetricsCounters counters;
+  array<MetricsTraceEntry, CONFIG_PASSINGLINK_BT_METRICS_BATCH * METRICS_FRAME_MAX_SIZE /
+                             sizeof(MetricsTraceFrameEntry)>
+    trace;
+  size_t trace_count;
+
+  // The smallest number of trace entries that made it to any connection.
+  optional<size_t> trace_sent;
+};
+
+// Send a batch to a single connection. Returns false if the controller ran out of buffers.
+// The number of trace entries that were sent is returned in trace_sent either way.
+static bool bt_metrics_send(struct bt_conn* conn, const MetricsBatch& batch, size_t* trace_sent) {
+  *trace_sent = 0;
+
+  size_t frame_size = bt_gatt_get_mtu(conn) - 3;
+  frame_size = max(METRICS_FRAME_MIN_SIZE, min(frame_size, METRICS_FRAME_MAX_SIZE));
+
+  array<uint8_t, METRICS_FRAME_MAX_SIZE> buf;
+  auto notify = [&](size_t len) {
+    int rc = bluetooth_notify(conn, bt_metrics_stream_attr, buf.data(), len);
+    if (rc != 0) {
+      LOG_DBG("notification failed: rc = %d", rc);
+      return false;
+    }
+    return true;
+  };
+
+  MetricsCountersFrame counters = {};
+  counters.type = static_cast<uint8_t>(MetricsFrameType::Counters);
+  counters.timing = batch.counters.timing;
+  counters.reports = batch.counters.reports;
+  counters.missed_polls = batch.counters.missed_polls;
+  counters.timing_delay_ticks = batch.counters.timing_delay_ticks;
+  memcpy(buf.data(), &counters, sizeof(counters));
+  if (!notify(sizeof(counters))) {
+    return false;
+  }
+
+  size_t buckets_per_frame = (frame_size - METRICS_FRAME_HEADER_SIZE) / sizeof(uint32_t);
+  for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i += buckets_per_frame) {
+    size_t n = min(buckets_per_frame, METRICS_HISTOGRAM_BUCKETS - i);
+    buf[0] = static_cast<uint8_t>(MetricsFrameType::Histogram);
+    buf[1] = i;
+    memcpy(&buf[METRICS_FRAME_HEADER_SIZE], &batch.counters.histogram[i], n * sizeof(uint32_t));
+    if (!notify(METRICS_FRAME_HEADER_SIZE + n * sizeof(uint32_t))) {
+      return false;
+    }
+  }
+
+  size_t entries_per_frame =
+    (frame_size - METRICS_FRAME_HEADER_SIZE) / sizeof(MetricsTraceFrameEntry);
+  size_t trace_frames = 0;
+  for (size_t i = 0; i < batch.trace_count && trace_frames < CONFIG_PASSINGLINK_BT_METRICS_BATCH;
+       i += entries_per_frame, ++trace_frames) {
+    size_t n = min(entries_per_frame, batch.trace_count - i);
+    buf[0] = static_cast<uint8_t>(MetricsFrameType::Trace);
+    buf[1] = n;
+    for (size_t j = 0; j < n; ++j) {
+      const MetricsTraceEntry& entry = batch.trace[i + j];
+      MetricsTraceFrameEntry frame_entry = {
+        .sequence = entry.sequence,
+        .tick = entry.tick,
+        .latency_ticks = entry.latency_ticks,
+        .missed_polls = entry.missed_polls,
+      };
+      memcpy(&buf[METRICS_FRAME_HEADER_SIZE + j * sizeof(frame_entry)], &frame_entry,
+             sizeof(frame_entry));
+    }
+    if (!notify(METRICS_FRAME_HEADER_SIZE + n * sizeof(MetricsTraceFrameEntry))) {
+      return false;
+    }
+    *trace_sent += n;
+  }
+
+  return true;
+}
+
+static void bt_metrics_thread_main(void*, void*, void*) {
+  static MetricsBatch batch;
+  while (true) {
+    k_msleep(CONFIG_PASSINGLINK_BT_METRICS_INTERVAL_MS);
+    if (!atomic_get(&subscribed)) {
+      continue;
+    }
+
+    if (atomic_cas(&trace_cursor_reset, true, false)) {
+      trace_cursor = 0;
+    }
+
+    metrics_get_counters(&batch.counters);
+    batch.trace_count = metrics_get_trace(batch.trace, &trace_cursor);
+    batch.trace_sent.reset();
+
+    bt_conn_foreach(
+      BT_CONN_TYPE_LE,
+      [](struct bt_conn* conn, void* data) {
+        if (!bt_gatt_is_subscribed(conn, bt_metrics_stream_attr, BT_GATT_CCC_NOTIFY)) {
+          return;
+        }
+        auto batch = static_cast<MetricsBatch*>(data);
+        size_t trace_sent;
+        if (!bt_metrics_send(conn, *batch, &trace_sent)) {
+          LOG_DBG("batch truncated");
+        }
+        batch->trace_sent = min(batch->trace_sent.get_or(trace_sent), trace_sent);
+      },
+      &batch);
+
+    // Pick up from the first entry that didn't make it out, which is bound to happen at smaller
+    // MTUs: at the default one, a trace frame only holds a single entry.
+    if (batch.trace_sent) {
+      trace_cursor -= batch.trace_count - *batch.trace_sent;
+    }
+  }
+}
+
+K_THREAD_DEFINE(bt_metrics_thread, CONFIG_PASSINGLINK_BT_METRICS_STACK_SIZE,
+                bt_metrics_thread_main, nullptr, nullptr, nullptr,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
@@ -0,0 +1,614 @@
+#include <zephyr.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/conn.h>
+#include <bluetooth/gatt.h>
+#include <bluetooth/uuid.h>
+#include <shell/shell.h>
+
+#include "bt/bt.h"
+#include "input/input.h"
+#include "metrics/metrics.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(bt_relay);
+
+// Relays a stick's buttons to a dongle, which presents them over USB as if they were its own.
+//
+// The source (the stick) samples its raw button state every CONFIG_PASSINGLINK_BT_RELAY_SAMPLE_US,
+// and notifies subscribers whenever it changes, and once right after they subscribe. The receiver
+// (the dongle) connects as a central at the 7.5ms minimum connection interval with no peripheral
+// latency, and feeds every notification into input_set_raw_state(), so everything downstream of it
+// (debouncing, SOCD, console probing, the USB report timing) is the same as for local inputs.
+//
+// The receiver pairs with the first stick it finds advertising the relay service, and bonds with
+// it. From then on, it only ever connects to that stick, by address, without scanning, until the
+// bond is removed with `btrelay forget`. The relay characteristic requires an encrypted link, so a
+// stick only relays to a dongle it has paired with. With CONFIG_BT_SETTINGS on both ends, the bond
+// survives reboots.
+//
+// A dropped link is noticed after the supervision timeout, which the receiver forces down to
+// CONFIG_PASSINGLINK_BT_RELAY_TIMEOUT_MS, whatever the source asks for. The receiver then releases
+// every button, and keeps trying to reconnect to the same stick, reusing the attribute handles it
+// discovered the first time.
+//
+// Every frame carries the source's side of the latency budget: its sampling interval, and how long
+// its previous notification took from being queued to being sent. The receiver adds the time from
+// a notification's arrival to the host picking up the first report that includes it, so that the
+// `btrelay` shell command can give the end to end latency from a button press to the host.
+
+struct __attribute__((packed)) RelayFrame {
+  uint8_t sequence;
+
+  // RawInputState.
+  uint32_t buttons;
+
+  uint16_t sample_us;
+  uint16_t queue_us;
+};
+
+static_assert(sizeof(RawInputState) == sizeof(uint32_t));
+
+static struct bt_uuid_128 bt_relay_svc_uuid = BT_UUID_INIT_128(0x00, 0x03, PL_BT_UUID_PREFIX);
+static struct bt_uuid_128 bt_relay_input_uuid = BT_UUID_INIT_128(0x01, 0x03, PL_BT_UUID_PREFIX);
+
+#if defined(CONFIG_PASSINGLINK_BT_RELAY_SOURCE)
+static atomic_t subscribed;
+static atomic_t resend;
+
+// The sampling thread sleeps on this while nobody is subscribed.
+K_SEM_DEFINE(relay_subscribed_sem, 0, 1);
+
+static void bt_relay_ccc_changed(const struct bt_gatt_attr* attr, uint16_t value) {
+  bool enabled = value == BT_GATT_CCC_NOTIFY;
+  LOG_INF("relay %s", enabled ? "enabled" : "disabled");
+  atomic_set(&subscribed, enabled);
+  if (enabled) {
+    k_sem_give(&relay_subscribed_sem);
+  }
+
+  // A new subscriber doesn't know what's held yet. Notifications can't be sent from here, so leave
+  // it to the sampling thread.
+  atomic_set(&resend, true);
+}
+
+static ssize_t bt_relay_read(struct bt_conn* conn, const struct bt_gatt_attr* attr, void* buf,
+                             uint16_t len, uint16_t offset) {
+  RawInputState input;
+  if (!input_get_raw_state(&input)) {
+    return BT_GATT_ERR(BT_ATT_ERR_ATTRIBUTE_NOT_FOUND);
+  }
+  return bt_gatt_attr_read(conn, attr, buf, len, offset, &input, sizeof(input));
+}
+
+// clang-format off
+BT_GATT_SERVICE_DEFINE(bt_relay_svc,
+  BT_GATT_PRIMARY_SERVICE(&bt_relay_svc_uuid),
+  BT_GATT_CHARACTERISTIC(
+    &bt_relay_input_uuid.uuid,
+    BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+    BT_GATT_PERM_READ_ENCRYPT,
+    bt_relay_read,
+    nullptr,
+    nullptr
+  ),
+  BT_GATT_CCC(
+    bt_relay_ccc_changed,
+    BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT
+  ),
+);
+// clang-format on
+
+static const struct bt_gatt_attr* bt_relay_input_attr = &bt_relay_svc.attrs[2];
+
+static uint8_t relay_sequence;
+static uint32_t relay_frames_sent;
+static uint32_t relay_frames_failed;
+
+static void bt_relay_thread_main(void*, void*, void*) {
+  RawInputState last = {};
+  while (true) {
+    if (!atomic_get(&subscribed)) {
+      k_sem_take(&relay_subscribed_sem, K_FOREVER);
+      continue;
+    }
+    k_usleep(CONFIG_PASSINGLINK_BT_RELAY_SAMPLE_US);
+
+    RawInputState input;
+    if (!input_get_raw_state(&input)) {
+      continue;
+    }
+
+    if (memcmp(&input, &last, sizeof(input)) == 0 && !atomic_get(&resend)) {
+      continue;
+    }
+
+    RelayFrame frame;
+    frame.sequence = relay_sequence;
+    memcpy(&frame.buttons, &input, sizeof(input));
+    frame.sample_us = min<uint32_t>(CONFIG_PASSINGLINK_BT_RELAY_SAMPLE_US, UINT16_MAX);
+    frame.queue_us = min<uint32_t>(bluetooth_get_link_stats().notify_last_us, UINT16_MAX);
+
+    // On failure (most likely out of buffers), the change is retried at the next sample.
+    int rc = bluetooth_notify(nullptr, bt_relay_input_attr, &frame, sizeof(frame));
+    if (rc != 0) {
+      LOG_DBG("notification failed: rc = %d", rc);
+      ++relay_frames_failed;
+      continue;
+    }
+
+    ++relay_sequence;
+    ++relay_frames_sent;
+    atomic_set(&resend, false);
+    last = input;
+  }
+}
+
+K_THREAD_DEFINE(bt_relay_thread, CONFIG_PASSINGLINK_BT_RELAY_STACK_SIZE, bt_relay_thread_main,
+                nullptr, nullptr, nullptr, K_PRIO_PREEMPT(0), 0, 0);
+
+#if defined(CONFIG_SHELL)
+static int cmd_btrelay(const struct shell* shell, size_t argc, char** argv) {
+  BluetoothLinkStats stats = bluetooth_get_link_stats();
+  shell_print(shell, "btrelay: %s", atomic_get(&subscribed) ? "subscribed" : "not subscribed");
+  shell_print(shell, "frames: %u sent, %u failed", relay_frames_sent, relay_frames_failed);
+  if (stats.notify_count != 0) {
+    shell_print(shell, "queue to sent: min = %u us, avg = %u us, max = %u us", stats.notify_min_us,
+                static_cast<uint32_t>(stats.notify_total_us / stats.notify_count),
+                stats.notify_max_us);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(btrelay, NULL, "Show Bluetooth input relay statistics", cmd_btrelay);
+#endif
+
+#elif defined(CONFIG_PASSINGLINK_BT_RELAY_RECEIVER)
+
+struct RelayStats {
+  uint32_t frames;
+  uint32_t lost;
+
+  // The source's half of the latency budget, as reported in its frames.
+  uint32_t sample_us;
+  uint32_t queue_max_us;
+  uint64_t queue_total_us;
+
+  // Time from the last frame received over a lost link to the first one over the new link, in ms.
+  // This includes the supervision timeout, which is most of the outage.
+  uint32_t connects;
+  uint32_t reconnect_last_ms;
+  uint32_t reconnect_max_ms;
+};
+
+static RelayStats relay_stats;
+
+static struct bt_conn* relay_conn;
+
+// The stick we're bonded with. Until there is one, relay_peer is the stick being paired with.
+static bool relay_bonded;
+static bt_addr_le_t relay_peer;
+
+// Handles found by discovery, kept for reconnecting to the same peer. Zero if unknown.
+static uint16_t relay_value_handle;
+static uint16_t relay_ccc_handle;
+
+static struct bt_uuid_16 relay_ccc_uuid = BT_UUID_INIT_16(BT_UUID_GATT_CCC_VAL);
+static struct bt_gatt_discover_params relay_discover_params;
+static struct bt_gatt_subscribe_params relay_subscribe_params;
+
+static optional<uint8_t> relay_last_sequence;
+static int64_t relay_last_frame_time;
+static optional<int64_t> relay_lost_time;
+static bool relay_receiving;
+
+static const struct bt_le_scan_param relay_scan_param = BT_LE_SCAN_PARAM_INIT(
+  BT_LE_SCAN_TYPE_PASSIVE, BT_LE_SCAN_OPT_FILTER_DUPLICATE, BT_GAP_SCAN_FAST_INTERVAL,
+  BT_GAP_SCAN_FAST_INTERVAL);
+
+// Scan and initiate continuously, so that the stick is found on its first advertisement.
+static const struct bt_conn_le_create_param relay_create_param = BT_CONN_LE_CREATE_PARAM_INIT(
+  BT_CONN_LE_OPT_NONE, BT_GAP_SCAN_FAST_INTERVAL, BT_GAP_SCAN_FAST_INTERVAL);
+
+// 7.5ms interval, no peripheral latency.
+static const struct bt_le_conn_param relay_conn_param = {
+  .interval_min = 6,
+  .interval_max = 6,
+  .latency = 0,
+  .timeout = CONFIG_PASSINGLINK_BT_RELAY_TIMEOUT_MS / 10,
+};
+
+static void bt_relay_scan_start();
+static k_delayed_work relay_reconnect_work;
+
+static void bt_relay_release() {
+  RawInputState released = {};
+  input_set_raw_state(&released);
+}
+
+static void bt_relay_connect(const bt_addr_le_t* addr) {
+  char addr_str[BT_ADDR_LE_STR_LEN];
+  bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
+
+  int rc = bt_conn_le_create(addr, &relay_create_param, &relay_conn_param, &relay_conn);
+  if (rc != 0) {
+    LOG_WRN("failed to connect to %s: rc = %d", addr_str, rc);
+    relay_conn = nullptr;
+    if (relay_bonded) {
+      k_delayed_work_submit(&relay_reconnect_work, K_MSEC(100));
+    } else {
+      bt_relay_scan_start();
+    }
+    return;
+  }
+  LOG_INF("connecting to %s", addr_str);
+}
+
+static bool bt_relay_ad_has_service(struct bt_data* data, void* user_data) {
+  bool* found = static_cast<bool*>(user_data);
+  if (data->type != BT_DATA_UUID128_ALL && data->type != BT_DATA_UUID128_SOME) {
+    return true;
+  }
+
+  for (size_t i = 0; i + 16 <= data->data_len; i += 16) {
+    if (memcmp(&data->data[i], bt_relay_svc_uuid.val, 16) == 0) {
+      *found = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bt_relay_device_found(const bt_addr_le_t* addr, int8_t rssi, uint8_t type,
+                                  struct net_buf_simple* ad) {
+  if (relay_conn || (type != BT_GAP_ADV_TYPE_ADV_IND && type != BT_GAP_ADV_TYPE_ADV_DIRECT_IND)) {
+    return;
+  }
+
+  bool found = false;
+  bt_data_parse(ad, bt_relay_ad_has_service, &found);
+  if (!found) {
+    return;
+  }
+
+  int rc = bt_le_scan_stop();
+  if (rc != 0) {
+    LOG_ERR("failed to stop scanning: rc = %d", rc);
+    return;
+  }
+  bt_relay_connect(addr);
+}
+
+static void bt_relay_scan_start() {
+  int rc = bt_le_scan_start(&relay_scan_param, bt_relay_device_found);
+  if (rc != 0 && rc != -EALREADY) {
+    LOG_ERR("failed to start scanning: rc = %d", rc);
+  }
+}
+
+// The disconnected callback runs before the connection is released, and a new connection to the
+// same address can't be created until it is.
+static void bt_relay_reconnect(struct k_work*) {
+  if (relay_conn) {
+    return;
+  }
+
+  if (relay_bonded) {
+    bt_relay_connect(&relay_peer);
+  } else {
+    bt_relay_scan_start();
+  }
+}
+
+
+// If the cached handles didn't get us any frames, the stick's attribute table may have changed.
+static void bt_relay_check_receiving(struct k_work*) {
+  if (!relay_conn || relay_receiving) {
+    return;
+  }
+
+  LOG_WRN("no frames received, reconnecting to rediscover");
+  relay_value_handle = 0;
+  relay_ccc_handle = 0;
+  bt_conn_disconnect(relay_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+}
+
+static k_delayed_work relay_check_work;
+
+static uint8_t bt_relay_notify(struct bt_conn* conn, struct bt_gatt_subscribe_params* params,
+                               const void* data, uint16_t length) {
+  if (!data) {
+    LOG_INF("unsubscribed");
+    params->value_handle = 0;
+    return BT_GATT_ITER_STOP;
+  }
+
+  if (length < sizeof(RelayFrame)) {
+    LOG_WRN("short frame: length = %u", length);
+    return BT_GATT_ITER_CONTINUE;
+  }
+
+  RelayFrame frame;
+  memcpy(&frame, data, sizeof(frame));
+  relay_last_frame_time = k_uptime_get();
+
+  RawInputState input;
+  memcpy(&input, &frame.buttons, sizeof(input));
+  metrics_record_relay_input();
+  input_set_raw_state(&input);
+
+  ++relay_stats.frames;
+  if (relay_last_sequence) {
+    relay_stats.lost += static_cast<uint8_t>(frame.sequence - *relay_last_sequence - 1);
+  }
+  relay_last_sequence = frame.sequence;
+  relay_stats.sample_us = frame.sample_us;
+  relay_stats.queue_total_us += frame.queue_us;
+  relay_stats.queue_max_us = max<uint32_t>(relay_stats.queue_max_us, frame.queue_us);
+
+  if (!relay_receiving) {
+    relay_receiving = true;
+    ++relay_stats.connects;
+    if (relay_lost_time) {
+      uint32_t ms = relay_last_frame_time - *relay_lost_time;
+      relay_stats.reconnect_last_ms = ms;
+      relay_stats.reconnect_max_ms = max(relay_stats.reconnect_max_ms, ms);
+      relay_lost_time.reset();
+      LOG_INF("relay restored after %u ms", ms);
+    } else {
+      LOG_INF("relay established");
+    }
+  }
+  return BT_GATT_ITER_CONTINUE;
+}
+
+static void bt_relay_subscribe(struct bt_conn* conn) {
+  relay_subscribe_params = {};
+  relay_subscribe_params.notify = bt_relay_notify;
+  relay_subscribe_params.value = BT_GATT_CCC_NOTIFY;
+  relay_subscribe_params.value_handle = relay_value_handle;
+  relay_subscribe_params.ccc_handle = relay_ccc_handle;
+
+  int rc = bt_gatt_subscribe(conn, &relay_subscribe_params);
+  if (rc != 0 && rc != -EALREADY) {
+    LOG_ERR("failed to subscribe: rc = %d", rc);
+    bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    return;
+  }
+
+  k_delayed_work_submit(&relay_check_work, K_MSEC(500));
+}
+
+static uint8_t bt_relay_discovered(struct bt_conn* conn, const struct bt_gatt_attr* attr,
+                                   struct bt_gatt_discover_params* params) {
+  if (!attr) {
+    LOG_ERR("relay service not found on peer");
+    bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    return BT_GATT_ITER_STOP;
+  }
+
+  if (params->type == BT_GATT_DISCOVER_CHARACTERISTIC) {
+    auto chrc = static_cast<const struct bt_gatt_chrc*>(attr->user_data);
+    relay_value_handle = chrc->value_handle;
+
+    params->uuid = &relay_ccc_uuid.uuid;
+    params->start_handle = relay_value_handle + 1;
+    params->type = BT_GATT_DISCOVER_DESCRIPTOR;
+    int rc = bt_gatt_discover(conn, params);
+    if (rc != 0) {
+      LOG_ERR("CCC discovery failed: rc = %d", rc);
+      bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+    }
+    return BT_GATT_ITER_STOP;
+  }
+
+  relay_ccc_handle = attr->handle;
+  bt_relay_subscribe(conn);
+  return BT_GATT_ITER_STOP;
+}
+
+static void bt_relay_discover(struct bt_conn* conn) {
+  relay_discover_params = {};
+  relay_discover_params.uuid = &bt_relay_input_uuid.uuid;
+  relay_discover_params.func = bt_relay_discovered;
+  relay_discover_params.start_handle = 0x0001;
+  relay_discover_params.end_handle = 0xffff;
+  relay_discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+  int rc = bt_gatt_discover(conn, &relay_discover_params);
+  if (rc != 0) {
+    LOG_ERR("discovery failed: rc = %d", rc);
+    bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+  }
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+static struct bt_conn_cb relay_connection_cbs = {
+  .connected =
+    [](struct bt_conn* conn, uint8_t err) {
+      if (conn != relay_conn) {
+        return;
+      }
+
+      if (err) {
+        // Keep trying the stick we're bonded with: it's most likely just out of range or off.
+        LOG_WRN("connection failed (err 0x%02x)", err);
+        bt_conn_unref(relay_conn);
+        relay_conn = nullptr;
+        k_delayed_work_submit(&relay_reconnect_work, K_NO_WAIT);
+        return;
+      }
+
+      const bt_addr_le_t* addr = bt_conn_get_dst(conn);
+      if (!relay_bonded) {
+        bt_addr_le_copy(&relay_peer, addr);
+        relay_value_handle = 0;
+        relay_ccc_handle = 0;
+      }
+      relay_last_sequence.reset();
+      relay_receiving = false;
+
+      // Pair (or with a bond, encrypt) before anything else: the relay characteristic needs it.
+      int rc = bt_conn_set_security(conn, BT_SECURITY_L2);
+      if (rc != 0) {
+        LOG_ERR("failed to set security: rc = %d", rc);
+        bt_conn_disconnect(conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+      }
+    },
+  .disconnected =
+    [](struct bt_conn* conn, uint8_t reason) {
+      if (conn != relay_conn) {
+        return;
+      }
+
+      LOG_WRN("relay lost (reason 0x%02x)", reason);
+      bt_relay_release();
+      k_delayed_work_cancel(&relay_check_work);
+      if (relay_receiving) {
+        relay_lost_time = relay_last_frame_time;
+      }
+      relay_receiving = false;
+
+      bt_conn_unref(relay_conn);
+      relay_conn = nullptr;
+      k_delayed_work_submit(&relay_reconnect_work, K_NO_WAIT);
+    },
+  .le_param_req =
+    [](struct bt_conn* conn, struct bt_le_conn_param* param) {
+      if (conn != relay_conn) {
+        return true;
+      }
+
+      // The stick asks for a timeout long enough to ride out a busy host, which would leave us
+      // holding its buttons for seconds after it's gone. Keep ours.
+      param->timeout = relay_conn_param.timeout;
+      return true;
+    },
+  .security_changed =
+    [](struct bt_conn* conn, bt_security_t level, enum bt_security_err err) {
+      if (conn != relay_conn) {
+        return;
+      }
+
+      if (err) {
+        // If we're bonded, the stick has most likely lost its keys: it takes `btrelay forget` to
+        // pair again, rather than trusting whatever shows up at that address.
+        LOG_WRN("relay security failed (err %d)", err);
+        bt_conn_disconnect(conn, BT_HCI_ERR_AUTH_FAIL);
+        return;
+      }
+
+      if (!relay_bonded) {
+        char addr_str[BT_ADDR_LE_STR_LEN];
+        bt_addr_le_to_str(&relay_peer, addr_str, sizeof(addr_str));
+        LOG_INF("bonded with %s", addr_str);
+        relay_bonded = true;
+      }
+
+      if (relay_value_handle != 0 && relay_ccc_handle != 0) {
+        bt_relay_subscribe(conn);
+      } else {
+        bt_relay_discover(conn);
+      }
+    },
+};
+#pragma GCC diagnostic pop
+
+static void bt_relay_find_bond(const struct bt_bond_info* info, void*) {
+  if (!relay_bonded) {
+    bt_addr_le_copy(&relay_peer, &info->addr);
+    relay_bonded = true;
+  }
+}
+
+void bluetooth_relay_init() {
+  k_delayed_work_init(&relay_check_work, bt_relay_check_receiving);
+  k_delayed_work_init(&relay_reconnect_work, bt_relay_reconnect);
+  bt_conn_cb_register(&relay_connection_cbs);
+
+  bt_foreach_bond(BT_ID_DEFAULT, bt_relay_find_bond, nullptr);
+  if (relay_bonded) {
+    char addr_str[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(&relay_peer, addr_str, sizeof(addr_str));
+    LOG_INF("bonded with %s", addr_str);
+  }
+  k_delayed_work_submit(&relay_reconnect_work, K_NO_WAIT);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_btrelay(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "forget") == 0) {
+    if (!relay_bonded) {
+      shell_print(shell, "btrelay: not bonded");
+      return 0;
+    }
+
+    // Unpairing drops the connection, if there is one, and the reconnect goes back to scanning.
+    relay_bonded = false;
+    relay_value_handle = 0;
+    relay_ccc_handle = 0;
+    int rc = bt_unpair(BT_ID_DEFAULT, &relay_peer);
+    if (rc != 0) {
+      shell_print(shell, "btrelay: failed to unpair: rc = %d", rc);
+    }
+    if (!relay_conn) {
+      k_delayed_work_submit(&relay_reconnect_work, K_NO_WAIT);
+    }
+    return 0;
+  } else if (argc != 1) {
+    shell_print(shell, "usage: btrelay [forget]");
+    return 0;
+  }
+
+  RelayStats stats = relay_stats;
+  if (relay_receiving) {
+    char addr_str[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(&relay_peer, addr_str, sizeof(addr_str));
+    shell_print(shell, "btrelay: receiving from %s", addr_str);
+  } else {
+    shell_print(shell, "btrelay: %s", relay_conn ? "connecting" : "searching");
+  }
+  if (relay_bonded) {
+    char addr_str[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(&relay_peer, addr_str, sizeof(addr_str));
+    shell_print(shell, "bonded with %s", addr_str);
+  }
+
+  shell_print(shell, "frames: %u, lost: %u", stats.frames, stats.lost);
+  shell_print(shell, "connects: %u, reconnect time: last = %u ms, max = %u ms", stats.connects,
+              stats.reconnect_last_ms, stats.reconnect_max_ms);
+  if (stats.frames == 0) {
+    return 0;
+  }
+
+  MetricsCounters counters;
+  metrics_get_counters(&counters);
+
+  // Sampling adds up to a full interval, half of one on average. Once queued, a notification
+  // waits for the next connection event; that's included in the source's queue time. The time on
+  // air after that is negligible next to the rest.
+  uint32_t queue_avg_us = stats.queue_total_us / stats.frames;
+  uint32_t usb_avg_us = 0;
+  if (counters.relay_inputs != 0) {
+    usb_avg_us = counters.relay_usb_total_us / counters.relay_inputs;
+  }
+  uint32_t avg_us = stats.sample_us / 2 + queue_avg_us + usb_avg_us;
+  uint32_t max_us = stats.sample_us + stats.queue_max_us + counters.relay_usb_max_us;
+  shell_print(shell, "latency: avg = %u us, max = %u us", avg_us, max_us);
+  shell_print(shell, "  source sampling: avg = %u us, max = %u us", stats.sample_us / 2,
+              stats.sample_us);
+  shell_print(shell, "  source queue to sent: avg = %u us, max = %u us", queue_avg_us,
+              stats.queue_max_us);
+  shell_print(shell, "  arrival to USB: avg = %u us, max = %u us", usb_avg_us,
+              counters.relay_usb_max_us);
+  return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(btrelay, NULL, "Show relay statistics, or forget the bonded stick",
+                       cmd_btrelay, 1, 1);
+#endif
+
+#endif
@@ -10,7 +10,6 @@
 #include "input/input.h"
 #include "input/profile.h"
 #include "input/socd.h"
-#include "metrics/metrics.h"
 #include "output/usb/hid.h"
 #include "types.h"
 #include "util.h"
@@ -343,27 +342,43 @@ struct OutputMenu : public Menu {
   SOCDMenu socd_;
 };
 
+struct TimingStrategyRadioMenu : public RadioMenu {
+  TimingStrategyRadioMenu() : RadioMenu("Strategy") {}
+
+  size_t get_selected_option() final { return static_cast<size_t>(usb_hid_get_timing().strategy); }
+  size_t get_option_count() final { return static_cast<size_t>(HidTimingStrategy::Count); }
+  void on_option_selected(size_t index) final {
+    HidTiming timing = usb_hid_get_timing();
+    timing.strategy = static_cast<HidTimingStrategy>(index);
+    usb_hid_set_timing(timing);
+  }
+
+  const char* get_option_name(size_t index) final {
+    return usb_hid_timing_strategy_name(static_cast<HidTimingStrategy>(index));
+  }
+};
+
 size_t usb_delay_print(span<char> buf) {
-  uint32_t ticks = usb_hid_get_report_delay_ticks();
+  uint32_t ticks = usb_hid_get_timing().delay_ticks;
   return snprintf(buf.data(), buf.size(), "%" PRIu32 " ticks", ticks);
 }
 
 void usb_delay_increase() {
-  uint32_t ticks = usb_hid_get_report_delay_ticks();
-  if (k_ticks_to_us_ceil32(ticks) > 1000) {
+  HidTiming timing = usb_hid_get_timing();
+  if (timing.delay_ticks >= usb_hid_get_max_report_delay_ticks()) {
     return;
   }
-  usb_hid_set_report_delay_ticks(ticks + 1);
-  metrics_reset();
+  ++timing.delay_ticks;
+  usb_hid_set_timing(timing);
 }
 
 void usb_delay_decrease() {
-  uint32_t ticks = usb_hid_get_report_delay_ticks();
-  if (ticks == 0) {
+  HidTiming timing = usb_hid_get_timing();
+  if (timing.delay_ticks == 0) {
     return;
   }
-  usb_hid_set_report_delay_ticks(ticks - 1);
-  metrics_reset();
+  --timing.delay_ticks;
+  usb_hid_set_timing(timing);
 }
 
 struct USBDelayMenu : public Menu {
@@ -375,12 +390,14 @@ struct USBDelayMenu : public Menu {
 
   size_t menu_items(span<MenuBase*> buffer) final {
     // TODO: Implement nonselectable items, so the cursor starts on increase.
-    buffer[0] = &delay_;
-    buffer[1] = &increase_;
-    buffer[2] = &decrease_;
-    return 3;
+    buffer[0] = &strategy_;
+    buffer[1] = &delay_;
+    buffer[2] = &increase_;
+    buffer[3] = &decrease_;
+    return 4;
   }
 
+  TimingStrategyRadioMenu strategy_;
   DynamicTextItem delay_;
   ActionItem increase_;
   ActionItem decrease_;
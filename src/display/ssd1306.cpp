@@ -3,10 +3,17 @@
 #include <zephyr.h>
 
 #include <device.h>
-#include <drivers/i2c.h>
 #include <logging/log.h>
 
+#if defined(CONFIG_PASSINGLINK_DISPLAY_SSD1306_I2C)
+#include <drivers/i2c.h>
+#elif defined(CONFIG_PASSINGLINK_DISPLAY_SSD1306_SPI)
+#include <drivers/gpio.h>
+#include <drivers/spi.h>
+#endif
+
 #include "arch.h"
+#include "background.h"
 #include "types.h"
 
 #include "display/font.h"
@@ -15,11 +22,6 @@
 #define LOG_LEVEL LOG_LEVEL_DBG
 LOG_MODULE_REGISTER(ssd1306);
 
-// static I2CManager* i2c;
-static const struct device* i2c_device;
-
-static constexpr uint8_t display_addr = 0x3c;
-
 static constexpr array<uint8_t, 2> ssd1306_set_contrast(uint8_t contrast) {
   return { 0x81, contrast };
 }
@@ -215,20 +217,29 @@ static void ssd1306_cmd_pack(uint8_t* buf, array<uint8_t, N> arg, Args... args)
   ssd1306_cmd_pack(buf + arg.size(), args...);
 }
 
-template <typename... Args>
-static bool ssd1306_command(Args... commands) {
-  uint8_t buf[ssd1306_cmd_size(commands...) + 1];
-  buf[0] = 0x00;
-  ssd1306_cmd_pack(buf + 1, commands...);
+// Over I2C, the kind of transfer is given by a control byte preceding it.
+// Over SPI, it's given by the level of the D/C line.
+enum class TransferType : uint8_t {
+  Command = 0x00,
+  Data = 0x40,
+};
 
-  int rc = i2c_write(i2c_device, buf, sizeof(buf), display_addr);
-  return rc == 0;
+#if defined(CONFIG_PASSINGLINK_DISPLAY_SSD1306_I2C)
+
+static const struct device* i2c_device;
+
+static constexpr uint8_t display_addr = 0x3c;
+
+static bool ssd1306_transport_init() {
+  i2c_device = device_get_binding(DT_LABEL(DT_ALIAS(display_i2c)));
+  return i2c_device;
 }
 
-static bool ssd1306_data(span<uint8_t> bytes) {
+// A full frame takes ~13ms at 400kHz, during which the bus is unavailable to the touchpad.
+static bool ssd1306_write(TransferType type, span<uint8_t> bytes) {
   struct i2c_msg msgs[2];
-  uint8_t write = 0x40;
-  msgs[0].buf = &write;
+  uint8_t control = static_cast<uint8_t>(type);
+  msgs[0].buf = &control;
   msgs[0].len = 1;
   msgs[0].flags = I2C_MSG_WRITE;
 
@@ -240,6 +251,103 @@ static bool ssd1306_data(span<uint8_t> bytes) {
   return rc == 0;
 }
 
+#elif defined(CONFIG_PASSINGLINK_DISPLAY_SSD1306_SPI)
+
+#define SSD1306_SPI_NODE DT_ALIAS(display_spi)
+
+static const struct device* spi_device;
+static const struct device* dc_device;
+
+#if DT_SPI_DEV_HAS_CS_GPIOS(SSD1306_SPI_NODE)
+static struct spi_cs_control spi_cs = {
+  .gpio_pin = DT_SPI_DEV_CS_GPIOS_PIN(SSD1306_SPI_NODE),
+  .gpio_dt_flags = DT_SPI_DEV_CS_GPIOS_FLAGS(SSD1306_SPI_NODE),
+};
+#endif
+
+// The SSD1306 samples on the rising edge of SCLK, with the clock idling low (mode 0).
+static struct spi_config spi_config = {
+  .frequency = DT_PROP(SSD1306_SPI_NODE, spi_max_frequency),
+  .operation = SPI_OP_MODE_MASTER | SPI_WORD_SET(8) | SPI_TRANSFER_MSB,
+  .slave = DT_REG_ADDR(SSD1306_SPI_NODE),
+  .cs = nullptr,
+};
+
+static bool ssd1306_transport_init() {
+  spi_device = device_get_binding(DT_BUS_LABEL(SSD1306_SPI_NODE));
+  if (!spi_device) {
+    LOG_ERR("failed to find SPI device %s", DT_BUS_LABEL(SSD1306_SPI_NODE));
+    return false;
+  }
+
+#if DT_SPI_DEV_HAS_CS_GPIOS(SSD1306_SPI_NODE)
+  spi_cs.gpio_dev = device_get_binding(DT_SPI_DEV_CS_GPIOS_LABEL(SSD1306_SPI_NODE));
+  if (!spi_cs.gpio_dev) {
+    LOG_ERR("failed to find chip select GPIO device");
+    return false;
+  }
+  spi_config.cs = &spi_cs;
+#endif
+
+  dc_device = device_get_binding(DT_GPIO_LABEL(SSD1306_SPI_NODE, dc_gpios));
+  if (!dc_device || gpio_pin_configure(dc_device, DT_GPIO_PIN(SSD1306_SPI_NODE, dc_gpios),
+                                       DT_GPIO_FLAGS(SSD1306_SPI_NODE, dc_gpios) |
+                                         GPIO_OUTPUT_INACTIVE) != 0) {
+    LOG_ERR("failed to configure D/C GPIO");
+    return false;
+  }
+
+#if DT_NODE_HAS_PROP(SSD1306_SPI_NODE, reset_gpios)
+  const struct device* reset_device =
+    device_get_binding(DT_GPIO_LABEL(SSD1306_SPI_NODE, reset_gpios));
+  gpio_pin_t reset_pin = DT_GPIO_PIN(SSD1306_SPI_NODE, reset_gpios);
+  if (!reset_device ||
+      gpio_pin_configure(reset_device, reset_pin,
+                         DT_GPIO_FLAGS(SSD1306_SPI_NODE, reset_gpios) | GPIO_OUTPUT_ACTIVE) != 0) {
+    LOG_ERR("failed to configure reset GPIO");
+    return false;
+  }
+
+  // The reset pulse only needs to be 3us, but VDD needs to be stable before it's released.
+  k_sleep(K_MSEC(1));
+  gpio_pin_set(reset_device, reset_pin, 0);
+  k_sleep(K_MSEC(1));
+#endif
+
+  return true;
+}
+
+// The transfer is handed to the SPI controller's DMA where available (EasyDMA on nRF, or with
+// CONFIG_SPI_STM32_DMA), and the display work queue sleeps until it completes. At 8MHz, a full
+// frame takes ~0.5ms.
+static bool ssd1306_write(TransferType type, span<uint8_t> bytes) {
+  gpio_pin_set(dc_device, DT_GPIO_PIN(SSD1306_SPI_NODE, dc_gpios), type == TransferType::Data);
+
+  struct spi_buf buf = {
+    .buf = bytes.data(),
+    .len = bytes.size(),
+  };
+  struct spi_buf_set tx = {
+    .buffers = &buf,
+    .count = 1,
+  };
+  int rc = spi_write(spi_device, &spi_config, &tx);
+  return rc == 0;
+}
+
+#endif
+
+template <typename... Args>
+static bool ssd1306_command(Args... commands) {
+  uint8_t buf[ssd1306_cmd_size(commands...)];
+  ssd1306_cmd_pack(buf, commands...);
+  return ssd1306_write(TransferType::Command, span(buf, sizeof(buf)));
+}
+
+static bool ssd1306_data(span<uint8_t> bytes) {
+  return ssd1306_write(TransferType::Data, bytes);
+}
+
 struct Framebuffer {
   uint8_t buffer[512];
 };
@@ -294,34 +402,59 @@ struct Display {
     }
   }
 
-  void blit() {
-    if (dirty_) {
+  // Send the framebuffer in chunks, yielding to reports between them.
+  // Returns true once the display is up to date.
+  bool blit() {
+    uint8_t* buf = current_buffer()->buffer;
+    if (blit_offset_ == 0) {
+      if (!dirty_) {
+        return true;
+      }
+
       // TODO: Double buffer?
       dirty_ = false;
-      ssd1306_data(span(current_buffer()->buffer, 512));
+
+      // Rewind to the top left, in case a previous blit was interrupted.
+      ssd1306_command(ssd1306_set_column_address(0, 127), ssd1306_set_page_address(0, 3));
+    }
+
+    while (blit_offset_ < sizeof(Framebuffer::buffer)) {
+      size_t length = min(BLIT_CHUNK_SIZE, sizeof(Framebuffer::buffer) - blit_offset_);
+      ssd1306_data(span(buf + blit_offset_, length));
+      blit_offset_ += length;
+      if (blit_offset_ < sizeof(Framebuffer::buffer) && background_should_yield()) {
+        return false;
+      }
     }
+
+    // Start over if anything got drawn in the meantime.
+    blit_offset_ = 0;
+    return !dirty_;
   }
 
   Framebuffer* current_buffer() { return &first_; }
 
  private:
+  static constexpr size_t BLIT_CHUNK_SIZE = 64;
+
   Framebuffer first_;
   uint8_t buffer_idx_;
   bool dirty_;
+  size_t blit_offset_ = 0;
 };
 
 static Display display;
 static bool initialized;
 
-K_THREAD_STACK_DEFINE(ssd1306_stack, 512);
-static struct k_work_q ssd1306_work_q;
-static struct k_work ssd1306_blit_work;
+static BackgroundJob ssd1306_blit_job("blit", [](BackgroundJob*) { return display.blit(); });
 
 bool ssd1306_init() {
   // TODO: Do this asynchronously.
-  i2c_device = device_get_binding(DT_LABEL(DT_ALIAS(display_i2c)));
-
   initialized = false;
+  if (!ssd1306_transport_init()) {
+    LOG_ERR("failed to initialize display transport");
+    return false;
+  }
 
   for (int i = 0; i < 50; ++i) {
     // clang-format off
@@ -347,9 +480,6 @@ bool ssd1306_init() {
     if (initialized) {
       new (&display) Display();
 
-      k_work_q_start(&ssd1306_work_q, ssd1306_stack, K_THREAD_STACK_SIZEOF(ssd1306_stack), 1);
-      k_work_init(&ssd1306_blit_work, [](struct k_work*) { display.blit(); });
-
       display.blit();
       ssd1306_command(ssd1306_set_display_on(true));
       break;
@@ -382,6 +512,6 @@ void display_draw_logo() {
 
 void display_blit() {
   if (initialized) {
-    k_work_submit(&ssd1306_blit_work);
+    background_submit(&ssd1306_blit_job);
   }
 }
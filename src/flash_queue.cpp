@@ -0,0 +1,252 @@
+#include "flash_queue.h"
+
+#include <zephyr.h>
+
+#include <drivers/flash.h>
+#include <shell/shell.h>
+#include <storage/flash_map.h>
+
+#include "arch.h"
+#include "background.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(flash_queue);
+
+enum class FlashOpType : uint8_t {
+  Erase,
+  Write,
+};
+
+struct FlashOp {
+  FlashOpType type;
+  uint8_t area_id;
+
+  // Advanced as pages and chunks are done.
+  off_t offset;
+  size_t remaining;
+  const uint8_t* data;
+
+  FlashCallback callback;
+  void* arg;
+};
+
+static array<FlashOp, CONFIG_PASSINGLINK_FLASH_QUEUE_SIZE> flash_ops;
+static size_t flash_op_head;
+static size_t flash_op_count;
+
+// Worst case durations of a page erase and of a write chunk, starting from the datasheet values,
+// and raised whenever one takes longer than that.
+static uint32_t erase_page_us = CONFIG_PASSINGLINK_FLASH_ERASE_PAGE_US;
+static uint32_t write_chunk_us = CONFIG_PASSINGLINK_FLASH_WRITE_CHUNK_US;
+
+// Erase up to the end of the page that the operation's offset is in.
+static int flash_queue_erase_page(FlashOp* op, const struct flash_area* fa, size_t* length) {
+  struct flash_pages_info info;
+  int rc = flash_get_page_info_by_offs(flash_area_get_device(fa), fa->fa_off + op->offset, &info);
+  if (rc != 0) {
+    return rc;
+  }
+
+  *length = min<size_t>(op->remaining, info.start_offset + info.size - (fa->fa_off + op->offset));
+  return flash_area_erase(fa, op->offset, *length);
+}
+
+static int flash_queue_write_chunk(FlashOp* op, const struct flash_area* fa, size_t* length) {
+  *length = min<size_t>(op->remaining, CONFIG_PASSINGLINK_FLASH_WRITE_CHUNK);
+  return flash_area_write(fa, op->offset, op->data, *length);
+}
+
+// When the operation at the head of the queue first didn't fit before the next report.
+static optional<int64_t> deferred_since;
+static uint32_t forced_count;
+
+static void flash_queue_finish(int rc) {
+  FlashOp op;
+  {
+    ScopedIRQLock lock;
+    op = flash_ops[flash_op_head];
+    flash_op_head = (flash_op_head + 1) % flash_ops.size();
+    --flash_op_count;
+  }
+  deferred_since.reset();
+
+  if (rc != 0) {
+    LOG_ERR("flash %s failed at offset 0x%lx: rc = %d",
+            op.type == FlashOpType::Erase ? "erase" : "write", static_cast<long>(op.offset), rc);
+  }
+  if (op.callback) {
+    op.callback(rc, op.arg);
+  }
+}
+
+static bool flash_queue_run(BackgroundJob*) {
+  while (true) {
+    FlashOp* op;
+    {
+      ScopedIRQLock lock;
+      if (flash_op_count == 0) {
+        return true;
+      }
+      op = &flash_ops[flash_op_head];
+    }
+
+    uint32_t* estimate_us = op->type == FlashOpType::Erase ? &erase_page_us : &write_chunk_us;
+    bool forced = false;
+    if (!background_has_time(*estimate_us)) {
+      // Erases (and on some chips, write chunks) never fit between reports while the host is
+      // polling, which it always is during provisioning. Once a step has waited long enough, take
+      // a deliberate gap in reports for it instead: the host's polls are NAKed until it's done.
+      int64_t now = k_uptime_get();
+      if (!deferred_since) {
+        deferred_since = now;
+      }
+      if (now - *deferred_since < CONFIG_PASSINGLINK_FLASH_MAX_DEFER_MS) {
+        return false;
+      }
+      forced = true;
+      ++forced_count;
+    } else {
+      deferred_since.reset();
+    }
+
+    const struct flash_area* fa;
+    int rc = flash_area_open(op->area_id, &fa);
+    if (rc != 0) {
+      flash_queue_finish(rc);
+      continue;
+    }
+
+    size_t length = 0;
+    uint32_t begin = get_cycle_count();
+    if (op->type == FlashOpType::Erase) {
+      rc = flash_queue_erase_page(op, fa, &length);
+    } else {
+      rc = flash_queue_write_chunk(op, fa, &length);
+    }
+    uint32_t us = static_cast<uint64_t>(get_cycle_count() - begin) * 1'000'000 / get_cpu_freq();
+    flash_area_close(fa);
+
+    if (us > *estimate_us) {
+      LOG_WRN("flash %s took %u us, more than the expected %u us",
+              op->type == FlashOpType::Erase ? "erase" : "write", us, *estimate_us);
+      *estimate_us = us;
+    }
+
+    op->offset += length;
+    op->remaining -= length;
+    if (op->data) {
+      op->data += length;
+    }
+
+    if (rc != 0 || op->remaining == 0) {
+      flash_queue_finish(rc);
+    }
+
+    // Let a report out between forced steps, rather than stringing them into one long gap.
+    if (forced) {
+      return false;
+    }
+  }
+}
+
+static BackgroundJob flash_job("flash", flash_queue_run, true);
+
+static bool flash_queue_push(const FlashOp& op) {
+  {
+    ScopedIRQLock lock;
+    if (flash_op_count == flash_ops.size()) {
+      LOG_ERR("flash queue full");
+      return false;
+    }
+    flash_ops[(flash_op_head + flash_op_count++) % flash_ops.size()] = op;
+  }
+  background_submit(&flash_job);
+  return true;
+}
+
+bool flash_queue_erase(uint8_t area_id, off_t offset, size_t length, FlashCallback callback,
+                       void* arg) {
+  FlashOp op = {};
+  op.type = FlashOpType::Erase;
+  op.area_id = area_id;
+  op.offset = offset;
+  op.remaining = length;
+  op.callback = callback;
+  op.arg = arg;
+  return flash_queue_push(op);
+}
+
+bool flash_queue_write(uint8_t area_id, off_t offset, const void* data, size_t length,
+                       FlashCallback callback, void* arg) {
+  FlashOp op = {};
+  op.type = FlashOpType::Write;
+  op.area_id = area_id;
+  op.offset = offset;
+  op.remaining = length;
+  op.data = static_cast<const uint8_t*>(data);
+  op.callback = callback;
+  op.arg = arg;
+  return flash_queue_push(op);
+}
+
+#if defined(CONFIG_SHELL) && defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK) && \
+  FLASH_AREA_LABEL_EXISTS(provisioning)
+// Rewrite the provisioning partition with its current contents, and compare the longest gap
+// between reports while doing so with the longest gap beforehand. With `sync`, the rewrite is done
+// in place, the way it was before the queue existed.
+static int cmd_flash_bench(const struct shell* shell, size_t argc, char** argv) {
+  static uint8_t buf[4096];
+  bool sync = argc == 2 && strcmp(argv[1], "sync") == 0;
+  if (FLASH_AREA_SIZE(provisioning) > sizeof(buf)) {
+    shell_print(shell, "flash_bench: provisioning partition too large");
+    return 0;
+  }
+
+  const struct flash_area* fa;
+  if (flash_area_open(FLASH_AREA_ID(provisioning), &fa) != 0 ||
+      flash_area_read(fa, 0, buf, FLASH_AREA_SIZE(provisioning)) != 0) {
+    shell_print(shell, "flash_bench: failed to read provisioning partition");
+    return 0;
+  }
+
+  background_take_max_report_gap_us();
+  k_msleep(100);
+  uint32_t idle_gap_us = background_take_max_report_gap_us();
+
+  int64_t begin = k_uptime_get();
+  int rc;
+  if (sync) {
+    rc = flash_area_erase(fa, 0, FLASH_AREA_SIZE(provisioning));
+    if (rc == 0) {
+      rc = flash_area_write(fa, 0, buf, FLASH_AREA_SIZE(provisioning));
+    }
+  } else {
+    static struct k_sem done;
+    static int result;
+    k_sem_init(&done, 0, 1);
+    auto callback = [](int rc, void*) {
+      result = rc;
+      k_sem_give(&done);
+    };
+
+    flash_queue_erase(FLASH_AREA_ID(provisioning), 0, FLASH_AREA_SIZE(provisioning));
+    flash_queue_write(FLASH_AREA_ID(provisioning), 0, buf, FLASH_AREA_SIZE(provisioning),
+                      callback);
+    rc = k_sem_take(&done, K_SECONDS(30)) == 0 ? result : -ETIMEDOUT;
+  }
+  int64_t elapsed_ms = k_uptime_get() - begin;
+  uint32_t save_gap_us = background_take_max_report_gap_us();
+  flash_area_close(fa);
+
+  shell_print(shell, "flash_bench (%s): rc = %d, took %lld ms", sync ? "sync" : "queued", rc,
+              elapsed_ms);
+  shell_print(shell, "  worst report gap: %u us before, %u us during", idle_gap_us, save_gap_us);
+  shell_print(shell, "  %u steps forced into a gap in reports so far", forced_count);
+  return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(flash_bench, NULL, "Measure report gaps while rewriting flash",
+                       cmd_flash_bench, 1, 1);
+#endif
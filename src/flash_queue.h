@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Flash erases and writes stall execution from flash for milliseconds at a time, so instead of
+// being done in place, they're queued and run from the background scheduler: one page erase or
+// write chunk at a time, and only when it will be done before the next report is due, or while
+// reports aren't being written at all (e.g. while USB is suspended). A step that still hasn't fit
+// after CONFIG_PASSINGLINK_FLASH_MAX_DEFER_MS is run anyway, stalling reports for its duration.
+//
+// Operations are run in the order they're queued. The data passed to flash_queue_write must stay
+// valid until its callback is called. Callbacks are called from the background thread, with the
+// result of the flash API call that finished the operation.
+using FlashCallback = void (*)(int rc, void* arg);
+
+// Returns false if the queue is full.
+bool flash_queue_erase(uint8_t area_id, off_t offset, size_t length,
+                       FlashCallback callback = nullptr, void* arg = nullptr);
+bool flash_queue_write(uint8_t area_id, off_t offset, const void* data, size_t length,
+                       FlashCallback callback = nullptr, void* arg = nullptr);
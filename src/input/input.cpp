@@ -6,26 +6,38 @@
 #include <devicetree/gpio.h>
 #include <drivers/gpio.h>
 #include <logging/log.h>
+#include <shell/shell.h>
+
+#if defined(CONFIG_PASSINGLINK_INPUT_GPIO_DIRECT)
+#include <soc.h>
+#endif
 
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(input);
 
 #include "arch.h"
+#include "background.h"
 #include "display/display.h"
+#include "input/link.h"
+#include "input/pipeline.h"
 #include "input/profile.h"
 #include "input/queue.h"
 #include "input/socd.h"
 #include "input/touchpad.h"
+#include "metrics/sched_trace.h"
 #include "panic.h"
 #include "profiling.h"
 #include "types.h"
 
-TouchpadData touchpad_data;
+seqlock<TouchpadData> touchpad_data;
 
 static void input_gpio_init();
 
 void input_init() {
   input_gpio_init();
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK)
+  input_link_init();
+#endif
   input_profile_init();
   input_touchpad_init();
 }
@@ -34,114 +46,238 @@ void input_init() {
 
 static void input_gpio_init() {}
 
-bool input_get_raw_state(RawInputState* out) {
-#if defined(CONFIG_PASSINGLINK_INPUT_QUEUE)
-  if (auto input = input_queue_get_state()) {
-    *out = *input;
-    return true;
-  }
-#endif
-
+static bool input_sample_raw_state(RawInputState* out, size_t) {
   memset(out, 0, sizeof(*out));
   return true;
 }
 
 #elif defined(CONFIG_PASSINGLINK_INPUT_EXTERNAL)
 
-static RawInputState input_state;
+static seqlock<RawInputState> input_state;
 
 static void input_gpio_init() {}
 
-bool input_get_raw_state(RawInputState* out) {
-#if defined(CONFIG_PASSINGLINK_INPUT_QUEUE)
-  if (auto input = input_queue_get_state()) {
-    *out = *input;
-    return true;
-  }
-#endif
-
-  *out = input_state;
+static bool input_sample_raw_state(RawInputState* out, size_t) {
+  *out = input_state.load();
   return true;
 }
 
 void input_set_raw_state(RawInputState* in) {
-  input_state = *in;
+  input_state.store(*in);
 }
 
 #else
 
 #define GPIO_PORT_COUNT 4
 
-static const struct device* gpio_devices[GPIO_PORT_COUNT];
-static uint8_t gpio_device_count;
-
-static uint8_t gpio_indices[PL_GPIO_COUNT];
-
-static uint8_t gpio_device_add(const struct device* device) {
-  uint8_t i;
-  for (i = 0; i < GPIO_PORT_COUNT; ++i) {
-    if (device == gpio_devices[i]) {
-      // Skipping already-cached device.
-      return i;
+// The GPIO ports used by a player's buttons, and which port each button is on.
+struct GpioBank {
+  const struct device* devices[GPIO_PORT_COUNT];
+  uint8_t device_count;
+  uint8_t indices[PL_GPIO_COUNT];
+
+  uint8_t add(const struct device* device) {
+    uint8_t i;
+    for (i = 0; i < GPIO_PORT_COUNT; ++i) {
+      if (device == devices[i]) {
+        // Skipping already-cached device.
+        return i;
+      }
+    }
+    if (device_count == GPIO_PORT_COUNT) {
+      PANIC("ran out of cached GPIO device slots");
     }
+
+    i = device_count++;
+    devices[i] = device;
+    return i;
   }
-  if (gpio_device_count == GPIO_PORT_COUNT) {
-    PANIC("ran out of cached GPIO device slots");
+};
+
+static GpioBank gpio_banks[PL_PLAYER_COUNT];
+
+// Like the PL_GPIO_* macros in input.h, for buttons under an arbitrary gpio-keys node.
+#define PL_GPIO_BANK_NODE(keys, name) DT_PATH(keys, name)
+#define PL_GPIO_BANK_LABEL(keys, name) DT_GPIO_LABEL(PL_GPIO_BANK_NODE(keys, name), gpios)
+#define PL_GPIO_BANK_PIN(keys, name) DT_GPIO_PIN(PL_GPIO_BANK_NODE(keys, name), gpios)
+#define PL_GPIO_BANK_FLAGS(keys, name) DT_GPIO_FLAGS(PL_GPIO_BANK_NODE(keys, name), gpios)
+#define PL_GPIO_BANK_AVAILABLE(keys, name) \
+  DT_NODE_HAS_STATUS(PL_GPIO_BANK_NODE(keys, name), okay)
+
+static void input_gpio_bank_add(GpioBank* bank, size_t index, const char* label, gpio_pin_t pin,
+                                gpio_flags_t flags) {
+  const struct device* device = device_get_binding(label);
+  if (!device) {
+    PANIC("failed to find gpio device %s", label);
   }
-
-  i = gpio_device_count++;
-  gpio_devices[i] = device;
-  return i;
+  if (gpio_pin_configure(device, pin, flags | GPIO_INPUT) != 0) {
+    PANIC("failed to configure gpio pin (device = %s, pin = %d)", label, pin);
+  }
+  bank->indices[index] = bank->add(device);
 }
 
+#define PL_GPIO_BANK_INIT(bank, keys, index, name)                                   \
+  COND_CODE_1(PL_GPIO_BANK_AVAILABLE(keys, name),                                    \
+              (input_gpio_bank_add(bank, index, PL_GPIO_BANK_LABEL(keys, name),      \
+                                   PL_GPIO_BANK_PIN(keys, name),                     \
+                                   PL_GPIO_BANK_FLAGS(keys, name));),                \
+              ())
+
 static void input_gpio_init() {
-#define PL_GPIO(index, name, available)                                                           \
-  COND_CODE_1(                                                                                    \
-    available, ({                                                                                 \
-      const struct device* device = device_get_binding(PL_GPIO_LABEL(name));                      \
-      if (!device) {                                                                              \
-        PANIC("failed to find gpio device %s", PL_GPIO_LABEL(name));                              \
-      }                                                                                           \
-      if (gpio_pin_configure(device, PL_GPIO_PIN(name), PL_GPIO_FLAGS(name) | GPIO_INPUT) != 0) { \
-        PANIC("failed to configure gpio pin (device = %s, pin = %d)", PL_GPIO_LABEL(name),        \
-              PL_GPIO_PIN(name));                                                                 \
-      };                                                                                          \
-      uint8_t device_offset = gpio_device_add(device);                                            \
-      gpio_indices[index] = device_offset;                                                        \
-    }),                                                                                           \
-    ())
+#define PL_GPIO(index, name, available) PL_GPIO_BANK_INIT(&gpio_banks[0], gpio_keys, index, name)
   PL_GPIOS()
 #undef PL_GPIO
+
+#if defined(CONFIG_PASSINGLINK_INPUT_TWO_PLAYER)
+#define PL_GPIO(index, name, available) \
+  PL_GPIO_BANK_INIT(&gpio_banks[1], gpio_keys_p2, index, name)
+  PL_GPIOS()
+#undef PL_GPIO
+#endif
+}
+
+#define PL_GPIO_BANK_READ(bank, port_values, out, keys, index, name)                        \
+  COND_CODE_1(PL_GPIO_BANK_AVAILABLE(keys, name), ({                                        \
+                uint8_t device_index = bank.indices[index];                                 \
+                bool value =                                                                \
+                  port_values[device_index] & (1U << PL_GPIO_BANK_PIN(keys, name));         \
+                if constexpr (PL_GPIO_BANK_FLAGS(keys, name) & GPIO_ACTIVE_LOW) {           \
+                  out->name = !value;                                                       \
+                } else {                                                                    \
+                  out->name = value;                                                        \
+                }                                                                           \
+              }),                                                                           \
+              ())
+
+#if defined(CONFIG_PASSINGLINK_INPUT_GPIO_DIRECT)
+// Read the ports' input data registers directly, instead of going through the GPIO driver API.
+//
+// Each port is identified by a key that's known at compile time from the devicetree, and the set
+// of ports each player uses (and which of them each button is on) is worked out by a constexpr
+// function, so sampling comes down to a few back to back volatile loads. The pins themselves are
+// still configured through the driver, by input_gpio_init.
+#if defined(STM32)
+// The key is the address of the port's register block.
+#define PL_GPIO_DIRECT_KEY(node) DT_REG_ADDR(DT_GPIO_CTLR(node, gpios))
+
+static inline uint32_t input_gpio_direct_read(uintptr_t key) {
+  return reinterpret_cast<volatile GPIO_TypeDef*>(key)->IDR;
 }
+#elif defined(NRF52840) || defined(NRF5340)
+// The key is the port number, since the register block addresses in the devicetree are relative
+// to the peripheral bus on the nRF5340.
+#define PL_GPIO_DIRECT_KEY(node) DT_PROP(DT_GPIO_CTLR(node, gpios), port)
+
+static inline uint32_t input_gpio_direct_read(uintptr_t key) {
+#if defined(NRF_P1)
+  if (key == 1) {
+    return NRF_P1->IN;
+  }
+#endif
+  return NRF_P0->IN;
+}
+#else
+#error "direct GPIO access is unsupported on this SoC"
+#endif
 
-bool input_get_raw_state(RawInputState* out) {
-  PROFILE("input_get_raw_state", 128);
+static constexpr uintptr_t GPIO_DIRECT_UNUSED = UINTPTR_MAX;
+
+struct GpioDirectLayout {
+  uintptr_t ports[GPIO_PORT_COUNT];
+  uint8_t port_count;
+  uint8_t indices[PL_GPIO_COUNT];
+};
+
+// Running out of ports here is a compile time error, since it writes past the end of ports.
+static constexpr GpioDirectLayout input_gpio_direct_layout(
+  const uintptr_t (&keys)[PL_GPIO_COUNT]) {
+  GpioDirectLayout layout = {};
+  for (size_t i = 0; i < PL_GPIO_COUNT; ++i) {
+    if (keys[i] == GPIO_DIRECT_UNUSED) {
+      continue;
+    }
 
-#if defined(CONFIG_PASSINGLINK_INPUT_QUEUE)
-  if (auto input = input_queue_get_state()) {
-    *out = *input;
-    return true;
+    uint8_t port = 0;
+    while (port < layout.port_count && layout.ports[port] != keys[i]) {
+      ++port;
+    }
+    if (port == layout.port_count) {
+      layout.ports[layout.port_count++] = keys[i];
+    }
+    layout.indices[i] = port;
   }
+  return layout;
+}
+
+#define PL_GPIO_DIRECT_BANK_KEY(keys, name)                                     \
+  COND_CODE_1(PL_GPIO_BANK_AVAILABLE(keys, name),                               \
+              (PL_GPIO_DIRECT_KEY(PL_GPIO_BANK_NODE(keys, name)), ),            \
+              (GPIO_DIRECT_UNUSED, ))
+
+#define PL_GPIO(index, name, available) PL_GPIO_DIRECT_BANK_KEY(gpio_keys, name)
+static constexpr uintptr_t gpio_direct_keys[PL_GPIO_COUNT] = {PL_GPIOS()};
+#undef PL_GPIO
+
+#if defined(CONFIG_PASSINGLINK_INPUT_TWO_PLAYER)
+#define PL_GPIO(index, name, available) PL_GPIO_DIRECT_BANK_KEY(gpio_keys_p2, name)
+static constexpr uintptr_t gpio_direct_keys_p2[PL_GPIO_COUNT] = {PL_GPIOS()};
+#undef PL_GPIO
 #endif
 
+static constexpr GpioDirectLayout gpio_direct_layouts[PL_PLAYER_COUNT] = {
+  input_gpio_direct_layout(gpio_direct_keys),
+#if defined(CONFIG_PASSINGLINK_INPUT_TWO_PLAYER)
+  input_gpio_direct_layout(gpio_direct_keys_p2),
+#endif
+};
+
+// Templated on the player, so that the loop gets unrolled into loads from constant addresses.
+template <size_t Player>
+static inline void input_gpio_direct_sample(gpio_port_value_t (&port_values)[GPIO_PORT_COUNT]) {
+  constexpr const GpioDirectLayout& layout = gpio_direct_layouts[Player];
+  for (size_t i = 0; i < layout.port_count; ++i) {
+    port_values[i] = input_gpio_direct_read(layout.ports[i]);
+  }
+}
+
+#define PL_GPIO_SAMPLE_BANK(player) gpio_direct_layouts[player]
+#else
+#define PL_GPIO_SAMPLE_BANK(player) gpio_banks[player]
+#endif
+
+static bool input_sample_raw_state(RawInputState* out, size_t player) {
   gpio_port_value_t port_values[GPIO_PORT_COUNT];
-  for (size_t i = 0; i < gpio_device_count; ++i) {
-    if (gpio_port_get_raw(gpio_devices[i], &port_values[i]) != 0) {
+#if defined(CONFIG_PASSINGLINK_INPUT_GPIO_DIRECT)
+#if defined(CONFIG_PASSINGLINK_INPUT_TWO_PLAYER)
+  if (player != 0) {
+    input_gpio_direct_sample<1>(port_values);
+  } else
+#endif
+  {
+    input_gpio_direct_sample<0>(port_values);
+  }
+#else
+  const GpioBank& bank = gpio_banks[player];
+  for (size_t i = 0; i < bank.device_count; ++i) {
+    if (gpio_port_get_raw(bank.devices[i], &port_values[i]) != 0) {
       PANIC("failed to get gpio values");
     }
   }
+#endif
 
-#define PL_GPIO(index, name, available)                                             \
-  COND_CODE_1(available, ({                                                         \
-                uint8_t device_index = gpio_indices[index];                         \
-                bool value = port_values[device_index] & (1U << PL_GPIO_PIN(name)); \
-                if constexpr (PL_GPIO_FLAGS(name) & GPIO_ACTIVE_LOW) {              \
-                  out->name = !value;                                               \
-                } else {                                                            \
-                  out->name = value;                                                \
-                }                                                                   \
-              }),                                                                   \
-              ())
+#if defined(CONFIG_PASSINGLINK_INPUT_TWO_PLAYER)
+  if (player != 0) {
+    memset(out, 0, sizeof(*out));
+#define PL_GPIO(index, name, available) \
+  PL_GPIO_BANK_READ(PL_GPIO_SAMPLE_BANK(1), port_values, out, gpio_keys_p2, index, name)
+    PL_GPIOS()
+#undef PL_GPIO
+    return true;
+  }
+#endif
+
+#define PL_GPIO(index, name, available) \
+  PL_GPIO_BANK_READ(PL_GPIO_SAMPLE_BANK(0), port_values, out, gpio_keys, index, name)
   PL_GPIOS()
 #undef PL_GPIO
 
@@ -149,41 +285,75 @@ bool input_get_raw_state(RawInputState* out) {
 }
 #endif
 
-static OutputMode input_output_mode = OutputMode::mode_dpad;
+bool input_get_raw_state(RawInputState* out, size_t player) {
+#if defined(CONFIG_PASSINGLINK_INPUT_QUEUE)
+  if (player == 0) {
+    if (auto input = input_queue_get_state()) {
+      *out = *input;
+      return true;
+    }
+  }
+#endif
+
+  return input_sample_raw_state(out, player);
+}
+
+ButtonHistory button_history[PL_PLAYER_COUNT];
+
+static InputPipelineState input_live_state = {
+  .history = button_history,
+  .output_mode = OutputMode::mode_dpad,
+  .locked = false,
+  .lock_tick = 0,
+  .menu_opened = false,
+  .live = true,
+};
+
 OutputMode input_get_output_mode() {
-  return input_output_mode;
+  return input_live_state.output_mode;
 }
 
 void input_set_output_mode(OutputMode mode) {
-  input_output_mode = mode;
+  input_live_state.output_mode = mode;
 }
 
-static bool input_locked = false;
-static uint64_t input_lock_tick;
-optional<uint64_t> input_get_lock_tick() {
-  if (input_locked) {
-    return input_locked;
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+// Redrawing the status line is done off of the report path.
+static void input_display_locked(struct k_work*) {
+  display_set_locked(input_live_state.locked);
+}
+
+K_WORK_DEFINE(input_display_locked_work, input_display_locked);
+#endif
+
+optional<uint64_t> input_get_lock_tick(const InputPipelineState* state) {
+  if (state->locked) {
+    return state->locked;
   }
   return {};
 }
 
-static void input_set_locked(bool locked, uint64_t tick) {
+optional<uint64_t> input_get_lock_tick() {
+  return input_get_lock_tick(&input_live_state);
+}
+
+static void input_set_locked(InputPipelineState* state, bool locked, uint64_t tick) {
 #if defined(CONFIG_PASSINGLINK_DISPLAY)
-  if (locked != input_locked) {
-    display_set_locked(locked);
-    input_lock_tick = tick;
+  if (locked != state->locked) {
+    state->lock_tick = tick;
+    if (state->live) {
+      k_work_submit_to_queue(&background_work_q, &input_display_locked_work);
+    }
   }
 #endif
 
-  input_locked = locked;
+  state->locked = locked;
 }
 
 void input_set_locked(bool locked) {
-  input_set_locked(locked, k_uptime_ticks());
+  input_set_locked(&input_live_state, locked, k_uptime_ticks());
 }
 
-ButtonHistory button_history;
-
 // Debounce a button input, given its history.
 // Updates history and returns the value that should be used.
 static bool input_debounce(bool current_state, ButtonHistory::Button* button_history,
@@ -195,7 +365,7 @@ static bool input_debounce(bool current_state, ButtonHistory::Button* button_his
   // Only allow transitions every 5 milliseconds.
   // TODO: Make configurable?
   uint64_t duration_ticks = current_tick - button_history->tick;
-  constexpr uint64_t transition_time = k_ms_to_cyc_ceil64(5);
+  constexpr uint64_t transition_time = k_ms_to_ticks_ceil64(5);
   if (duration_ticks < transition_time) {
     return !current_state;
   }
@@ -205,26 +375,345 @@ static bool input_debounce(bool current_state, ButtonHistory::Button* button_his
   return current_state;
 }
 
-static void input_parse_mode(RawInputState* in) {
+static void input_debounce_state(RawInputState* in, ButtonHistory* history, uint64_t current_tick) {
+#define PL_GPIO(index, name, available) \
+  COND_CODE_1(available, (in->name = input_debounce(in->name, &history->name, current_tick);), ())
+  PL_GPIOS()
+#undef PL_GPIO
+}
+
+#if defined(CONFIG_PASSINGLINK_SCHED_TRACE)
+// Debouncing for reports happens when they're built (or on the oversampling timer, which is tied
+// to the poll interval), so timestamping edges there would snap them to the recorded schedule,
+// and bias schedsim towards it. Instead, the pins are sampled from a separate timer, and debounced
+// by the same rule against a history of their own: edges are late by at most one sampling
+// interval, whatever the report timing.
+static ButtonHistory edge_history;
+static bool edge_primed;
+
+static void input_edge_sample(struct k_timer*) {
+  RawInputState raw;
+  if (!input_sample_raw_state(&raw, 0)) {
+    return;
+  }
+
+  uint64_t tick = k_uptime_ticks();
+  ButtonHistory previous = edge_history;
+  input_debounce_state(&raw, &edge_history, tick);
+
+  // Whatever's held when the capture starts isn't an edge.
+  if (edge_primed && memcmp(&previous, &edge_history, sizeof(previous)) != 0) {
+    sched_trace_record(SchedTraceEvent::Edge, tick);
+  }
+  edge_primed = true;
+}
+
+K_TIMER_DEFINE(input_edge_timer, input_edge_sample, nullptr);
+
+void input_trace_edges(bool enabled) {
+  if (enabled) {
+    memset(&edge_history, 0, sizeof(edge_history));
+    edge_primed = false;
+    k_timer_start(&input_edge_timer, K_NO_WAIT, K_USEC(CONFIG_PASSINGLINK_SCHED_TRACE_EDGE_US));
+  } else {
+    k_timer_stop(&input_edge_timer);
+  }
+}
+#endif
+
+#if defined(CONFIG_PASSINGLINK_INPUT_OVERSAMPLE)
+// When the host polls much slower than we can sample, sample and debounce from a timer between
+// reports instead of once per report. Each report gets the latest debounced state, plus any button
+// that was pressed since the previous report, so that a tap shorter than the poll interval still
+// shows up in one report.
+struct OversampleState {
+  RawInputState current;
+  RawInputState pressed;
+};
+
+static OversampleState oversample_state[PL_PLAYER_COUNT];
+static atomic_t oversample_enabled;
+
+static void input_oversample(struct k_timer*) {
+  uint64_t tick = k_uptime_ticks();
+  for (size_t player = 0; player < PL_PLAYER_COUNT; ++player) {
+    RawInputState raw;
+    if (!input_sample_raw_state(&raw, player)) {
+      continue;
+    }
+    input_debounce_state(&raw, &button_history[player], tick);
+
+    OversampleState& state = oversample_state[player];
+#define PL_GPIO(index, name, available) \
+  COND_CODE_1(available, (state.pressed.name |= raw.name & !state.current.name;), ())
+    PL_GPIOS()
+#undef PL_GPIO
+    state.current = raw;
+  }
+}
+
+K_TIMER_DEFINE(input_oversample_timer, input_oversample, nullptr);
+
+void input_set_oversampling(bool enabled) {
+  if (atomic_set(&oversample_enabled, enabled) == enabled) {
+    return;
+  }
+
+  if (enabled) {
+    memset(oversample_state, 0, sizeof(oversample_state));
+    k_timer_start(&input_oversample_timer, K_NO_WAIT,
+                  K_USEC(CONFIG_PASSINGLINK_INPUT_OVERSAMPLE_INTERVAL_US));
+  } else {
+    k_timer_stop(&input_oversample_timer);
+  }
+}
+
+static bool input_oversample_take(RawInputState* out, size_t player) {
+  if (!atomic_get(&oversample_enabled)) {
+    return false;
+  }
+
+  ScopedIRQLock lock;
+  OversampleState& state = oversample_state[player];
+  *out = state.current;
+#define PL_GPIO(index, name, available) COND_CODE_1(available, (out->name |= state.pressed.name;), ())
+  PL_GPIOS()
+#undef PL_GPIO
+  memset(&state.pressed, 0, sizeof(state.pressed));
+  return true;
+}
+#endif
+
+static void input_parse_mode(InputPipelineState* state, RawInputState* in) {
   bool have_mode = false;
-#define PL_GPIO(index, mode, available)                    \
-  COND_CODE_1(available,                                   \
-              (                                            \
-                if (in->mode) {                            \
-                  input_set_output_mode(OutputMode::mode); \
-                  return;                                  \
-                } else { have_mode = true; }),             \
+#define PL_GPIO(index, mode, available)                  \
+  COND_CODE_1(available,                                 \
+              (                                          \
+                if (in->mode) {                          \
+                  state->output_mode = OutputMode::mode; \
+                  return;                                \
+                } else { have_mode = true; }),           \
               ())
   PL_GPIO_OUTPUT_MODES()
 #undef PL_GPIO
   if (have_mode) {
-    input_set_output_mode(OutputMode::mode_dpad);
+    state->output_mode = OutputMode::mode_dpad;
   }
 }
 
-static bool input_parse(InputState* out, RawInputState* in) {
-  PROFILE("input_parse", 128);
+struct SampleStage {
+  static constexpr const char* name = "input_sample";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+#if defined(CONFIG_PASSINGLINK_INPUT_OVERSAMPLE)
+    if (input_oversample_take(&ctx.raw, ctx.player)) {
+      ctx.debounced = true;
+      return StageResult::Continue;
+    }
+#endif
+    return input_sample_raw_state(&ctx.raw, ctx.player) ? StageResult::Continue : StageResult::Fail;
+  }
+};
+
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK_PRIMARY)
+// The peripheral's buttons are debounced against a history of their own, since the oversampling
+// timer can be debouncing the local pins against button_history at the same time.
+static ButtonHistory link_history;
+
+// Buttons pressed on the peripheral since the previous report.
+static uint32_t link_pressed;
+
+// The peripheral's sampling timestamps don't depend on our report timing, so changes that come
+// with one go into the scheduling trace as edges. Ones that are only settled when a report is
+// built don't.
+static uint32_t input_link_debounce(uint32_t buttons, uint64_t tick, bool trace) {
+  uint32_t held = 0;
+  bool edge = false;
+  for (size_t index = 0; index < PL_GPIO_COUNT; ++index) {
+    ButtonHistory::Button* button = &link_history.values[index];
+    bool was_held = button->state;
+    bool is_held = input_debounce((buttons >> index) & 1, button, tick);
+    edge |= is_held != was_held;
+    if (is_held) {
+      held |= 1u << index;
+      if (!was_held) {
+        link_pressed |= 1u << index;
+      }
+    }
+  }
+
+  if (trace && edge) {
+    sched_trace_record(SchedTraceEvent::Edge, tick);
+  }
+  return held;
+}
+#endif
+
+// Take the buttons held on a peripheral board. Each change is debounced at the time it was sampled
+// on the peripheral, rather than when we got around to it, and like with oversampling, a press
+// that was let go of again before this report still shows up in it.
+struct LinkStage {
+  static constexpr const char* name = "input_link";
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK_PRIMARY)
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (ctx.player != 0) {
+      return StageResult::Continue;
+    }
+
+    uint32_t buttons;
+    array<LinkEvent, 4> events;
+    while (size_t count = input_link_take_events(events, &buttons)) {
+      for (size_t i = 0; i < count; ++i) {
+        input_link_debounce(events[i].buttons, events[i].tick, true);
+      }
+    }
+
+    // Changes that were rejected as bounces when they arrived get settled here, once they've
+    // lasted long enough.
+    ctx.link = input_link_debounce(buttons, ctx.tick, false) | link_pressed;
+    link_pressed = 0;
+    return StageResult::Continue;
+  }
+#else
+  static constexpr bool enabled = false;
+#endif
+};
+
+// Replace the sampled inputs with the active input queue, if there is one.
+struct QueueStage {
+  static constexpr const char* name = "input_queue";
+#if defined(CONFIG_PASSINGLINK_INPUT_QUEUE)
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (ctx.player != 0) {
+      return StageResult::Continue;
+    }
+    if (auto input = input_queue_get_state()) {
+      ctx.raw = *input;
+      ctx.link = 0;
+    }
+    return StageResult::Continue;
+  }
+#else
+  static constexpr bool enabled = false;
+#endif
+};
 
+struct DebounceStage {
+  static constexpr const char* name = "input_debounce";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (!ctx.debounced) {
+      input_debounce_state(&ctx.raw, &ctx.state->history[ctx.player], ctx.tick);
+    }
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK_PRIMARY)
+    if (ctx.link) {
+      input_link_unpack(input_link_pack(ctx.raw) | ctx.link, &ctx.raw);
+    }
+#endif
+    return StageResult::Continue;
+  }
+};
+
+// Handle the lock and output mode switches.
+struct ModeStage {
+  static constexpr const char* name = "input_mode";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (ctx.player != 0) {
+      return StageResult::Continue;
+    }
+
+#if defined(PL_GPIO_MODE_LOCK_AVAILABLE)
+    input_set_locked(ctx.state, ctx.raw.mode_lock, ctx.tick);
+#endif
+
+    input_parse_mode(ctx.state, &ctx.raw);
+    return StageResult::Continue;
+  }
+};
+
+struct TouchpadStage {
+  static constexpr const char* name = "input_touchpad";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (ctx.player != 0) {
+      ctx.out->touchpad_data.p1.unpressed = 1;
+      ctx.out->touchpad_data.p2.unpressed = 1;
+      return StageResult::Continue;
+    }
+    ctx.out->touchpad_data = touchpad_data.load();
+    return StageResult::Continue;
+  }
+};
+
+struct SOCDStage {
+  static constexpr const char* name = "input_socd";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    ctx.stick = input_profile_socd(&ctx.raw, ctx.state, ctx.player);
+    return StageResult::Continue;
+  }
+};
+
+// While the menu button is held, stick inputs go to the menu instead of the host.
+struct MenuStage {
+  static constexpr const char* name = "input_menu";
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (ctx.player == 0 && input_profile_menu(&ctx.raw, ctx.state, ctx.stick, ctx.tick)) {
+      return StageResult::Finish;
+    }
+    return StageResult::Continue;
+  }
+#else
+  static constexpr bool enabled = false;
+#endif
+};
+
+struct RemapStage {
+  static constexpr const char* name = "input_remap";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    input_profile_remap(ctx.out, &ctx.raw, ctx.state, ctx.stick, ctx.player);
+    return StageResult::Continue;
+  }
+};
+
+// Mask out the buttons that can leave a game while locked.
+struct LockStage {
+  static constexpr const char* name = "input_lock";
+  static constexpr bool enabled = true;
+
+  static StageResult run(InputPipelineContext& ctx) {
+    if (input_get_lock_tick(ctx.state)) {
+      ctx.out->button_select = 0;
+      ctx.out->button_start = 0;
+      ctx.out->button_home = 0;
+    }
+    return StageResult::Continue;
+  }
+};
+
+#define INPUT_PARSE_STAGES \
+  DebounceStage, ModeStage, TouchpadStage, SOCDStage, MenuStage, RemapStage, LockStage
+
+using InputParsePipeline = InputPipeline<INPUT_PARSE_STAGES>;
+using InputStatePipeline =
+  InputPipeline<SampleStage, LinkStage, QueueStage, INPUT_PARSE_STAGES>;
+
+static void input_pipeline_begin(InputPipelineContext* ctx, InputState* out, size_t player) {
   // Initialize to neutral.
   memset(out, 0, sizeof(*out));
   out->dpad = StickState::Neutral;
@@ -233,29 +722,152 @@ static bool input_parse(InputState* out, RawInputState* in) {
   out->right_stick_x = 128;
   out->right_stick_y = 128;
 
-  uint64_t current_tick = k_uptime_ticks();
-  // Debounce inputs.
+  ctx->out = out;
+  ctx->state = &input_live_state;
+  ctx->player = player;
+  ctx->tick = k_uptime_ticks();
+  ctx->debounced = false;
+  ctx->link = 0;
+}
+
+bool input_parse(InputState* out, const RawInputState* in) {
+  InputPipelineContext ctx;
+  input_pipeline_begin(&ctx, out, 0);
+  ctx.raw = *in;
+  return InputParsePipeline::run(ctx);
+}
+
+bool input_get_state(InputState* out, size_t player) {
+  PROFILE("input_get_state", 128);
+
+  InputPipelineContext ctx;
+  input_pipeline_begin(&ctx, out, player);
+  return InputStatePipeline::run(ctx);
+}
+
+#if defined(CONFIG_PASSINGLINK_INPUT_BENCH)
+// Worst case timing of the parse pipeline, measured over a sweep of inputs meant to hit every
+// expensive path: SOCD conflicts on both axes, overrides, the menu and mode switches.
+template <typename Stage>
+static bool input_bench_stage(InputPipelineContext& ctx, uint32_t* cycles) {
+  uint32_t begin = get_cycle_count();
+  StageResult result = InputParsePipeline::run_stage<Stage>(ctx);
+  *cycles = get_cycle_count() - begin;
+  return result == StageResult::Continue;
+}
+
+template <typename... Stages>
+struct InputBench {
+  static constexpr size_t stage_count = sizeof...(Stages);
+  static constexpr const char* stage_names[stage_count] = { Stages::name... };
+
+  // Stages that don't get run because of an earlier Finish are reported as taking 0 cycles.
+  static void run(InputPipelineContext& ctx, uint32_t (&cycles)[stage_count]) {
+    memset(cycles, 0, sizeof(cycles));
+    size_t i = 0;
+    (void)(input_bench_stage<Stages>(ctx, &cycles[i++]) && ...);
+  }
+};
+
+using InputParseBench = InputBench<INPUT_PARSE_STAGES>;
+
+struct InputBenchRange {
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint64_t total = 0;
+
+  void add(uint32_t cycles) {
+    min = ::min(min, cycles);
+    max = ::max(max, cycles);
+    total += cycles;
+  }
+};
+
+static void input_bench_fill(RawInputState* raw, uint32_t pattern, bool conflict) {
+  memset(raw, 0, sizeof(*raw));
+  size_t bit = 0;
 #define PL_GPIO(index, name, available) \
-  COND_CODE_1(available,                \
-              (in->name = input_debounce(in->name, &button_history.name, current_tick);), ())
+  COND_CODE_1(available, (raw->name = (pattern >> (bit++ % 32)) & 1;), ())
   PL_GPIOS()
 #undef PL_GPIO
 
-#if defined(PL_GPIO_MODE_LOCK_AVAILABLE)
-  input_set_locked(in->mode_lock, current_tick);
-#endif
+  if (conflict) {
+    raw->stick_left = 1;
+    raw->stick_right = 1;
+    raw->stick_up = 1;
+    raw->stick_down = 1;
+  }
+}
 
-  input_parse_mode(in);
+static int cmd_input_bench(const struct shell* shell, size_t argc, char** argv) {
+  size_t iterations = 4096;
+  if (argc == 2) {
+    iterations = strtoul(argv[1], nullptr, 10);
+  }
 
-  // Copy TouchpadData.
-  out->touchpad_data = touchpad_data;
+  // Reports keep getting built while this runs, so run against state of our own, starting out
+  // from a copy of the live state, instead of touching it.
+  ButtonHistory history;
+  InputPipelineState state;
+  {
+    ScopedIRQLock lock;
+    history = button_history[0];
+    state = input_live_state;
+  }
+  state.history = &history;
+  state.live = false;
+
+  InputBenchRange total;
+  InputBenchRange stages[InputParseBench::stage_count];
+  uint32_t rng = 0x504c4942;
+  uint64_t tick = k_uptime_ticks();
+  for (size_t i = 0; i < iterations; ++i) {
+    // xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+
+    InputState out;
+    InputPipelineContext ctx;
+    input_pipeline_begin(&ctx, &out, 0);
+    ctx.state = &state;
+    input_bench_fill(&ctx.raw, rng, i % 2);
+
+    // Step time forward by a poll interval, so that debouncing lets changes through.
+    ctx.tick = tick + i * k_ms_to_ticks_ceil64(CONFIG_USB_HID_POLL_INTERVAL_MS);
+
+    uint32_t cycles[InputParseBench::stage_count];
+    uint32_t elapsed;
+    {
+      ScopedIRQLock lock;
+      uint32_t begin = get_cycle_count();
+      InputParseBench::run(ctx, cycles);
+      elapsed = get_cycle_count() - begin;
+    }
 
-  input_profile_parse(out, in, current_tick);
+    total.add(elapsed);
+    for (size_t j = 0; j < InputParseBench::stage_count; ++j) {
+      stages[j].add(cycles[j]);
+    }
+  }
 
-  return true;
-}
+  if (iterations == 0) {
+    return 0;
+  }
 
-bool input_get_state(InputState* out) {
-  RawInputState input;
-  return input_get_raw_state(&input) && input_parse(out, &input);
+  shell_print(shell, "%zu iterations, cycles at %u Hz", iterations, get_cpu_freq());
+  shell_print(shell, "  %-16s %8s %8s %8s %8s", "stage", "min", "avg", "max", "max-min");
+  for (size_t j = 0; j < InputParseBench::stage_count; ++j) {
+    const InputBenchRange& range = stages[j];
+    shell_print(shell, "  %-16s %8u %8u %8u %8u", InputParseBench::stage_names[j], range.min,
+                static_cast<uint32_t>(range.total / iterations), range.max,
+                range.max - range.min);
+  }
+  shell_print(shell, "  %-16s %8u %8u %8u %8u", "total", total.min,
+              static_cast<uint32_t>(total.total / iterations), total.max, total.max - total.min);
+  return 0;
 }
+
+SHELL_CMD_ARG_REGISTER(input_bench, NULL, "Measure input pipeline timing over adversarial input",
+                       cmd_input_bench, 1, 1);
+#endif
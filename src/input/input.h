@@ -40,6 +40,13 @@ inline const char* to_string(StickState state) {
   return "<invalid>";
 }
 
+// The second player's buttons, if any, are children of /gpio_keys_p2, with the same names.
+#if defined(CONFIG_PASSINGLINK_INPUT_TWO_PLAYER)
+static constexpr size_t PL_PLAYER_COUNT = 2;
+#else
+static constexpr size_t PL_PLAYER_COUNT = 1;
+#endif
+
 #define PL_GPIO_NODE(name) DT_PATH(gpio_keys, name)
 #define PL_GPIO_LABEL(name) DT_GPIO_LABEL(PL_GPIO_NODE(name), gpios)
 #define PL_GPIO_PIN(name) DT_GPIO_PIN(PL_GPIO_NODE(name), gpios)
@@ -98,7 +105,7 @@ union ButtonHistory {
   Button values[PL_GPIO_COUNT];
 };
 
-extern ButtonHistory button_history;
+extern ButtonHistory button_history[PL_PLAYER_COUNT];
 
 struct RawInputState {
 #define PL_GPIO(index, name, available) \
@@ -145,15 +152,49 @@ enum class OutputMode {
 OutputMode input_get_output_mode();
 void input_set_output_mode(OutputMode mode);
 
-// Get the raw state of the buttons, unaffected by SOCD cleaning, mode switches, etc.
-bool input_get_raw_state(RawInputState* out);
+// State that the input pipeline carries from one run to the next. Reports all share the live one,
+// while the input benchmark brings its own, so that it never disturbs them.
+struct InputPipelineState {
+  // Indexed by player.
+  ButtonHistory* history;
+
+  OutputMode output_mode;
+  bool locked;
+  uint64_t lock_tick;
+
+  // Whether holding the menu button has opened the menu.
+  bool menu_opened;
+
+  // Whether changes get shown on the display and drive the menu.
+  bool live;
+};
+
+optional<uint64_t> input_get_lock_tick(const InputPipelineState* state);
+
+// Get the raw state of the buttons, unaffected by SOCD cleaning, mode switches, etc. For the first
+// player, an active input queue replaces the buttons, like it does for reports.
+bool input_get_raw_state(RawInputState* out, size_t player = 0);
 
 #if defined(CONFIG_PASSINGLINK_INPUT_EXTERNAL)
 void input_set_raw_state(RawInputState* out);
 #endif
 
+// Sample and debounce inputs from a timer, instead of once per report.
+#if defined(CONFIG_PASSINGLINK_INPUT_OVERSAMPLE)
+void input_set_oversampling(bool enabled);
+#else
+inline void input_set_oversampling(bool) {}
+#endif
+
+// Sample the first player's buttons from a timer of their own while a scheduling trace is being
+// captured, so that edges are timestamped independently of when reports get built.
+#if defined(CONFIG_PASSINGLINK_SCHED_TRACE)
+void input_trace_edges(bool enabled);
+#endif
+
 // Parse a RawInputState into host-facing output.
 bool input_parse(InputState* out, const RawInputState* in);
 
 // Get the parsed button state.
-bool input_get_state(InputState* out);
+// Mode switches, the menu, the touchpad and the input queue only apply to the first player.
+bool input_get_state(InputState* out, size_t player = 0);
@@ -0,0 +1,342 @@
+#include "input/link.h"
+
+#include <zephyr.h>
+
+#include <device.h>
+#include <drivers/uart.h>
+#include <shell/shell.h>
+#include <sys/crc.h>
+
+#include "metrics/metrics.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(link);
+
+// Every frame carries the complete button state, so a lost frame is corrected by the next one.
+struct __attribute__((packed)) LinkFrame {
+  uint8_t sync;
+  uint8_t sequence;
+
+  // k_uptime_ticks() on the peripheral when the buttons were sampled, in microseconds.
+  uint32_t timestamp_us;
+  uint32_t buttons;
+
+  // CRC-8-CCITT of everything before it.
+  uint8_t crc;
+};
+
+static constexpr uint8_t LINK_SYNC = 0xA5;
+
+static const struct device* link_device;
+
+uint32_t input_link_pack(const RawInputState& state) {
+  uint32_t buttons = 0;
+#define PL_GPIO(index, name, available) buttons |= static_cast<uint32_t>(state.name) << index;
+  PL_GPIOS()
+#undef PL_GPIO
+  return buttons;
+}
+
+void input_link_unpack(uint32_t buttons, RawInputState* out) {
+#define PL_GPIO(index, name, available) out->name = (buttons >> index) & 1;
+  PL_GPIOS()
+#undef PL_GPIO
+}
+
+static uint8_t input_link_crc(const LinkFrame& frame) {
+  return crc8_ccitt(0xff, &frame, offsetof(LinkFrame, crc));
+}
+
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK_PRIMARY)
+// Frames are parsed a byte at a time from the UART interrupt, and the resulting events are queued
+// for the input pipeline.
+static array<LinkEvent, 16> link_events;
+static size_t link_event_head;
+static size_t link_event_count;
+static uint32_t link_buttons;
+static optional<uint64_t> link_last_frame_tick;
+static bool link_timed_out;
+
+static array<uint8_t, sizeof(LinkFrame)> link_rx_buffer;
+static size_t link_rx_length;
+static optional<uint8_t> link_last_sequence;
+
+// The peripheral's clock is aligned to ours by the smallest offset between a frame's timestamp and
+// its arrival: the frame that got through the quickest. That includes the fixed part of the link
+// latency, so aligned timestamps are late by it, but free of the variable part. The minimum is
+// taken over windows, so that it follows drift between the two clocks.
+static constexpr size_t LINK_OFFSET_WINDOW = 64;
+
+static optional<uint32_t> link_offset_us;
+static uint32_t link_window_offset_us;
+static size_t link_window_count;
+
+struct LinkStats {
+  uint32_t frames;
+  uint32_t lost;
+  uint32_t errors;
+  uint32_t timeouts;
+  uint32_t late;
+  uint32_t max_excess_us;
+};
+
+static LinkStats link_stats;
+
+static void input_link_push_event(uint32_t buttons, uint64_t tick) {
+  if (link_event_count == link_events.size()) {
+    // Drop the oldest change: the latest state still gets through.
+    link_event_head = (link_event_head + 1) % link_events.size();
+    --link_event_count;
+  }
+  link_events[(link_event_head + link_event_count++) % link_events.size()] = {buttons, tick};
+}
+
+// Returns how much later than the fastest frame this one arrived, in microseconds.
+static uint32_t input_link_align(uint32_t timestamp_us, uint32_t now_us) {
+  uint32_t offset_us = now_us - timestamp_us;
+  if (!link_offset_us || static_cast<int32_t>(offset_us - *link_offset_us) < 0 ||
+      offset_us - *link_offset_us > 1'000'000) {
+    // Either this is the fastest frame yet, or the peripheral's clock jumped (e.g. it rebooted).
+    link_offset_us = offset_us;
+    link_window_offset_us = offset_us;
+    link_window_count = 0;
+    return 0;
+  }
+
+  if (link_window_count == 0 || static_cast<int32_t>(offset_us - link_window_offset_us) < 0) {
+    link_window_offset_us = offset_us;
+  }
+  if (++link_window_count == LINK_OFFSET_WINDOW) {
+    link_offset_us = link_window_offset_us;
+    link_window_count = 0;
+  }
+  return offset_us - *link_offset_us;
+}
+
+static void input_link_receive(const LinkFrame& frame) {
+  uint64_t now = k_uptime_ticks();
+  uint32_t now_us = k_ticks_to_us_floor64(now);
+
+  uint32_t lost = 0;
+  if (link_last_sequence) {
+    lost = static_cast<uint8_t>(frame.sequence - *link_last_sequence - 1);
+  }
+  link_last_sequence = frame.sequence;
+
+  uint32_t excess_us = input_link_align(frame.timestamp_us, now_us);
+  bool late = excess_us > CONFIG_PASSINGLINK_INPUT_LINK_MAX_LATENCY_US;
+
+  ++link_stats.frames;
+  link_stats.lost += lost;
+  link_stats.late += late;
+  link_stats.max_excess_us = max(link_stats.max_excess_us, excess_us);
+  metrics_record_link_frame(excess_us, lost, late);
+
+  link_last_frame_tick = now;
+  link_timed_out = false;
+  if (frame.buttons != link_buttons) {
+    link_buttons = frame.buttons;
+    input_link_push_event(frame.buttons, now - k_us_to_ticks_floor64(excess_us));
+  }
+}
+
+static void input_link_receive_byte(uint8_t byte) {
+  if (link_rx_length == 0 && byte != LINK_SYNC) {
+    return;
+  }
+
+  link_rx_buffer[link_rx_length++] = byte;
+  if (link_rx_length != sizeof(LinkFrame)) {
+    return;
+  }
+  link_rx_length = 0;
+
+  LinkFrame frame;
+  memcpy(&frame, link_rx_buffer.data(), sizeof(frame));
+  if (frame.crc != input_link_crc(frame)) {
+    ++link_stats.errors;
+    metrics_record_link_error();
+
+    // Resynchronize on the next sync byte in what was received.
+    for (size_t i = 1; i < sizeof(LinkFrame); ++i) {
+      if (link_rx_buffer[i] == LINK_SYNC) {
+        link_rx_length = sizeof(LinkFrame) - i;
+        memmove(link_rx_buffer.data(), &link_rx_buffer[i], link_rx_length);
+        break;
+      }
+    }
+    return;
+  }
+
+  input_link_receive(frame);
+}
+
+static void input_link_isr(const struct device* device, void*) {
+  while (uart_irq_update(device) && uart_irq_rx_ready(device)) {
+    uint8_t buf[8];
+    int n = uart_fifo_read(device, buf, sizeof(buf));
+    for (int i = 0; i < n; ++i) {
+      input_link_receive_byte(buf[i]);
+    }
+  }
+}
+
+size_t input_link_take_events(span<LinkEvent> out, uint32_t* buttons) {
+  ScopedIRQLock lock;
+
+  // Let go of everything if the peripheral stops talking, rather than leaving buttons held.
+  uint64_t timeout = k_ms_to_ticks_ceil64(CONFIG_PASSINGLINK_INPUT_LINK_TIMEOUT_MS);
+  if (link_last_frame_tick && !link_timed_out &&
+      k_uptime_ticks() - *link_last_frame_tick > timeout) {
+    link_timed_out = true;
+    ++link_stats.timeouts;
+    metrics_record_link_timeout();
+    if (link_buttons != 0) {
+      link_buttons = 0;
+      input_link_push_event(0, *link_last_frame_tick + timeout);
+    }
+  }
+
+  size_t n = min(out.size(), link_event_count);
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = link_events[link_event_head];
+    link_event_head = (link_event_head + 1) % link_events.size();
+  }
+  link_event_count -= n;
+  *buttons = link_buttons;
+  return n;
+}
+
+void input_link_init() {
+  link_device = device_get_binding(DT_LABEL(DT_ALIAS(pl_link)));
+  if (!link_device) {
+    LOG_ERR("failed to find link UART");
+    return;
+  }
+
+  uart_irq_callback_set(link_device, input_link_isr);
+  uart_irq_rx_enable(link_device);
+}
+#else
+// The peripheral samples its buttons from a timer, and queues a frame whenever they change or the
+// heartbeat interval passes. Frames are fed to the UART from its TX interrupt.
+static array<uint8_t, 4 * sizeof(LinkFrame)> link_tx_buffer;
+static size_t link_tx_head;
+static size_t link_tx_count;
+
+static uint8_t link_sequence;
+static uint32_t link_frames_sent;
+static optional<uint32_t> link_last_buttons;
+static uint64_t link_last_send_tick;
+
+static void input_link_tx_isr(const struct device* device, void*) {
+  while (uart_irq_update(device) && uart_irq_tx_ready(device)) {
+    if (link_tx_count == 0) {
+      uart_irq_tx_disable(device);
+      return;
+    }
+
+    size_t contiguous = min(link_tx_count, link_tx_buffer.size() - link_tx_head);
+    int n = uart_fifo_fill(device, &link_tx_buffer[link_tx_head], contiguous);
+    if (n <= 0) {
+      return;
+    }
+    link_tx_head = (link_tx_head + n) % link_tx_buffer.size();
+    link_tx_count -= n;
+  }
+}
+
+static void input_link_send(const LinkFrame& frame) {
+  ScopedIRQLock lock;
+  if (link_tx_buffer.size() - link_tx_count < sizeof(frame)) {
+    // The UART is behind: drop the frame, the next one carries the full state anyway.
+    return;
+  }
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(&frame);
+  for (size_t i = 0; i < sizeof(frame); ++i) {
+    link_tx_buffer[(link_tx_head + link_tx_count++) % link_tx_buffer.size()] = p[i];
+  }
+  uart_irq_tx_enable(link_device);
+}
+
+static void input_link_sample(struct k_timer*) {
+  uint64_t tick = k_uptime_ticks();
+  RawInputState state;
+  if (!input_get_raw_state(&state, 0)) {
+    return;
+  }
+
+  uint32_t buttons = input_link_pack(state);
+  uint64_t heartbeat = k_ms_to_ticks_ceil64(CONFIG_PASSINGLINK_INPUT_LINK_HEARTBEAT_MS);
+  if (link_last_buttons && *link_last_buttons == buttons &&
+      tick - link_last_send_tick < heartbeat) {
+    return;
+  }
+
+  LinkFrame frame;
+  frame.sync = LINK_SYNC;
+  frame.sequence = link_sequence++;
+  frame.timestamp_us = k_ticks_to_us_floor64(tick);
+  frame.buttons = buttons;
+  frame.crc = input_link_crc(frame);
+  input_link_send(frame);
+  ++link_frames_sent;
+
+  link_last_buttons = buttons;
+  link_last_send_tick = tick;
+}
+
+K_TIMER_DEFINE(input_link_timer, input_link_sample, nullptr);
+
+void input_link_init() {
+  link_device = device_get_binding(DT_LABEL(DT_ALIAS(pl_link)));
+  if (!link_device) {
+    LOG_ERR("failed to find link UART");
+    return;
+  }
+
+  uart_irq_callback_set(link_device, input_link_tx_isr);
+  k_timer_start(&input_link_timer, K_NO_WAIT, K_USEC(CONFIG_PASSINGLINK_INPUT_LINK_SAMPLE_US));
+}
+#endif
+
+#if defined(CONFIG_SHELL)
+static int cmd_link(const struct shell* shell, size_t argc, char** argv) {
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK_PRIMARY)
+  LinkStats stats;
+  uint32_t buttons;
+  optional<uint32_t> offset_us;
+  optional<uint64_t> last_frame_tick;
+  bool timed_out;
+  {
+    ScopedIRQLock lock;
+    stats = link_stats;
+    buttons = link_buttons;
+    offset_us = link_offset_us;
+    last_frame_tick = link_last_frame_tick;
+    timed_out = link_timed_out;
+  }
+
+  if (!last_frame_tick) {
+    shell_print(shell, "link: primary, nothing received");
+    return 0;
+  }
+  shell_print(shell, "link: primary, %s, last frame %u us ago, buttons 0x%08x",
+              timed_out ? "timed out" : "up",
+              static_cast<uint32_t>(k_ticks_to_us_floor64(k_uptime_ticks() - *last_frame_tick)),
+              buttons);
+  shell_print(shell, "  clock offset %u us", offset_us.get_or(0));
+  shell_print(shell, "  %u frames, %u lost, %u corrupt, %u late, %u timeouts", stats.frames,
+              stats.lost, stats.errors, stats.late, stats.timeouts);
+  shell_print(shell, "  worst latency over the fastest frame: %u us", stats.max_excess_us);
+#else
+  shell_print(shell, "link: peripheral, %u frames sent", link_frames_sent);
+#endif
+  return 0;
+}
+
+SHELL_CMD_REGISTER(link, NULL, "Show input link status", cmd_link);
+#endif
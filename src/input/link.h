@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "input/input.h"
+#include "types.h"
+
+// Inputs aggregated from other Passing Link boards (e.g. a detachable thumb button module or macro
+// pad) over a UART link.
+//
+// A peripheral samples its own buttons, and sends a frame with their state and the time at which
+// it was sampled whenever it changes, and at least every CONFIG_PASSINGLINK_INPUT_LINK_HEARTBEAT_MS.
+// The primary aligns those timestamps to its own clock, and debounces each change at the time it
+// was sampled, against a history of its own, before merging it into the first player's buttons.
+//
+// Buttons are identified by their PL_GPIOS() index, so a button on the peripheral shows up as the
+// button with the same name on the primary.
+
+// A change in the buttons held on the peripheral.
+struct LinkEvent {
+  // Bitmask of held buttons, by PL_GPIOS() index.
+  uint32_t buttons;
+
+  // When the change was sampled on the peripheral, in local ticks.
+  uint64_t tick;
+};
+
+static_assert(PL_GPIO_COUNT <= 32);
+
+uint32_t input_link_pack(const RawInputState& state);
+void input_link_unpack(uint32_t buttons, RawInputState* out);
+
+// Called from input_init, once the GPIOs that the peripheral samples are configured.
+void input_link_init();
+
+#if defined(CONFIG_PASSINGLINK_INPUT_LINK_PRIMARY)
+// Take the changes received since the previous call, oldest first. *buttons is set to what the
+// peripheral currently holds, which is nothing if the link has timed out.
+size_t input_link_take_events(span<LinkEvent> out, uint32_t* buttons);
+#endif
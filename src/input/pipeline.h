@@ -0,0 +1,83 @@
+#pragma once
+
+#ifndef LOG_LEVEL
+#error LOG_LEVEL must be defined before including pipeline.h.
+#endif
+
+#include "input/input.h"
+#include "input/socd.h"
+#include "metrics/budget.h"
+#include "profiling.h"
+
+// The input pipeline is a compile-time list of stages that turn sampled GPIOs into an InputState.
+//
+// Each stage is a struct of the form:
+//   struct FooStage {
+//     static constexpr const char* name = "foo";
+//     static constexpr bool enabled = IS_ENABLED(CONFIG_FOO);
+//     static StageResult run(InputPipelineContext& ctx);
+//   };
+//
+// Disabled stages are discarded with `if constexpr`, so their run() doesn't need to exist in
+// configurations where they're turned off, and enabled ones get inlined into a single function.
+enum class StageResult {
+  // Continue on to the next stage.
+  Continue,
+
+  // Stop running stages, the output is complete.
+  Finish,
+
+  // Stop running stages, the output is invalid.
+  Fail,
+};
+
+struct InputPipelineContext {
+  RawInputState raw;
+  InputState* out;
+
+  // State carried over from the previous run.
+  InputPipelineState* state;
+
+  // Index of the player whose input is being parsed.
+  size_t player;
+
+  // The tick at which the pipeline started.
+  uint64_t tick;
+
+  // Whether raw has already been debounced, by oversampling between reports.
+  bool debounced;
+
+  // Buttons held on a peripheral board, by PL_GPIOS() index, already debounced: merged into raw
+  // once the local inputs are.
+  uint32_t link;
+
+  // Output of the SOCD stage.
+  StickOutput stick;
+};
+
+template <typename... Stages>
+struct InputPipeline {
+  static bool run(InputPipelineContext& ctx) {
+    StageResult result = StageResult::Continue;
+    (void)((result = run_stage<Stages>(ctx), result == StageResult::Continue) && ...);
+    budget_record_input(&ctx.raw);
+    return result != StageResult::Fail;
+  }
+
+  // Run a single stage, with profiling if enabled.
+  // This is public so that stages can be benchmarked individually.
+  template <typename Stage>
+  static StageResult run_stage(InputPipelineContext& ctx) {
+    if constexpr (!Stage::enabled) {
+      return StageResult::Continue;
+    } else {
+      StageResult result;
+      {
+        PROFILE(Stage::name, 128);
+        result = Stage::run(ctx);
+      }
+      budget_stage_end(Stage::name);
+      return result;
+    }
+  }
+};
@@ -1,5 +1,8 @@
 #include "input/profile.h"
 
+#include <zephyr.h>
+
+#include "background.h"
 #include "display/menu.h"
 #include "input/input.h"
 #include "input/socd.h"
@@ -23,8 +26,10 @@ struct ButtonMapping {
 struct Profile {
   virtual const char* name() = 0;
   virtual const ButtonMapping* button_mapping() = 0;
-  virtual size_t socd_x(span<SOCDInputs> out, const RawInputState* in) = 0;
-  virtual size_t socd_y(span<SOCDInputs> out, const RawInputState* in) = 0;
+  virtual size_t socd_x(span<SOCDInputs> out, const RawInputState* in,
+                        const ButtonHistory& history) = 0;
+  virtual size_t socd_y(span<SOCDInputs> out, const RawInputState* in,
+                        const ButtonHistory& history) = 0;
 };
 
 static constexpr ButtonMapping base_mapping() {
@@ -46,19 +51,21 @@ static constexpr ButtonMapping default_mapping() {
   return result;
 }
 
-static size_t default_socd_x(span<SOCDInputs> out, const RawInputState* in) {
+static size_t default_socd_x(span<SOCDInputs> out, const RawInputState* in,
+                             const ButtonHistory& history) {
   size_t i = 0;
-  out[i++] = { in->stick_left, button_history.stick_left.tick, SOCDButtonType::Negative };
-  out[i++] = { in->stick_right, button_history.stick_right.tick, SOCDButtonType::Positive };
+  out[i++] = { in->stick_left, history.stick_left.tick, SOCDButtonType::Negative };
+  out[i++] = { in->stick_right, history.stick_right.tick, SOCDButtonType::Positive };
   return i;
 }
 
-static size_t default_socd_y(span<SOCDInputs> out, const RawInputState* in) {
+static size_t default_socd_y(span<SOCDInputs> out, const RawInputState* in,
+                             const ButtonHistory& history) {
   size_t i = 0;
-  out[i++] = { in->stick_up, button_history.stick_up.tick, SOCDButtonType::Negative };
-  out[i++] = { in->stick_down, button_history.stick_down.tick, SOCDButtonType::Positive };
+  out[i++] = { in->stick_up, history.stick_up.tick, SOCDButtonType::Negative };
+  out[i++] = { in->stick_down, history.stick_down.tick, SOCDButtonType::Positive };
 #if PL_GPIO_AVAILABLE(button_w)
-  out[i++] = { in->button_w, button_history.button_w.tick, SOCDButtonType::Negative };
+  out[i++] = { in->button_w, history.button_w.tick, SOCDButtonType::Negative };
 #endif
   return i;
 }
@@ -68,12 +75,14 @@ static struct DefaultProfile : Profile {
 
   const ButtonMapping* button_mapping() final { return &mapping; }
 
-  size_t socd_x(span<SOCDInputs> out, const RawInputState* in) final {
-    return default_socd_x(out, in);
+  size_t socd_x(span<SOCDInputs> out, const RawInputState* in,
+                const ButtonHistory& history) final {
+    return default_socd_x(out, in, history);
   }
 
-  size_t socd_y(span<SOCDInputs> out, const RawInputState* in) final {
-    return default_socd_y(out, in);
+  size_t socd_y(span<SOCDInputs> out, const RawInputState* in,
+                const ButtonHistory& history) final {
+    return default_socd_y(out, in, history);
   }
 
   static constexpr ButtonMapping mapping = default_mapping();
@@ -81,27 +90,29 @@ static struct DefaultProfile : Profile {
 
 #if defined(CONFIG_PASSINGLINK_DISPLAY)
 
-static size_t dashblock_socd_x(span<SOCDInputs> out, const RawInputState* in) {
-  size_t n = default_socd_x(out, in);
+static size_t dashblock_socd_x(span<SOCDInputs> out, const RawInputState* in,
+                               const ButtonHistory& history) {
+  size_t n = default_socd_x(out, in, history);
 #if PL_GPIO_AVAILABLE(button_thumb_left)
-  out[n++] = { in->button_thumb_left, button_history.button_thumb_left.tick,
+  out[n++] = { in->button_thumb_left, history.button_thumb_left.tick,
                SOCDButtonType::Negative, true };
 #endif
 #if PL_GPIO_AVAILABLE(button_thumb_right)
-  out[n++] = { in->button_thumb_right, button_history.button_thumb_right.tick,
+  out[n++] = { in->button_thumb_right, history.button_thumb_right.tick,
                SOCDButtonType::Positive, true };
 #endif
   return n;
 }
 
-static size_t dashblock_socd_y(span<SOCDInputs> out, const RawInputState* in) {
-  size_t n = default_socd_y(out, in);
+static size_t dashblock_socd_y(span<SOCDInputs> out, const RawInputState* in,
+                               const ButtonHistory& history) {
+  size_t n = default_socd_y(out, in, history);
 #if PL_GPIO_AVAILABLE(button_thumb_left)
-  out[n++] = { in->button_thumb_left, button_history.button_thumb_left.tick,
+  out[n++] = { in->button_thumb_left, history.button_thumb_left.tick,
                SOCDButtonType::Neutral, true };
 #endif
 #if PL_GPIO_AVAILABLE(button_thumb_right)
-  out[n++] = { in->button_thumb_right, button_history.button_thumb_right.tick,
+  out[n++] = { in->button_thumb_right, history.button_thumb_right.tick,
                SOCDButtonType::Neutral, true };
 #endif
   return n;
@@ -112,38 +123,42 @@ static struct DashblockProfile : Profile {
 
   const ButtonMapping* button_mapping() final { return &mapping; }
 
-  size_t socd_x(span<SOCDInputs> out, const RawInputState* in) final {
-    return dashblock_socd_x(out, in);
+  size_t socd_x(span<SOCDInputs> out, const RawInputState* in,
+                const ButtonHistory& history) final {
+    return dashblock_socd_x(out, in, history);
   }
 
-  size_t socd_y(span<SOCDInputs> out, const RawInputState* in) final {
-    return dashblock_socd_y(out, in);
+  size_t socd_y(span<SOCDInputs> out, const RawInputState* in,
+                const ButtonHistory& history) final {
+    return dashblock_socd_y(out, in, history);
   }
 
   static constexpr ButtonMapping mapping = base_mapping();
 } dashblock_profile;
 
-static size_t tigerknee_socd_x(span<SOCDInputs> out, const RawInputState* in) {
-  size_t n = default_socd_x(out, in);
+static size_t tigerknee_socd_x(span<SOCDInputs> out, const RawInputState* in,
+                               const ButtonHistory& history) {
+  size_t n = default_socd_x(out, in, history);
 #if PL_GPIO_AVAILABLE(button_thumb_left)
-  out[n++] = { in->button_thumb_left, button_history.button_thumb_left.tick,
+  out[n++] = { in->button_thumb_left, history.button_thumb_left.tick,
                SOCDButtonType::Negative, true };
 #endif
 #if PL_GPIO_AVAILABLE(button_thumb_right)
-  out[n++] = { in->button_thumb_right, button_history.button_thumb_right.tick,
+  out[n++] = { in->button_thumb_right, history.button_thumb_right.tick,
                SOCDButtonType::Positive, true };
 #endif
   return n;
 }
 
-static size_t tigerknee_socd_y(span<SOCDInputs> out, const RawInputState* in) {
-  size_t n = default_socd_y(out, in);
+static size_t tigerknee_socd_y(span<SOCDInputs> out, const RawInputState* in,
+                               const ButtonHistory& history) {
+  size_t n = default_socd_y(out, in, history);
 #if PL_GPIO_AVAILABLE(button_thumb_left)
-  out[n++] = { in->button_thumb_left, button_history.button_thumb_left.tick,
+  out[n++] = { in->button_thumb_left, history.button_thumb_left.tick,
                SOCDButtonType::Negative, true };
 #endif
 #if PL_GPIO_AVAILABLE(button_thumb_right)
-  out[n++] = { in->button_thumb_right, button_history.button_thumb_right.tick,
+  out[n++] = { in->button_thumb_right, history.button_thumb_right.tick,
                SOCDButtonType::Negative, true };
 #endif
   return n;
@@ -154,12 +169,14 @@ static struct TigerKneeProfile : Profile {
 
   const ButtonMapping* button_mapping() final { return &mapping; }
 
-  size_t socd_x(span<SOCDInputs> out, const RawInputState* in) final {
-    return tigerknee_socd_x(out, in);
+  size_t socd_x(span<SOCDInputs> out, const RawInputState* in,
+                const ButtonHistory& history) final {
+    return tigerknee_socd_x(out, in, history);
   }
 
-  size_t socd_y(span<SOCDInputs> out, const RawInputState* in) final {
-    return tigerknee_socd_y(out, in);
+  size_t socd_y(span<SOCDInputs> out, const RawInputState* in,
+                const ButtonHistory& history) final {
+    return tigerknee_socd_y(out, in, history);
   }
 
   static constexpr ButtonMapping mapping = base_mapping();
@@ -175,7 +192,7 @@ static const array<Profile*, 1> profiles = { &default_profile };
 #endif
 
 // TODO: Save active profile.
-static size_t active_profile_idx = 0;
+static array<size_t, PL_PLAYER_COUNT> active_profile_idx = {};
 
 size_t input_profile_count() {
   return profiles.size();
@@ -185,16 +202,16 @@ const char* input_profile_get_name(size_t idx) {
   return profiles[idx]->name();
 }
 
-size_t input_profile_get_active() {
-  return active_profile_idx;
+size_t input_profile_get_active(size_t player) {
+  return active_profile_idx[player];
 }
 
-void input_profile_activate(size_t idx) {
-  active_profile_idx = idx;
+void input_profile_activate(size_t idx, size_t player) {
+  active_profile_idx[player] = idx;
 }
 
-static Profile* active_profile() {
-  return profiles[active_profile_idx];
+static Profile* active_profile(size_t player = 0) {
+  return profiles[active_profile_idx[player]];
 }
 
 #if defined(CONFIG_PASSINGLINK_DISPLAY)
@@ -203,14 +220,16 @@ static SOCDInputs socd_buf[32];
 static SOCDInputs socd_buf[2];
 #endif
 
-static StickOutput::Axis input_profile_socd_x(Profile* profile, const RawInputState* in) {
-  size_t n = profile->socd_x(socd_buf, in);
+static StickOutput::Axis input_profile_socd_x(Profile* profile, const RawInputState* in,
+                                              const ButtonHistory& history) {
+  size_t n = profile->socd_x(socd_buf, in, history);
   span<SOCDInputs> inputs(socd_buf, n);
   return input_socd_parse(input_socd_get_x_type(), inputs);
 }
 
-static StickOutput::Axis input_profile_socd_y(Profile* profile, const RawInputState* in) {
-  size_t n = profile->socd_y(socd_buf, in);
+static StickOutput::Axis input_profile_socd_y(Profile* profile, const RawInputState* in,
+                                              const ButtonHistory& history) {
+  size_t n = profile->socd_y(socd_buf, in, history);
   span<SOCDInputs> inputs(socd_buf, n);
   return input_socd_parse(input_socd_get_y_type(), inputs);
 }
@@ -222,19 +241,66 @@ static bool get_bit(const void* ptr, size_t idx) {
 }
 
 #if defined(CONFIG_PASSINGLINK_DISPLAY)
-bool input_profile_parse_menu(const RawInputState* in, ButtonHistory::Button* menu_button,
-                              StickOutput stick, uint64_t current_tick) {
-  static bool menu_opened = false;
+// Rendering the menu is far more expensive than anything else in the report, so the menu is
+// driven from the background work queue, and the report path only posts events to it.
+enum class MenuAction : uint8_t {
+  Open,
+  Close,
+  Input,
+};
+
+struct MenuEvent {
+  MenuAction action;
+  MenuInput input;
+};
+
+// Inputs are edge-triggered, so the work queue has no trouble keeping up with these.
+K_MSGQ_DEFINE(menu_event_queue, sizeof(MenuEvent), 16, 4);
+
+static void menu_event_handler(struct k_work*) {
+  MenuEvent event;
+  while (k_msgq_get(&menu_event_queue, &event, K_NO_WAIT) == 0) {
+    switch (event.action) {
+      case MenuAction::Open:
+        menu_open();
+        break;
+      case MenuAction::Close:
+        menu_close();
+        break;
+      case MenuAction::Input:
+        menu_input(event.input);
+        break;
+    }
+  }
+}
+
+K_WORK_DEFINE(menu_event_work, menu_event_handler);
+
+// Only the live pipeline state drives the menu.
+static void menu_post(const InputPipelineState* state, MenuAction action,
+                      MenuInput input = MenuInput::Up) {
+  if (!state->live) {
+    return;
+  }
+  MenuEvent event = { action, input };
+  k_msgq_put(&menu_event_queue, &event, K_NO_WAIT);
+  k_work_submit_to_queue(&background_work_q, &menu_event_work);
+}
+
+static bool input_profile_parse_menu(const RawInputState* in, InputPipelineState* state,
+                                     const ButtonHistory::Button* menu_button, StickOutput stick,
+                                     uint64_t current_tick) {
+  bool& menu_opened = state->menu_opened;
 
   if (!menu_button->state) {
     if (menu_opened) {
-      menu_close();
+      menu_post(state, MenuAction::Close);
       menu_opened = false;
     }
     return false;
   }
 
-  if (optional<uint64_t> lock_tick = input_get_lock_tick()) {
+  if (optional<uint64_t> lock_tick = input_get_lock_tick(state)) {
     // TODO: Make timeout configurable.
     // TODO: Display progress bar.
     if (current_tick - menu_button->tick < k_ms_to_ticks_ceil64(2000)) {
@@ -242,28 +308,28 @@ bool input_profile_parse_menu(const RawInputState* in, ButtonHistory::Button* me
     } else if (*lock_tick < menu_button->tick) {
       if (!menu_opened) {
         menu_opened = true;
-        menu_open();
+        menu_post(state, MenuAction::Open);
       }
     }
   } else if (!menu_opened) {
     menu_opened = true;
-    menu_open();
+    menu_post(state, MenuAction::Open);
   }
 
   if (stick.x.value != 0 && stick.x.tick == current_tick) {
     if (stick.x.value == -1) {
-      menu_input(MenuInput::Left);
+      menu_post(state, MenuAction::Input, MenuInput::Left);
     } else {
-      menu_input(MenuInput::Right);
+      menu_post(state, MenuAction::Input, MenuInput::Right);
     }
     return true;
   }
 
   if (stick.y.value != 0 && stick.y.tick == current_tick) {
     if (stick.y.value == -1) {
-      menu_input(MenuInput::Up);
+      menu_post(state, MenuAction::Input, MenuInput::Up);
     } else {
-      menu_input(MenuInput::Down);
+      menu_post(state, MenuAction::Input, MenuInput::Down);
     }
     return true;
   }
@@ -273,63 +339,52 @@ bool input_profile_parse_menu(const RawInputState* in, ButtonHistory::Button* me
 #endif
 
 // Convert ({-1, 0, 1}, {-1, 0, 1}) to a StickState.
+// These are table lookups rather than comparison chains, so they cost the same for every input.
 static StickState stick_state_from_x_y(int horizontal, int vertical) {
-  if (vertical == -1 && horizontal == 0) {
-    return StickState::North;
-  } else if (vertical == -1 && horizontal == 1) {
-    return StickState::NorthEast;
-  } else if (vertical == 0 && horizontal == 1) {
-    return StickState::East;
-  } else if (vertical == 1 && horizontal == 1) {
-    return StickState::SouthEast;
-  } else if (vertical == 1 && horizontal == 0) {
-    return StickState::South;
-  } else if (vertical == 1 && horizontal == -1) {
-    return StickState::SouthWest;
-  } else if (vertical == 0 && horizontal == -1) {
-    return StickState::West;
-  } else if (vertical == -1 && horizontal == -1) {
-    return StickState::NorthWest;
-  } else {
-    return StickState::Neutral;
-  }
-
-  __builtin_unreachable();
+  static constexpr StickState states[3][3] = {
+    // vertical = -1
+    { StickState::NorthWest, StickState::North, StickState::NorthEast },
+    // vertical = 0
+    { StickState::West, StickState::Neutral, StickState::East },
+    // vertical = 1
+    { StickState::SouthWest, StickState::South, StickState::SouthEast },
+  };
+  return states[vertical + 1][horizontal + 1];
 }
 
 // Scale {-1, 0, 1} to {-128, 0, 127}.
 static uint8_t stick_scale(int sign) {
-  if (sign < 0) {
-    return 0x00;
-  } else if (sign == 0) {
-    return 0x80;
-  } else {
-    return 0xFF;
-  }
+  static constexpr uint8_t values[3] = { 0x00, 0x80, 0xFF };
+  return values[sign + 1];
 }
 
-static StickOutput input_socd(Profile* profile, const RawInputState* in) {
+StickOutput input_profile_socd(const RawInputState* in, const InputPipelineState* state,
+                               size_t player) {
+  Profile* profile = active_profile(player);
+  const ButtonHistory& history = state->history[player];
   return StickOutput {
-    .x = input_profile_socd_x(profile, in),
-    .y = input_profile_socd_y(profile, in),
+    .x = input_profile_socd_x(profile, in, history),
+    .y = input_profile_socd_y(profile, in, history),
   };
 }
 
-void input_profile_parse(InputState* out, const RawInputState* in, uint64_t current_tick) {
-  Profile* profile = active_profile();
-  const ButtonMapping* mapping = profile->button_mapping();
-
-  StickOutput stick_output = input_socd(profile, in);
-
 #if defined(CONFIG_PASSINGLINK_DISPLAY)
-  if (mapping->button_menu != 0xff) {
-    if (input_profile_parse_menu(in, &button_history.values[mapping->button_menu], stick_output,
-                                 current_tick)) {
-      return;
-    }
+bool input_profile_menu(const RawInputState* in, InputPipelineState* state, StickOutput stick,
+                        uint64_t current_tick) {
+  const ButtonMapping* mapping = active_profile()->button_mapping();
+  if (mapping->button_menu == 0xff) {
+    return false;
   }
+
+  return input_profile_parse_menu(in, state, &state->history[0].values[mapping->button_menu],
+                                  stick, current_tick);
+}
 #endif
 
+void input_profile_remap(InputState* out, const RawInputState* in,
+                         const InputPipelineState* state, StickOutput stick_output, size_t player) {
+  const ButtonMapping* mapping = active_profile(player)->button_mapping();
+
 #define BUTTONS()       \
   BUTTON(button_north)  \
   BUTTON(button_east)   \
@@ -350,8 +405,7 @@ void input_profile_parse(InputState* out, const RawInputState* in, uint64_t curr
 #undef BUTTON
 #undef BUTTONS
 
-  OutputMode output_mode = input_get_output_mode();
-  switch (output_mode) {
+  switch (state->output_mode) {
     case OutputMode::mode_dpad:
       out->dpad = stick_state_from_x_y(stick_output.x.value, stick_output.y.value);
       break;
@@ -366,13 +420,6 @@ void input_profile_parse(InputState* out, const RawInputState* in, uint64_t curr
       out->right_stick_y = stick_scale(stick_output.y.value);
       break;
   }
-
-  bool input_locked = input_get_lock_tick();
-  if (input_locked) {
-    out->button_select = 0;
-    out->button_start = 0;
-    out->button_home = 0;
-  }
 }
 
 void input_profile_init() {}
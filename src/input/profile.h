@@ -7,7 +7,19 @@ void input_profile_init();
 size_t input_profile_count();
 const char* input_profile_get_name(size_t idx);
 
-size_t input_profile_get_active();
-void input_profile_activate(size_t idx);
+// Each player has their own active profile. The menu only controls the first player's.
+size_t input_profile_get_active(size_t player = 0);
+void input_profile_activate(size_t idx, size_t player = 0);
 
-void input_profile_parse(InputState* out, const RawInputState* in, uint64_t current_tick);
+// Pipeline stages that depend on the active profile.
+StickOutput input_profile_socd(const RawInputState* in, const InputPipelineState* state,
+                               size_t player);
+
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+// Returns true if the menu consumed the input.
+bool input_profile_menu(const RawInputState* in, InputPipelineState* state, StickOutput stick,
+                        uint64_t current_tick);
+#endif
+
+void input_profile_remap(InputState* out, const RawInputState* in,
+                         const InputPipelineState* state, StickOutput stick, size_t player);
@@ -4,6 +4,8 @@
 
 #include <logging/log.h>
 
+#include "background.h"
+
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(queue);
 
@@ -21,6 +23,22 @@ static InputQueue* queue_next_free_head;
 
 static int64_t queue_next_tick;
 
+// Freeing a finished queue walks the whole chain, so it's done from the background work queue
+// instead of the report path.
+static InputQueue* queue_pending_free;
+
+static void input_queue_free_pending(struct k_work*) {
+  InputQueue* p;
+  {
+    ScopedIRQLock lock;
+    p = queue_pending_free;
+    queue_pending_free = nullptr;
+  }
+  input_queue_free(p);
+}
+
+K_WORK_DEFINE(queue_free_work, input_queue_free_pending);
+
 InputQueue* input_queue_alloc() {
   ScopedIRQLock lock;
   InputQueue* result = nullptr;
@@ -50,22 +68,21 @@ InputQueue* input_queue_append(InputQueue* head) {
   return tail;
 }
 
+// The chain must already be detached from anything the report path can reach, so only the
+// allocator's state needs the lock, one entry at a time.
 void input_queue_free(InputQueue* p) {
-  if (!p) return;
-
-  ScopedIRQLock lock;
-
-  do {
+  while (p) {
     ptrdiff_t offset = p - queue_storage;
     assert(offset >= 0);
     assert(static_cast<size_t>(offset) < queue_storage_size);
     p = p->next;
 
+    ScopedIRQLock lock;
     queue_storage_bitmap[offset] = false;
     if (static_cast<size_t>(offset) < queue_storage_last_avail) {
       queue_storage_last_avail = offset;
     }
-  } while (p);
+  }
 }
 
 optional<RawInputState> input_queue_get_state() {
@@ -81,9 +98,12 @@ optional<RawInputState> input_queue_get_state() {
       InputQueue* prev = queue_next;
       queue_next = queue_next->next;
 
-      if (!queue_next) {
-        input_queue_free(queue_next_free_head);
+      if (!queue_next && queue_next_free_head) {
+        // Queues are only replaced from thread context, so there's never more than one of these
+        // outstanding: input_queue_set_active() flushes it first.
+        queue_pending_free = queue_next_free_head;
         queue_next_free_head = nullptr;
+        k_work_submit_to_queue(&background_work_q, &queue_free_work);
       }
     }
     return queue_input;
@@ -96,16 +116,24 @@ bool input_queue_is_active() {
 }
 
 void input_queue_set_active(InputQueue* queue, bool consume) {
-  ScopedIRQLock lock;
-
-  input_queue_free(queue_next_free_head);
-  queue_next_free_head = nullptr;
-
-  queue_next = queue;
-  queue_next_tick = k_uptime_ticks();
-  if (consume) {
-    queue_next_free_head = queue;
+  InputQueue* pending_free;
+  InputQueue* next_free_head;
+  {
+    ScopedIRQLock lock;
+    pending_free = queue_pending_free;
+    queue_pending_free = nullptr;
+    next_free_head = queue_next_free_head;
+    queue_next_free_head = nullptr;
+
+    queue_next = queue;
+    queue_next_tick = k_uptime_ticks();
+    if (consume) {
+      queue_next_free_head = queue;
+    }
   }
+
+  input_queue_free(pending_free);
+  input_queue_free(next_free_head);
 }
 
 #endif
@@ -20,112 +20,78 @@ void input_socd_set_y_type(SOCDType type) {
   input_socd_type_y = type;
 }
 
+// Select between two values without branching on the condition.
+template <typename T>
+static T select(bool condition, T if_true, T if_false) {
+  T mask = -static_cast<T>(condition);
+  return (if_true & mask) | (if_false & ~mask);
+}
+
+// This runs on every report, so it's written to take the same time regardless of which inputs are
+// held: every input is visited, and conflicts are resolved with selects instead of branches.
+// Branching on the SOCD type is fine, since that doesn't change from report to report.
 StickOutput::Axis input_socd_parse(SOCDType type, span<SOCDInputs> inputs) {
-  optional<uint64_t> newest_positive;
-  optional<uint64_t> newest_neutral;
-  optional<uint64_t> newest_negative;
+  // Indexed by SOCDButtonType + 1.
+  bool valid[3] = {};
+  uint64_t newest[3] = {};
+
+  // The first held input that overrides the others.
+  bool have_override = false;
+  int override_value = 0;
+  uint64_t override_tick = 0;
 
   for (auto& input : inputs) {
-    if (input.input_value) {
-      if (input.overrides) {
-        return StickOutput::Axis {
-          .value = static_cast<int>(input.button_type),
-          .tick = input.input_tick,
-        };
-      }
-      optional<uint64_t>* target = nullptr;
-      switch (input.button_type) {
-        case SOCDButtonType::Positive:
-          target = &newest_positive;
-          break;
-
-        case SOCDButtonType::Neutral:
-          target = &newest_neutral;
-          break;
-
-        case SOCDButtonType::Negative:
-          target = &newest_negative;
-          break;
-      }
+    bool pressed = input.input_value;
+    size_t idx = static_cast<int>(input.button_type) + 1;
 
-      if (!*target || **target < input.input_tick) {
-        target->reset(input.input_tick);
-      }
-    }
+    bool take_override = pressed & input.overrides & !have_override;
+    override_value = select(take_override, static_cast<int>(input.button_type), override_value);
+    override_tick = select(take_override, input.input_tick, override_tick);
+    have_override |= take_override;
+
+    bool take = pressed & !input.overrides & (!valid[idx] | (newest[idx] < input.input_tick));
+    newest[idx] = select(take, input.input_tick, newest[idx]);
+    valid[idx] |= take;
   }
 
+  bool negative = valid[0];
+  bool positive = valid[2];
+
+  StickOutput::Axis result;
   switch (type) {
     case SOCDType::Neutral:
-      return StickOutput::Axis {
-        .value = newest_positive.valid() - newest_negative.valid(),
-        .tick = max(newest_positive.get_or(0), newest_negative.get_or(0)),
-      };
+      result.value = positive - negative;
+      result.tick = max(newest[0], newest[2]);
+      break;
 
     case SOCDType::Positive:
-      if (newest_positive.valid()) {
-        return StickOutput::Axis {
-          .value = 1,
-          .tick = *newest_positive,
-        };
-      } else if (newest_negative.valid()) {
-        return StickOutput::Axis {
-          .value = -1,
-          .tick = *newest_negative,
-        };
-      } else {
-        return StickOutput::Axis {
-          .value = 0,
-          .tick = 0,
-        };
-      }
+      result.value = select(positive, 1, -static_cast<int>(negative));
+      result.tick = select(positive, newest[2], newest[0]);
+      break;
 
     case SOCDType::Negative:
-      if (newest_negative.valid()) {
-        return StickOutput::Axis {
-          .value = -1,
-          .tick = *newest_negative,
-        };
-      } else if (newest_positive.valid()) {
-        return StickOutput::Axis {
-          .value = 1,
-          .tick = *newest_positive,
-        };
-      } else {
-        return StickOutput::Axis {
-          .value = 0,
-          .tick = 0,
-        };
-      }
-
-    case SOCDType::Last:
+      result.value = select(negative, -1, static_cast<int>(positive));
+      result.tick = select(negative, newest[0], newest[2]);
       break;
-  }
 
-  struct {
-    optional<uint64_t> tick;
-    int value;
-  } results[] = {
-    { newest_positive, 1 },
-    { newest_neutral, 0 },
-    { newest_negative, -1 },
-  };
-
-  optional<uint64_t> newest_tick;
-  optional<int> newest_value;
-#define X(tick, value)                          \
-  if (tick) {                                   \
-    if (!newest_tick || *newest_tick < *tick) { \
-      newest_tick = *tick;                      \
-      newest_value.reset(value);                \
-    }                                           \
+    case SOCDType::Last: {
+      // Newest wins, with ties going to positive, then neutral, then negative.
+      bool have_newest = false;
+      result.value = 0;
+      result.tick = 0;
+      static constexpr int values[] = { 1, 0, -1 };
+      for (int value : values) {
+        size_t idx = value + 1;
+        bool take = valid[idx] & (!have_newest | (result.tick < newest[idx]));
+        result.value = select(take, value, result.value);
+        result.tick = select(take, newest[idx], result.tick);
+        have_newest |= take;
+      }
+      break;
+    }
   }
 
-  X(newest_positive, 1);
-  X(newest_neutral, 0);
-  X(newest_negative, -1);
-
-  return StickOutput::Axis {
-    .value = newest_value.get_or(0),
-    .tick = newest_tick.get_or(0),
-  };
+  result.value = select(have_override, override_value, result.value);
+  result.tick = select(have_override, override_tick, result.tick);
+  return result;
 }
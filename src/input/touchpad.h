@@ -26,7 +26,8 @@ struct TouchpadData {
   TouchpadXY p2;
 };
 
-extern TouchpadData touchpad_data;
+// Published by input_touchpad_poll, read by the report encoders.
+extern seqlock<TouchpadData> touchpad_data;
 
 void input_touchpad_init();
 
@@ -14,6 +14,8 @@ void input_touchpad_poll() {}
 
 void input_touchpad_init() {
   LOG_INF("touchpad disabled");
-  touchpad_data.p1.unpressed = 1;
-  touchpad_data.p2.unpressed = 1;
+  TouchpadData data = {};
+  data.p1.unpressed = 1;
+  data.p2.unpressed = 1;
+  touchpad_data.store(data);
 }
@@ -7,11 +7,13 @@
 #include <drivers/gpio.h>
 #include <drivers/i2c.h>
 #include <logging/log.h>
+#include <shell/shell.h>
 
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(touchpad);
 
 #include "arch.h"
+#include "metrics/metrics.h"
 #include "profiling.h"
 #include "types.h"
 
@@ -25,8 +27,19 @@ LOG_MODULE_REGISTER(touchpad);
 #error "Unsupported board; tp_rst not defined"
 #endif
 
+// The touch interrupt line is optional: without it, the touchpad gets polled while idle.
+#define TP_INT_NODE DT_PATH(gpio_keys, tp_int)
+#if DT_NODE_HAS_STATUS(TP_INT_NODE, okay)
+#define TP_INT_LABEL DT_GPIO_LABEL(TP_INT_NODE, gpios)
+#define TP_INT_PIN DT_GPIO_PIN(TP_INT_NODE, gpios)
+#define TP_INT_FLAGS DT_GPIO_FLAGS(TP_INT_NODE, gpios)
+#endif
+
 static const struct device* tp_i2c_device;
 static const struct device* tp_rst_device;
+#if defined(TP_INT_PIN)
+static const struct device* tp_int_device;
+#endif
 
 struct TouchpadXYFormat {
   uint8_t xh : 4;
@@ -57,30 +70,82 @@ static bool succeeded_once;
 static bool disabled;
 static uint8_t attempts;
 
-static uint8_t counter;
+// The writer's copy of touchpad_data, which gets published after every successful read.
+static TouchpadData touchpad_state;
+
+// We get polled once per report by USB, and read the touchpad at a rate that depends on activity:
+//   - while idle, every CONFIG_PASSINGLINK_INPUT_TOUCHPAD_IDLE_DIVIDER polls, or only when the
+//     interrupt line is asserted on boards that have one
+//   - while touched, and for CONFIG_PASSINGLINK_INPUT_TOUCHPAD_HOLD_MS after the last release,
+//     every CONFIG_PASSINGLINK_INPUT_TOUCHPAD_ACTIVE_DIVIDER polls
+enum class TouchpadActivity {
+  Idle,
+  Active,
+  Hold,
+};
+
+static TouchpadActivity activity;
+static uint32_t release_ms;
+static uint32_t counter;
+
+struct TouchpadStats {
+  uint32_t reads;
+  uint32_t failures;
+  uint64_t bus_cycles;
+};
+
+static TouchpadStats stats;
+
+static bool touchpad_should_read() {
+  if (activity == TouchpadActivity::Hold &&
+      k_uptime_get_32() - release_ms >= CONFIG_PASSINGLINK_INPUT_TOUCHPAD_HOLD_MS) {
+    activity = TouchpadActivity::Idle;
+  }
+
+  uint32_t divider = CONFIG_PASSINGLINK_INPUT_TOUCHPAD_ACTIVE_DIVIDER;
+  if (activity == TouchpadActivity::Idle) {
+#if defined(TP_INT_PIN)
+    // Keep polling until the touchpad has answered once, so that a missing one gets disabled.
+    if (succeeded_once) {
+      counter = 0;
+      return gpio_pin_get(tp_int_device, TP_INT_PIN) > 0;
+    }
+#endif
+    divider = CONFIG_PASSINGLINK_INPUT_TOUCHPAD_IDLE_DIVIDER;
+  }
+
+  if (++counter < divider) {
+    return false;
+  }
+  counter = 0;
+  return true;
+}
+
 void input_touchpad_poll() {
   if (disabled) {
     return;
   }
 
-  // We get polled at 1000Hz by USB.
-  // Divide this by 8, since this isn't critical.
-  if (++counter == 8) {
-    counter = 0;
-  } else {
+  if (!touchpad_should_read()) {
     return;
-  };
+  }
 
   PROFILE("input_touchpad_poll", 128);
-  TouchpadData* output = &touchpad_data;
+  TouchpadData* output = &touchpad_state;
   TouchpadOutput input;
 
   uint8_t reg = TP_OUTPUT_REGISTER;
   input.touchpoints = 0;
 
+  uint32_t begin = get_cycle_count();
   int rc = i2c_write_read(tp_i2c_device, TP_I2C_ADDRESS, &reg, sizeof(reg), &input, sizeof(input));
+  uint32_t bus_cycles = get_cycle_count() - begin;
+  ++stats.reads;
+  stats.bus_cycles += bus_cycles;
+  metrics_record_touchpad_read(static_cast<uint64_t>(bus_cycles) * 1'000'000 / get_cpu_freq());
 
   if (rc != 0) {
+    ++stats.failures;
     if (!succeeded_once) {
       if (attempts++ > 128) {
         LOG_ERR("touchpad: not found, disabling");
@@ -91,12 +156,14 @@ void input_touchpad_poll() {
       LOG_WRN("failed to read TP_OUTPUT_REGISTER: rc = %d", rc);
     }
   } else {
+    succeeded_once = true;
     if (input.touchpoints == 0) {
       LOG_DBG("no touchpoints");
       output->p1.unpressed = 1;
     }
 
     if (input.touchpoints >= 1) {
+      activity = TouchpadActivity::Active;
       if (output->p1.unpressed) {
         ++output->p1.counter;
         output->p1.unpressed = 0;
@@ -107,10 +174,15 @@ void input_touchpad_poll() {
       output->p1.set_x(p1_x);
       output->p1.set_y(p1_y);
     } else {
+      if (activity == TouchpadActivity::Active) {
+        activity = TouchpadActivity::Hold;
+        release_ms = k_uptime_get_32();
+      }
       output->p1.unpressed = 1;
     }
 
     // TODO: Implement multitouch.
+    touchpad_data.store(touchpad_state);
   }
 }
 
@@ -118,8 +190,49 @@ void input_touchpad_init() {
   tp_i2c_device = device_get_binding(DT_PROP(DT_ALIAS(tp_i2c), label));
   tp_rst_device = device_get_binding(TP_RST_LABEL);
   gpio_pin_configure(tp_rst_device, TP_RST_PIN, TP_RST_FLAGS | GPIO_OUTPUT);
+#if defined(TP_INT_PIN)
+  tp_int_device = device_get_binding(TP_INT_LABEL);
+  gpio_pin_configure(tp_int_device, TP_INT_PIN, TP_INT_FLAGS | GPIO_INPUT);
+#endif
   tp_reset();
 
-  touchpad_data.p1.unpressed = 1;
-  touchpad_data.p2.unpressed = 1;
+  touchpad_state.p1.unpressed = 1;
+  touchpad_state.p2.unpressed = 1;
+  touchpad_data.store(touchpad_state);
 }
+
+#if defined(CONFIG_SHELL)
+static int cmd_touchpad(const struct shell* shell, size_t argc, char** argv) {
+  static const char* activity_names[] = {"idle", "active", "hold"};
+  static uint32_t last_ms;
+  static uint32_t last_reads;
+  static uint64_t last_bus_cycles;
+
+  TouchpadStats current;
+  TouchpadActivity current_activity;
+  {
+    ScopedIRQLock lock;
+    current = stats;
+    current_activity = activity;
+  }
+
+  // Rates are over the interval since the previous invocation.
+  uint32_t now = k_uptime_get_32();
+  uint32_t elapsed_ms = max<uint32_t>(now - last_ms, 1);
+  uint32_t reads = current.reads - last_reads;
+  uint64_t bus_us = (current.bus_cycles - last_bus_cycles) * 1'000'000 / get_cpu_freq();
+  last_ms = now;
+  last_reads = current.reads;
+  last_bus_cycles = current.bus_cycles;
+
+  shell_print(shell, "touchpad: %s%s, %u reads (%u failed)",
+              disabled ? "disabled, " : "", activity_names[static_cast<int>(current_activity)],
+              current.reads, current.failures);
+  shell_print(shell, "  %u reads/s, %u us of bus time per read, %u us/s", reads * 1000 / elapsed_ms,
+              reads ? static_cast<uint32_t>(bus_us / reads) : 0,
+              static_cast<uint32_t>(bus_us * 1000 / elapsed_ms));
+  return 0;
+}
+
+SHELL_CMD_REGISTER(touchpad, NULL, "Report touchpad sampling statistics", cmd_touchpad);
+#endif
@@ -14,6 +14,7 @@
 #include "input/input.h"
 #include "output/output.h"
 #include "provisioning.h"
+#include "recovery.h"
 #include "version.h"
 
 #define LOG_LEVEL LOG_LEVEL_DBG
@@ -60,6 +61,7 @@ static int stm32_usb_reset(const struct device*) {
 #define USB_RESET_PRIORITY 41
 SYS_INIT(stm32_usb_reset, POST_KERNEL, USB_RESET_PRIORITY);
 static_assert(CONFIG_KERNEL_INIT_PRIORITY_DEFAULT < USB_RESET_PRIORITY);
+static_assert(ARCH_CALIBRATION_PRIORITY < USB_RESET_PRIORITY);
 static_assert(USB_RESET_PRIORITY < CONFIG_PINMUX_STM32_DEVICE_INITIALIZATION_PRIORITY);
 
 #endif
@@ -68,6 +70,8 @@ static_assert(USB_RESET_PRIORITY < CONFIG_PINMUX_STM32_DEVICE_INITIALIZATION_PRI
 // main is renamed to zephyr_app_main via macro and must not be mangled,
 // or it'll be silently ignored.
 extern "C" void main(void) {
+  bool recovering = recovery_init();
+
   auto kver = sys_kernel_version_get();
 
   LOG_INF("passinglink %s (kernel version %d.%d.%d) initializing", version_string(),
@@ -77,20 +81,26 @@ extern "C" void main(void) {
     LOG_ERR("%s: rc = %d", init_error, init_rc);
   }
 
-#if defined(NRF52840)
-  // Enable the trace unit so we can get a cycle count.
-  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
-  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
-#endif
-
 #if defined(CONFIG_PASSINGLINK_DISPLAY)
-  display_init();
+  if (!recovering) {
+    display_init();
+  }
 #endif
 
   provisioning_init();
   input_init();
   output_init();
 
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+  // Bringing up the display can take a while, so get reports flowing first when recovering.
+  if (recovering) {
+    display_init();
+    if (auto probe = recovery_get_probe()) {
+      display_set_connection_type(false, *probe);
+    }
+  }
+#endif
+
 #if defined(CONFIG_PASSINGLINK_BT)
   bluetooth_init();
 #endif
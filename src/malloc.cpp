@@ -11,9 +11,15 @@
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(malloc);
 
+// The PS4 auth simulator reports peak heap usage.
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_PS4_AUTH_SIM)
+#define ALLOC_HWM 1
+#else
 #define ALLOC_HWM 0
+#endif
 
 extern "C" void dump_allocator_hwm();
+extern "C" size_t allocator_get_hwm();
 
 template <size_t Bits>
 struct Bitset {
@@ -86,9 +92,11 @@ struct Bucket {
   }
 
   void dump_hwm() { LOG_WRN("Bucket<%zu> hwm = %zu", Size, hwm); }
+  size_t hwm_bytes() { return hwm * Size; }
 #else
   void update_hwm(int sign) {}
   void dump_hwm() {}
+  size_t hwm_bytes() { return 0; }
 #endif
 
   Block blocks_[Count];
@@ -143,7 +151,16 @@ struct Allocator {
   void dump_hwm() {
 #define BUCKET(block_size, count) bucket_##block_size.dump_hwm();
     BUCKETS()
-#undef BUCKETS
+#undef BUCKET
+  }
+
+  // The sum of each bucket's peak, which is an upper bound on the overall peak.
+  size_t hwm_bytes() {
+    size_t result = 0;
+#define BUCKET(block_size, count) result += bucket_##block_size.hwm_bytes();
+    BUCKETS()
+#undef BUCKET
+    return result;
   }
 };
 
@@ -161,8 +178,16 @@ extern "C" void dump_allocator_hwm() {
   allocator.dump_hwm();
 }
 
+extern "C" size_t allocator_get_hwm() {
+  return allocator.hwm_bytes();
+}
+
 #else
 
 extern "C" void dump_allocator_hwm() {}
 
+extern "C" size_t allocator_get_hwm() {
+  return 0;
+}
+
 #endif  // defined(CONFIG_PASSINGLINK_ALLOCATOR)
@@ -0,0 +1,184 @@
+#include "metrics/blackbox.h"
+
+#include <zephyr.h>
+
+#include <init.h>
+
+#include <shell/shell.h>
+
+#include "output/usb/hid.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(blackbox);
+
+static constexpr size_t BLACKBOX_SIZE = CONFIG_PASSINGLINK_BLACKBOX_SIZE;
+static_assert((BLACKBOX_SIZE & (BLACKBOX_SIZE - 1)) == 0, "black box size must be a power of two");
+
+static constexpr uint32_t BLACKBOX_MAGIC = 0x504c4242;  // PLBB
+
+struct BlackboxLog {
+  uint32_t magic;
+  uint32_t boots;
+
+  // Total number of events recorded, the next entry goes at count % BLACKBOX_SIZE.
+  uint32_t count;
+
+  BlackboxEntry entries[BLACKBOX_SIZE];
+};
+
+static BlackboxLog blackbox __attribute__((section(".noinit")));
+static size_t blackbox_read_cursor;
+
+const char* to_string(BlackboxEvent event) {
+  switch (event) {
+    case BlackboxEvent::Invalid:
+      return "Invalid";
+    case BlackboxEvent::Boot:
+      return "Boot";
+    case BlackboxEvent::UsbStatus:
+      return "UsbStatus";
+    case BlackboxEvent::UsbWriteFailed:
+      return "UsbWriteFailed";
+    case BlackboxEvent::Stall:
+      return "Stall";
+    case BlackboxEvent::BudgetOverrun:
+      return "BudgetOverrun";
+    case BlackboxEvent::ProbeStart:
+      return "ProbeStart";
+    case BlackboxEvent::ProbeSelected:
+      return "ProbeSelected";
+    case BlackboxEvent::AuthState:
+      return "AuthState";
+    case BlackboxEvent::Panic:
+      return "Panic";
+    case BlackboxEvent::Reboot:
+      return "Reboot";
+    case BlackboxEvent::Fault:
+      return "Fault";
+    case BlackboxEvent::Recovered:
+      return "Recovered";
+  }
+  return "<invalid>";
+}
+
+// Validate the log left behind by the previous boot, or start a new one. This runs before anything
+// else gets initialized, so that nothing that happens during boot goes unrecorded.
+static int blackbox_init(const struct device*) {
+  if (blackbox.magic != BLACKBOX_MAGIC) {
+    memset(&blackbox, 0, sizeof(blackbox));
+    blackbox.magic = BLACKBOX_MAGIC;
+  } else {
+    LOG_INF("recovered %u events from previous boot", min<uint32_t>(blackbox.count, BLACKBOX_SIZE));
+  }
+
+  ++blackbox.boots;
+  blackbox_record(BlackboxEvent::Boot, 0, blackbox.boots);
+  return 0;
+}
+
+SYS_INIT(blackbox_init, PRE_KERNEL_1, 0);
+
+void blackbox_record(BlackboxEvent event, uint8_t arg8, uint16_t arg16) {
+  ScopedIRQLock lock;
+  BlackboxEntry& entry = blackbox.entries[blackbox.count++ & (BLACKBOX_SIZE - 1)];
+  entry.cycle = k_cycle_get_32();
+  entry.event = event;
+  entry.arg8 = arg8;
+  entry.arg16 = arg16;
+}
+
+void blackbox_record_panic() {
+  blackbox_record(BlackboxEvent::Panic);
+}
+
+size_t blackbox_get_entries(span<BlackboxEntry> out, size_t skip) {
+  ScopedIRQLock lock;
+  size_t available = min<size_t>(blackbox.count, BLACKBOX_SIZE);
+  if (skip >= available) {
+    return 0;
+  }
+  size_t n = min(available - skip, out.size());
+  size_t first = blackbox.count - available + skip;
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = blackbox.entries[(first + i) & (BLACKBOX_SIZE - 1)];
+  }
+  return n;
+}
+
+void blackbox_clear() {
+  ScopedIRQLock lock;
+  blackbox.count = 0;
+  blackbox_read_cursor = 0;
+}
+
+static constexpr size_t BLACKBOX_REPORT_ENTRIES = 7;
+
+struct __attribute__((packed)) BlackboxReport {
+  uint8_t report_id;
+  uint16_t index;
+  uint16_t count;
+  BlackboxEntry entries[BLACKBOX_REPORT_ENTRIES];
+};
+
+// Each read returns the next page of the log, starting over from the oldest after the last one.
+ssize_t blackbox_get_report(span<uint8_t> buf) {
+  if (buf.size() < sizeof(BlackboxReport)) {
+    LOG_ERR("blackbox_get_report: buffer too small (%zu)", buf.size());
+    return -1;
+  }
+
+  BlackboxReport report = {};
+  report.report_id = static_cast<uint8_t>(PLReportId::Blackbox);
+
+  ScopedIRQLock lock;
+  size_t available = min<size_t>(blackbox.count, BLACKBOX_SIZE);
+  if (blackbox_read_cursor >= available) {
+    blackbox_read_cursor = 0;
+  }
+
+  size_t first = blackbox.count - available;
+  size_t n = min(BLACKBOX_REPORT_ENTRIES, available - blackbox_read_cursor);
+  for (size_t i = 0; i < n; ++i) {
+    report.entries[i] = blackbox.entries[(first + blackbox_read_cursor + i) & (BLACKBOX_SIZE - 1)];
+  }
+
+  report.index = blackbox_read_cursor;
+  report.count = available;
+  blackbox_read_cursor += n;
+
+  memcpy(buf.data(), &report, sizeof(report));
+  return sizeof(report);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_blackbox(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+    blackbox_clear();
+    shell_print(shell, "blackbox: cleared");
+    return 0;
+  } else if (argc != 1) {
+    shell_print(shell, "usage: blackbox [clear]");
+    return 0;
+  }
+
+  // Copy out a page at a time, rather than keeping a second copy of the whole log around. Events
+  // that come in while dumping push the window along, and can cause a few to be printed twice.
+  shell_print(shell, "blackbox: %u events, cycles at %u Hz",
+              min<uint32_t>(blackbox.count, BLACKBOX_SIZE), sys_clock_hw_cycles_per_sec());
+  BlackboxEntry entries[16];
+  size_t printed = 0;
+  while (size_t count = blackbox_get_entries(entries, printed)) {
+    for (size_t i = 0; i < count; ++i) {
+      const BlackboxEntry& entry = entries[i];
+      shell_print(shell, "  [%u] %s %u %u", entry.cycle, to_string(entry.event), entry.arg8,
+                  entry.arg16);
+    }
+    printed += count;
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(blackbox, NULL, "Dump the black box event log", cmd_blackbox);
+#endif
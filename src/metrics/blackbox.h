@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "types.h"
+
+// Black box recorder for high level events.
+//
+// Events are kept in a ring buffer in .noinit RAM, so that the log from before a warm reboot or a
+// panic can be read out after the next boot. Recording an event is a handful of stores with
+// interrupts disabled, so it's cheap enough to leave on everywhere.
+enum class BlackboxEvent : uint8_t {
+  Invalid = 0,
+
+  // arg16: number of boots seen by the log.
+  Boot,
+
+  // arg8: usb_dc_status_code, arg16: endpoint for halt changes.
+  UsbStatus,
+
+  // arg8: HID interface, arg16: -rc.
+  UsbWriteFailed,
+
+  // arg8: HID interface, arg16: milliseconds since the previous report.
+  Stall,
+
+  // arg16: report time as a percentage of the budget.
+  BudgetOverrun,
+
+  // arg8: ProbeType.
+  ProbeStart,
+  ProbeSelected,
+
+  // arg8: AuthStateType, arg16: nonce id.
+  AuthState,
+
+  Panic,
+  Reboot,
+
+  // arg8: k_fatal_error_reason.
+  Fault,
+
+  // arg16: milliseconds from boot to the first report.
+  Recovered,
+};
+
+const char* to_string(BlackboxEvent event);
+
+struct BlackboxEntry {
+  // k_cycle_get_32() at the time of the event.
+  uint32_t cycle;
+  BlackboxEvent event;
+  uint8_t arg8;
+  uint16_t arg16;
+};
+
+static_assert(sizeof(BlackboxEntry) == 8);
+
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+
+void blackbox_record(BlackboxEvent event, uint8_t arg8 = 0, uint16_t arg16 = 0);
+
+// Copy out the log, oldest first, starting `skip` entries in. Returns the number of entries
+// written.
+size_t blackbox_get_entries(span<BlackboxEntry> out, size_t skip = 0);
+void blackbox_clear();
+
+// Serialize the next page of the log into a PL feature report.
+ssize_t blackbox_get_report(span<uint8_t> buf);
+
+#else
+
+inline void blackbox_record(BlackboxEvent, uint8_t = 0, uint16_t = 0) {}
+
+#endif
@@ -0,0 +1,183 @@
+#include "metrics/budget.h"
+
+#include <zephyr.h>
+
+#include <shell/shell.h>
+
+#include "arch.h"
+#include "metrics/blackbox.h"
+#include "output/usb/hid.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(budget);
+
+static constexpr size_t BUDGET_LOG_SIZE = 8;
+
+// The thread that's building a report, or nullptr between reports. The input pipeline also gets
+// run from elsewhere (e.g. the Bluetooth paths), which mustn't be charged to the report.
+static k_tid_t report_thread;
+
+static uint32_t report_begin_cycle;
+static uint32_t stage_begin_cycle;
+
+static const char* worst_stage;
+static uint32_t worst_stage_cycles;
+static RawInputState report_input;
+
+static array<BudgetOverrun, BUDGET_LOG_SIZE> overrun_log;
+static size_t overrun_count;
+static size_t overrun_read_cursor;
+
+// The report is written hid_report_delay_ticks after the host polls us, and has to be done
+// before the next poll, so the remainder of the poll interval is all we have.
+uint32_t budget_get_cycles() {
+  uint32_t interval_ticks = k_ms_to_ticks_ceil32(CONFIG_USB_HID_POLL_INTERVAL_MS);
+  uint32_t delay_ticks = usb_hid_get_report_delay_ticks();
+  uint32_t slack_ticks = interval_ticks > delay_ticks ? interval_ticks - delay_ticks : 0;
+  uint64_t slack_cycles =
+    static_cast<uint64_t>(slack_ticks) * get_cpu_freq() / CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+  return slack_cycles * CONFIG_PASSINGLINK_REPORT_BUDGET_PERCENT / 100;
+}
+
+void budget_report_begin() {
+  report_thread = k_current_get();
+  report_begin_cycle = get_cycle_count();
+  stage_begin_cycle = report_begin_cycle;
+  worst_stage = nullptr;
+  worst_stage_cycles = 0;
+}
+
+void budget_stage_end(const char* stage) {
+  if (k_current_get() != report_thread) {
+    return;
+  }
+
+  uint32_t now = get_cycle_count();
+  uint32_t cycles = now - stage_begin_cycle;
+  stage_begin_cycle = now;
+
+  if (cycles > worst_stage_cycles) {
+    worst_stage = stage;
+    worst_stage_cycles = cycles;
+  }
+}
+
+void budget_record_input(const RawInputState* input) {
+  if (k_current_get() != report_thread) {
+    return;
+  }
+  report_input = *input;
+}
+
+void budget_report_end() {
+  if (!report_thread || k_current_get() != report_thread) {
+    return;
+  }
+  report_thread = nullptr;
+
+  uint32_t total_cycles = get_cycle_count() - report_begin_cycle;
+  uint32_t budget_cycles = budget_get_cycles();
+  if (total_cycles <= budget_cycles) {
+    return;
+  }
+
+  uint64_t percent = static_cast<uint64_t>(total_cycles) * 100 / budget_cycles;
+  blackbox_record(BlackboxEvent::BudgetOverrun, 0, min<uint64_t>(percent, UINT16_MAX));
+
+  ScopedIRQLock lock;
+  BudgetOverrun& entry = overrun_log[overrun_count++ % BUDGET_LOG_SIZE];
+  entry.tick = k_uptime_ticks();
+  entry.budget_cycles = budget_cycles;
+  entry.total_cycles = total_cycles;
+  entry.stage = worst_stage ? worst_stage : "<none>";
+  entry.stage_cycles = worst_stage_cycles;
+  entry.input = report_input;
+}
+
+size_t budget_get_overruns(span<BudgetOverrun> out) {
+  ScopedIRQLock lock;
+  size_t available = min(overrun_count, BUDGET_LOG_SIZE);
+  size_t n = min(available, out.size());
+  size_t first = overrun_count - available;
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = overrun_log[(first + i) % BUDGET_LOG_SIZE];
+  }
+  return n;
+}
+
+void budget_clear_overruns() {
+  ScopedIRQLock lock;
+  overrun_count = 0;
+  overrun_read_cursor = 0;
+}
+
+struct __attribute__((packed)) BudgetOverrunReport {
+  uint8_t report_id;
+  uint8_t index;
+  uint8_t count;
+  uint32_t tick;
+  uint32_t budget_cycles;
+  uint32_t total_cycles;
+  uint32_t stage_cycles;
+  RawInputState input;
+  char stage[16];
+};
+
+// Each read returns the next entry of the log, starting over from the oldest after the last one.
+ssize_t budget_get_overrun_report(span<uint8_t> buf) {
+  if (buf.size() < sizeof(BudgetOverrunReport)) {
+    LOG_ERR("budget_get_overrun_report: buffer too small (%zu)", buf.size());
+    return -1;
+  }
+
+  array<BudgetOverrun, BUDGET_LOG_SIZE> entries;
+  size_t count = budget_get_overruns(entries);
+
+  BudgetOverrunReport report = {};
+  report.report_id = static_cast<uint8_t>(PLReportId::BudgetOverrun);
+  report.count = count;
+  if (count != 0) {
+    size_t index = overrun_read_cursor++ % count;
+    const BudgetOverrun& entry = entries[index];
+    report.index = index;
+    report.tick = entry.tick;
+    report.budget_cycles = entry.budget_cycles;
+    report.total_cycles = entry.total_cycles;
+    report.stage_cycles = entry.stage_cycles;
+    report.input = entry.input;
+    strncpy(report.stage, entry.stage, sizeof(report.stage));
+  }
+
+  memcpy(buf.data(), &report, sizeof(report));
+  return sizeof(report);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_budget(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+    budget_clear_overruns();
+    shell_print(shell, "budget: overrun log cleared");
+    return 0;
+  } else if (argc != 1) {
+    shell_print(shell, "usage: budget [clear]");
+    return 0;
+  }
+
+  array<BudgetOverrun, BUDGET_LOG_SIZE> entries;
+  size_t count = budget_get_overruns(entries);
+  shell_print(shell, "budget: %u cycles, %zu overruns logged", budget_get_cycles(), count);
+  for (size_t i = 0; i < count; ++i) {
+    const BudgetOverrun& entry = entries[i];
+    uint32_t input;
+    static_assert(sizeof(input) == sizeof(entry.input));
+    memcpy(&input, &entry.input, sizeof(input));
+    shell_print(shell, "  [%u] %u/%u cycles, %s took %u, input = 0x%08x", entry.tick,
+                entry.total_cycles, entry.budget_cycles, entry.stage, entry.stage_cycles, input);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(budget, NULL, "Report CPU budget overruns", cmd_budget);
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "input/input.h"
+#include "types.h"
+
+// Per-report CPU budget watchdog.
+//
+// Every report build is split into stages by calls to budget_stage_end(), which attribute the
+// cycles elapsed since the previous mark to the named stage. If the whole report takes longer than
+// the slack between the report delay and the next host poll, the most expensive stage is recorded
+// into a small overrun log, along with the input state and timestamps. Only the thread that began
+// the report gets charged, so running the input pipeline elsewhere doesn't skew it.
+#if defined(CONFIG_PASSINGLINK_REPORT_BUDGET)
+
+struct BudgetOverrun {
+  // k_uptime_ticks() at the end of the report.
+  uint32_t tick;
+
+  uint32_t budget_cycles;
+  uint32_t total_cycles;
+
+  // The most expensive stage of the report.
+  const char* stage;
+  uint32_t stage_cycles;
+
+  RawInputState input;
+};
+
+void budget_report_begin();
+void budget_stage_end(const char* stage);
+void budget_record_input(const RawInputState* input);
+void budget_report_end();
+
+uint32_t budget_get_cycles();
+
+// Copy out the overrun log, oldest first. Returns the number of entries written.
+size_t budget_get_overruns(span<BudgetOverrun> out);
+void budget_clear_overruns();
+
+// Serialize the next overrun log entry into a PL feature report.
+ssize_t budget_get_overrun_report(span<uint8_t> buf);
+
+#else
+
+inline void budget_report_begin() {}
+inline void budget_stage_end(const char*) {}
+inline void budget_record_input(const RawInputState*) {}
+inline void budget_report_end() {}
+
+#endif
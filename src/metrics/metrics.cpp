@@ -3,6 +3,7 @@
 #include <zephyr.h>
 
 #include "arch.h"
+#include "background.h"
 #include "display/display.h"
 #include "types.h"
 
@@ -10,15 +11,18 @@
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(metrics);
 
-#if !defined(CONFIG_PASSINGLINK_DISPLAY)
+#if !defined(CONFIG_PASSINGLINK_DISPLAY) && !defined(CONFIG_PASSINGLINK_METRICS)
 void metrics_reset() {}
+void metrics_set_timing(uint8_t, uint16_t) {}
 void metrics_record_input_read() {}
 void metrics_record_usb_write() {}
 #else
 
-constexpr uint64_t REPORT_INTERVAL = 1024;
 optional<uint32_t> input_tick;
 
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+constexpr uint64_t REPORT_INTERVAL = 1024;
+
 template <typename T, size_t alpha_num, size_t alpha_denom>
 struct moving_average {
   static_assert(alpha_denom > alpha_num);
@@ -51,28 +55,242 @@ moving_average<float, 2, 2048> averager;
 #else
 moving_average<uint64_t, 2, 2048> averager;
 #endif
+#endif  // defined(CONFIG_PASSINGLINK_DISPLAY)
+
+#if defined(CONFIG_PASSINGLINK_METRICS)
+static MetricsCounters counters;
+static uint8_t timing_tag;
+static uint16_t timing_delay_ticks;
+static array<MetricsTraceEntry, CONFIG_PASSINGLINK_METRICS_TRACE_SIZE> trace;
+static optional<uint32_t> last_write_tick;
+
+// When the latest relayed input that hasn't been read into a report yet arrived, and when the one
+// in the report that's waiting for the host did.
+static optional<uint32_t> relay_input_tick;
+static optional<uint32_t> relay_report_tick;
+
+static size_t histogram_bucket(uint32_t ticks) {
+  size_t bucket = 0;
+  while (ticks != 0 && bucket < METRICS_HISTOGRAM_BUCKETS - 1) {
+    ticks >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+// Called with interrupts locked, once per report.
+static void metrics_record_report(uint32_t now, optional<uint32_t> latency,
+                                  optional<uint32_t> relay_tick) {
+  uint32_t poll_ticks = k_ms_to_ticks_ceil32(CONFIG_USB_HID_POLL_INTERVAL_MS);
+  uint32_t missed = 0;
+  if (last_write_tick) {
+    // Allow half an interval of jitter before calling a poll missed.
+    uint32_t gap = now - *last_write_tick;
+    if (gap > poll_ticks + poll_ticks / 2) {
+      missed = (gap + poll_ticks / 2) / poll_ticks - 1;
+    }
+  }
+  last_write_tick = now;
+
+  counters.missed_polls += missed;
+  if (latency) {
+    ++counters.histogram[histogram_bucket(*latency)];
+  }
+
+  if (relay_tick) {
+    uint32_t relay_us = k_ticks_to_us_floor32(now - *relay_tick);
+    ++counters.relay_inputs;
+    counters.relay_usb_total_us += relay_us;
+    counters.relay_usb_max_us = max(counters.relay_usb_max_us, relay_us);
+  }
+
+  MetricsTraceEntry& entry = trace[counters.reports % trace.size()];
+  entry.sequence = counters.reports;
+  entry.tick = now;
+  entry.latency_ticks = latency ? min<uint32_t>(*latency, UINT16_MAX) : 0;
+  entry.missed_polls = min<uint32_t>(missed, UINT16_MAX);
+  ++counters.reports;
+}
+
+void metrics_get_counters(MetricsCounters* out) {
+  ScopedIRQLock lock;
+  *out = counters;
+}
+
+size_t metrics_get_trace(span<MetricsTraceEntry> out, uint32_t* cursor) {
+  ScopedIRQLock lock;
+  uint32_t end = counters.reports;
+  uint32_t oldest = end > trace.size() ? end - trace.size() : 0;
+  uint32_t begin = max(*cursor, oldest);
+  if (begin > end) {
+    // The counters were reset underneath the reader.
+    begin = oldest;
+  }
+
+  size_t n = min<size_t>(end - begin, out.size());
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = trace[(begin + i) % trace.size()];
+  }
+  *cursor = begin + n;
+  return n;
+}
+
+void metrics_record_touchpad_read(uint32_t bus_us) {
+  ScopedIRQLock lock;
+  ++counters.touchpad_reads;
+  counters.touchpad_bus_us += bus_us;
+}
+
+void metrics_record_link_frame(uint32_t excess_us, uint32_t lost, bool late) {
+  ScopedIRQLock lock;
+  ++counters.link_frames;
+  counters.link_lost += lost;
+  counters.link_late += late;
+  counters.link_max_excess_us = max(counters.link_max_excess_us, excess_us);
+}
+
+void metrics_record_link_error() {
+  ScopedIRQLock lock;
+  ++counters.link_errors;
+}
+
+void metrics_record_link_timeout() {
+  ScopedIRQLock lock;
+  ++counters.link_timeouts;
+}
+
+void metrics_record_relay_input() {
+  ScopedIRQLock lock;
+  if (!relay_input_tick) {
+    relay_input_tick = k_uptime_ticks();
+  }
+}
+#endif  // defined(CONFIG_PASSINGLINK_METRICS)
+
+// Reports are only timestamped in the USB interrupt: they get folded into the metrics and the
+// display's latency average by a background job.
+struct MetricsSample {
+  uint32_t tick;
+  optional<uint32_t> latency;
+#if defined(CONFIG_PASSINGLINK_METRICS)
+  optional<uint32_t> relay_tick;
+#endif
+};
+
+static array<MetricsSample, 32> samples;
+static uint32_t samples_begin;
+static uint32_t samples_end;
+
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+static bool latency_update_pending;
+#endif
+
+// Called with interrupts locked.
+static void metrics_apply(const MetricsSample& sample) {
+#if defined(CONFIG_PASSINGLINK_METRICS)
+  metrics_record_report(sample.tick, sample.latency, sample.relay_tick);
+#endif
+
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+  if (sample.latency) {
+    averager.add(*sample.latency);
+    if (averager.reports() % REPORT_INTERVAL == 0) {
+      latency_update_pending = true;
+    }
+  }
+#endif
+}
+
+static bool metrics_process(BackgroundJob*) {
+  while (true) {
+    ScopedIRQLock lock;
+    if (samples_begin == samples_end) {
+      break;
+    }
+    metrics_apply(samples[samples_begin++ % samples.size()]);
+  }
+
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
+  optional<uint32_t> latency_us;
+  {
+    ScopedIRQLock lock;
+    if (latency_update_pending) {
+      latency_update_pending = false;
+      latency_us = k_ticks_to_us_ceil32(1) * averager.get();
+    }
+  }
+  if (latency_us) {
+    display_update_latency(*latency_us);
+  }
+#endif
+  return true;
+}
+
+static BackgroundJob metrics_job("metrics", metrics_process);
 
 void metrics_reset() {
   ScopedIRQLock lock;
+  samples_begin = samples_end;
+#if defined(CONFIG_PASSINGLINK_DISPLAY)
   averager.reset();
+  latency_update_pending = false;
+#endif
+#if defined(CONFIG_PASSINGLINK_METRICS)
+  counters = {};
+  counters.timing = timing_tag;
+  counters.timing_delay_ticks = timing_delay_ticks;
+  last_write_tick.reset();
+  relay_input_tick.reset();
+  relay_report_tick.reset();
+#endif
   input_tick.reset();
 }
 
+void metrics_set_timing(uint8_t tag, uint16_t delay_ticks) {
+  ScopedIRQLock lock;
+#if defined(CONFIG_PASSINGLINK_METRICS)
+  timing_tag = tag;
+  timing_delay_ticks = delay_ticks;
+#endif
+  metrics_reset();
+}
+
 void metrics_record_input_read() {
   if (!input_tick) {
     input_tick = k_uptime_ticks();
   }
+
+#if defined(CONFIG_PASSINGLINK_METRICS)
+  ScopedIRQLock lock;
+  if (relay_input_tick) {
+    relay_report_tick = relay_input_tick;
+    relay_input_tick.reset();
+  }
+#endif
 }
 
 void metrics_record_usb_write() {
+  MetricsSample sample = {};
+  sample.tick = k_uptime_ticks();
   if (input_tick) {
-    uint32_t diff = k_uptime_ticks() - *input_tick;
+    sample.latency = sample.tick - *input_tick;
     input_tick = {};
-    averager.add(diff);
-    if (averager.reports() % REPORT_INTERVAL == 0) {
-      display_update_latency(k_ticks_to_us_ceil32(1) * averager.get());
+  }
+
+  {
+    ScopedIRQLock lock;
+#if defined(CONFIG_PASSINGLINK_METRICS)
+    sample.relay_tick = relay_report_tick;
+    relay_report_tick.reset();
+#endif
+
+    if (samples_end - samples_begin == samples.size()) {
+      // The background thread has fallen behind: make room by folding the oldest report in here.
+      metrics_apply(samples[samples_begin++ % samples.size()]);
     }
+    samples[samples_end++ % samples.size()] = sample;
   }
+  background_submit(&metrics_job);
 }
 
 #endif
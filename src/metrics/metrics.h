@@ -1,5 +1,95 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "types.h"
+
 void metrics_reset();
+
+// Reset the metrics, and tag everything recorded from here on with a report timing strategy (see
+// HidTiming::tag), so that strategies can be compared against each other in one session.
+void metrics_set_timing(uint8_t tag, uint16_t delay_ticks);
 void metrics_record_input_read();
 void metrics_record_usb_write();
+
+#if defined(CONFIG_PASSINGLINK_METRICS)
+
+// Latency histogram buckets are powers of two in ticks: bucket n counts reports whose
+// input-to-write latency was in [2^(n-1), 2^n) ticks, with the first bucket holding zero latency
+// and the last one holding everything that didn't fit.
+constexpr size_t METRICS_HISTOGRAM_BUCKETS = 16;
+
+struct MetricsCounters {
+  // Number of reports written.
+  uint32_t reports;
+
+  // Number of host polls that passed without us writing a report.
+  uint32_t missed_polls;
+
+  array<uint32_t, METRICS_HISTOGRAM_BUCKETS> histogram;
+
+  // Number of touchpad reads, and the total time spent on the bus for them.
+  uint32_t touchpad_reads;
+  uint32_t touchpad_bus_us;
+
+  // Health of the input link from a peripheral board: frames received, frames that went missing
+  // or arrived corrupt, frames that arrived more than CONFIG_PASSINGLINK_INPUT_LINK_MAX_LATENCY_US
+  // later than the fastest one, and how often the link timed out.
+  uint32_t link_frames;
+  uint32_t link_lost;
+  uint32_t link_errors;
+  uint32_t link_late;
+  uint32_t link_timeouts;
+  uint32_t link_max_excess_us;
+
+  // Inputs relayed from a stick over Bluetooth, and the time from their arrival to the host
+  // picking up the first report that included them.
+  uint32_t relay_inputs;
+  uint32_t relay_usb_max_us;
+  uint64_t relay_usb_total_us;
+
+  // The report timing strategy that everything above was recorded with.
+  uint8_t timing;
+  uint16_t timing_delay_ticks;
+};
+
+struct MetricsTraceEntry {
+  // Sequence number of the report.
+  uint32_t sequence;
+
+  // k_uptime_ticks() when the report was written.
+  uint32_t tick;
+
+  uint16_t latency_ticks;
+
+  // Number of polls missed before this report.
+  uint16_t missed_polls;
+};
+
+void metrics_get_counters(MetricsCounters* out);
+
+// Copy out trace entries with sequence numbers greater than or equal to *cursor, oldest first,
+// and advance the cursor past them. Entries that have been overwritten in the ring are skipped.
+size_t metrics_get_trace(span<MetricsTraceEntry> out, uint32_t* cursor);
+
+void metrics_record_touchpad_read(uint32_t bus_us);
+
+void metrics_record_link_frame(uint32_t excess_us, uint32_t lost, bool late);
+void metrics_record_link_error();
+void metrics_record_link_timeout();
+
+// Called when an input relayed over Bluetooth arrives.
+void metrics_record_relay_input();
+
+#else
+
+inline void metrics_record_touchpad_read(uint32_t) {}
+
+inline void metrics_record_link_frame(uint32_t, uint32_t, bool) {}
+inline void metrics_record_link_error() {}
+inline void metrics_record_link_timeout() {}
+
+inline void metrics_record_relay_input() {}
+
+#endif
@@ -0,0 +1,95 @@
+#include "metrics/sched_trace.h"
+
+#include <zephyr.h>
+
+#include <shell/shell.h>
+
+#include "input/input.h"
+#include "output/usb/hid.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(sched_trace);
+
+static array<SchedTraceEntry, CONFIG_PASSINGLINK_SCHED_TRACE_SIZE> sched_trace_entries;
+static size_t sched_trace_count;
+static atomic_t sched_trace_capturing;
+
+// The timing strategy that the capture was recorded with. Switching strategies ends the capture.
+static HidTiming sched_trace_timing;
+
+static void sched_trace_stop() {
+  atomic_set(&sched_trace_capturing, false);
+  input_trace_edges(false);
+}
+
+void sched_trace_record(SchedTraceEvent event, uint32_t tick, uint16_t value) {
+  if (!atomic_get(&sched_trace_capturing)) {
+    return;
+  }
+
+  ScopedIRQLock lock;
+  HidTiming timing = usb_hid_get_timing();
+  if (sched_trace_count == sched_trace_entries.size() ||
+      timing.tag() != sched_trace_timing.tag() ||
+      timing.delay_ticks != sched_trace_timing.delay_ticks) {
+    sched_trace_stop();
+    return;
+  }
+  sched_trace_entries[sched_trace_count++] = {tick, value, event, 0};
+}
+
+span<const SchedTraceEntry> sched_trace_freeze(SchedTraceHeader* header) {
+  sched_trace_stop();
+  header->rate = CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+  header->nominal_ticks = k_ms_to_ticks_ceil32(CONFIG_USB_HID_POLL_INTERVAL_MS);
+  header->strategy = static_cast<uint8_t>(sched_trace_timing.strategy);
+  header->flags = sched_trace_timing.flags;
+  header->delay_ticks = sched_trace_timing.delay_ticks;
+  header->count = sched_trace_count;
+  return span<const SchedTraceEntry>(sched_trace_entries.data(), sched_trace_count);
+}
+
+static int cmd_sched_trace(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "start") == 0) {
+    {
+      ScopedIRQLock lock;
+      sched_trace_timing = usb_hid_get_timing();
+      sched_trace_count = 0;
+      atomic_set(&sched_trace_capturing, true);
+    }
+    input_trace_edges(true);
+    return 0;
+  } else if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+    sched_trace_stop();
+    return 0;
+  } else if (argc == 2 && strcmp(argv[1], "dump") == 0) {
+    SchedTraceHeader header;
+    span<const SchedTraceEntry> entries = sched_trace_freeze(&header);
+    shell_print(shell, "# passinglink sched_trace");
+    shell_print(shell, "rate %u", header.rate);
+    shell_print(shell, "nominal %u", header.nominal_ticks);
+    shell_print(shell, "timing %u %u %u", header.strategy, header.flags, header.delay_ticks);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const SchedTraceEntry& entry = entries.data()[i];
+      if (entry.event == SchedTraceEvent::Build) {
+        shell_print(shell, "%c %u %u", static_cast<char>(entry.event), entry.tick, entry.value);
+      } else {
+        shell_print(shell, "%c %u", static_cast<char>(entry.event), entry.tick);
+      }
+    }
+    return 0;
+  } else if (argc == 1) {
+    shell_print(shell, "sched_trace: %s, %zu/%zu entries",
+                atomic_get(&sched_trace_capturing) ? "capturing" : "stopped", sched_trace_count,
+                sched_trace_entries.size());
+    return 0;
+  }
+
+  shell_print(shell, "usage: sched_trace [start | stop | dump]");
+  return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(sched_trace, NULL, "Capture a report scheduling trace for schedsim",
+                       cmd_sched_trace, 1, 1);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+// Records what the report scheduler had to work with, for replaying against other scheduling
+// policies on the host with tools/schedsim: when the host collected reports, when buttons changed
+// state, and when each report build started and how long it took.
+//
+// A capture runs from `sched_trace start` until the buffer fills up (or `sched_trace stop`), and
+// `sched_trace dump` prints it in the text format that schedsim reads. Only the first player's
+// reports are recorded. The entries can also be read out in binary with tools/plbulk, so the
+// layouts below are kept free of Zephyr.
+enum class SchedTraceEvent : uint8_t {
+  // The host collected a report.
+  Poll = 'P',
+
+  // A button changed state. Pins are sampled every CONFIG_PASSINGLINK_SCHED_TRACE_EDGE_US, apart
+  // from report building, and debounced by the same rule as for reports, so an edge is recorded
+  // no earlier than it happened, and at most one sampling interval later. Buttons on a link
+  // peripheral are timestamped with when the peripheral sampled them.
+  Edge = 'E',
+
+  // A report build started. value: how long it took, in microseconds.
+  Build = 'B',
+};
+
+struct SchedTraceEntry {
+  uint32_t tick;
+  uint16_t value;
+  SchedTraceEvent event;
+  uint8_t reserved;
+};
+
+static_assert(sizeof(SchedTraceEntry) == 8);
+
+// Everything besides the entries that's needed to replay a capture.
+struct SchedTraceHeader {
+  uint32_t rate;
+  uint32_t nominal_ticks;
+  uint8_t strategy;
+  uint8_t flags;
+  uint16_t delay_ticks;
+  uint32_t count;
+};
+
+static_assert(sizeof(SchedTraceHeader) == 16);
+
+#if defined(CONFIG_PASSINGLINK_SCHED_TRACE)
+#include "types.h"
+
+// tick: k_uptime_ticks()
+void sched_trace_record(SchedTraceEvent event, uint32_t tick, uint16_t value = 0);
+
+// Stop capturing, and describe the capture. The entries are left alone until the next
+// `sched_trace start`, so they can be read out in place.
+span<const SchedTraceEntry> sched_trace_freeze(SchedTraceHeader* header);
+#else
+inline void sched_trace_record(SchedTraceEvent, uint32_t, uint16_t = 0) {}
+#endif
@@ -7,6 +7,8 @@
 #include <devicetree/gpio.h>
 #include <drivers/gpio.h>
 
+#include "background.h"
+
 #define LOG_LEVEL LOG_LEVEL_INF
 LOG_MODULE_REGISTER(led);
 
@@ -29,8 +31,14 @@ void led_flash(Led led, uint32_t duration_ms, uint32_t interval_ms) {}
 
 #else
 
+static bool led_flash_job(BackgroundJob* job);
+
 struct LedState {
   k_delayed_work work;
+
+  // Flashing toggles are done in the background, the work item only keeps time.
+  BackgroundJob job = BackgroundJob("led", led_flash_job);
+
   const device* led_device;
   uint32_t led_pin;
   uint32_t counter;
@@ -69,8 +77,7 @@ static void led_schedule_update(LedState& state) {
   }
 }
 
-void led_update(k_work* work) {
-  LedState& state = *reinterpret_cast<LedState*>(work);
+static void led_update(LedState& state) {
   if (state.flashing) {
     if (state.interval_ticks > state.duration_ticks) {
       // We're done.
@@ -88,13 +95,23 @@ void led_update(k_work* work) {
   }
 }
 
+static bool led_flash_job(BackgroundJob* job) {
+  led_update(*CONTAINER_OF(job, LedState, job));
+  return true;
+}
+
+static void led_work(k_work* work) {
+  LedState& state = *reinterpret_cast<LedState*>(work);
+  background_submit(&state.job);
+}
+
 static void led_init(LedState& state, const char* device_name, uint32_t gpio_pin, uint32_t flags) {
   if (device_name) {
     state.initialized = true;
     state.led_device = device_get_binding(device_name);
     state.led_pin = gpio_pin;
     gpio_pin_configure(state.led_device, gpio_pin, GPIO_OUTPUT_INACTIVE | flags);
-    k_delayed_work_init(&state.work, led_update);
+    k_delayed_work_init(&state.work, led_work);
   }
 }
 
@@ -129,7 +146,7 @@ uint32_t led_set(Led led, bool value, optional<uint32_t> expected_counter) {
 
   state.on = value;
   if (!state.flashing) {
-    led_update(reinterpret_cast<k_work*>(&state.work));
+    led_update(state);
   }
 
   if (expected_counter) {
@@ -0,0 +1,165 @@
+#include "output/usb/bulk.h"
+
+#include <zephyr.h>
+
+#include <sys/crc.h>
+
+#include "metrics/blackbox.h"
+#include "metrics/metrics.h"
+#include "metrics/sched_trace.h"
+#include "output/usb/hid.h"
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(bulk);
+
+// Sources that are copied out go here. Others are read in place, after being frozen.
+static uint8_t bulk_snapshot_buf[CONFIG_PASSINGLINK_BULK_SNAPSHOT_SIZE] __attribute__((aligned(4)));
+
+// The snapshot is the concatenation of these.
+static array<span<const uint8_t>, 2> bulk_segments;
+static size_t bulk_segment_count;
+
+static optional<BulkSource> bulk_source;
+static uint32_t bulk_offset;
+static uint32_t bulk_total;
+
+static uint8_t bulk_response_buf[sizeof(BulkResponse) + CONFIG_PASSINGLINK_BULK_CHUNK];
+
+static void bulk_add_segment(const void* data, size_t length) {
+  bulk_segments[bulk_segment_count++] = span(static_cast<const uint8_t*>(data), length);
+  bulk_total += length;
+}
+
+template <typename T>
+static span<T> bulk_snapshot_span() {
+  return span(reinterpret_cast<T*>(bulk_snapshot_buf), sizeof(bulk_snapshot_buf) / sizeof(T));
+}
+
+static bool bulk_open(BulkSource source) {
+  bulk_source.reset();
+  bulk_segment_count = 0;
+  bulk_offset = 0;
+  bulk_total = 0;
+
+  switch (source) {
+#if defined(CONFIG_PASSINGLINK_METRICS)
+    case BulkSource::MetricsTrace: {
+      uint32_t cursor = 0;
+      size_t count = metrics_get_trace(bulk_snapshot_span<MetricsTraceEntry>(), &cursor);
+      bulk_add_segment(bulk_snapshot_buf, count * sizeof(MetricsTraceEntry));
+      break;
+    }
+
+    case BulkSource::MetricsCounters: {
+      static MetricsCounters counters;
+      metrics_get_counters(&counters);
+      bulk_add_segment(&counters, sizeof(counters));
+      break;
+    }
+#endif
+
+#if defined(CONFIG_PASSINGLINK_SCHED_TRACE)
+    case BulkSource::SchedTrace: {
+      static SchedTraceHeader header;
+      span<const SchedTraceEntry> entries = sched_trace_freeze(&header);
+      bulk_add_segment(&header, sizeof(header));
+      bulk_add_segment(entries.data(), entries.size() * sizeof(SchedTraceEntry));
+      break;
+    }
+#endif
+
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+    case BulkSource::Blackbox: {
+      size_t count = blackbox_get_entries(bulk_snapshot_span<BlackboxEntry>());
+      bulk_add_segment(bulk_snapshot_buf, count * sizeof(BlackboxEntry));
+      break;
+    }
+#endif
+
+    default:
+      LOG_ERR("bulk source %u unavailable", static_cast<uint8_t>(source));
+      return false;
+  }
+
+  LOG_INF("bulk source %u opened: %u bytes", static_cast<uint8_t>(source), bulk_total);
+  bulk_source = source;
+  return true;
+}
+
+bool usb_bulk_request(span<uint8_t> data) {
+  BulkRequest request;
+  if (data.size() < sizeof(request)) {
+    LOG_ERR("bulk request too short: %zu bytes", data.size());
+    return false;
+  }
+  memcpy(&request, data.data(), sizeof(request));
+
+  switch (static_cast<BulkOp>(request.op)) {
+    case BulkOp::Open:
+      return bulk_open(static_cast<BulkSource>(request.source));
+
+    case BulkOp::Seek:
+      if (!bulk_source || request.offset > bulk_total) {
+        return false;
+      }
+      bulk_offset = request.offset;
+      return true;
+
+    case BulkOp::Close:
+      bulk_source.reset();
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+span<uint8_t> usb_bulk_read(size_t max_length) {
+  BulkResponse response = {};
+  response.report_id = static_cast<uint8_t>(PLReportId::Bulk);
+  response.offset = bulk_offset;
+  response.total = bulk_total;
+
+  uint8_t* chunk = bulk_response_buf + sizeof(response);
+  if (!bulk_source) {
+    response.status = static_cast<uint8_t>(BulkStatus::Closed);
+  } else if (bulk_offset == bulk_total) {
+    response.status = static_cast<uint8_t>(BulkStatus::End);
+    response.source = static_cast<uint8_t>(*bulk_source);
+  } else {
+    response.status = static_cast<uint8_t>(BulkStatus::Ok);
+    response.source = static_cast<uint8_t>(*bulk_source);
+
+    size_t length = min<size_t>(bulk_total - bulk_offset, CONFIG_PASSINGLINK_BULK_CHUNK);
+    if (max_length > sizeof(response)) {
+      length = min(length, max_length - sizeof(response));
+    } else {
+      length = 0;
+    }
+
+    // Copy the chunk out of however many segments it spans.
+    size_t segment_offset = bulk_offset;
+    size_t copied = 0;
+    for (size_t i = 0; i < bulk_segment_count && copied < length; ++i) {
+      const span<const uint8_t>& segment = bulk_segments[i];
+      if (segment_offset >= segment.size()) {
+        segment_offset -= segment.size();
+        continue;
+      }
+
+      size_t n = min(segment.size() - segment_offset, length - copied);
+      memcpy(chunk + copied, segment.data() + segment_offset, n);
+      copied += n;
+      segment_offset = 0;
+    }
+
+    response.length = length;
+    response.crc = crc32_ieee(chunk, length);
+    bulk_offset += length;
+  }
+
+  memcpy(bulk_response_buf, &response, sizeof(response));
+  return span(bulk_response_buf, sizeof(response) + response.length);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bulk readout of diagnostics over the PL feature report channel.
+//
+// The other PL reports move a page of at most 63 bytes per control transfer, which takes
+// thousands of round trips for a large trace. Instead, the host sets a PLReportId::Bulk feature
+// report to open a source, which is snapshotted right away, and then gets the same report over and
+// over: every get returns the next chunk of the snapshot, of up to CONFIG_PASSINGLINK_BULK_CHUNK
+// bytes, in a single multi-packet control transfer. Reports are never held up by a readout: the
+// snapshot is taken once, and chunks are served from it without touching the live data.
+//
+// Set (BulkRequest):
+//   Open: snapshot a source, and start reading it from the beginning.
+//   Seek: continue reading from an offset, e.g. to retry a chunk that failed its CRC.
+//   Close: drop the snapshot.
+//
+// Get: a BulkResponse, followed by `length` bytes of the snapshot starting at `offset`. Once
+// everything has been read, the status becomes End, with no data.
+//
+// Snapshot layouts, all little endian:
+//   MetricsTrace: MetricsTraceEntry[], oldest first.
+//   SchedTrace: SchedTraceHeader, then SchedTraceEntry[count].
+//   Blackbox: BlackboxEntry[], oldest first.
+//   MetricsCounters: MetricsCounters, including the latency histogram.
+//
+// There's no source for input recordings, because nothing records input: the input queue only
+// plays back a sequence that was sent to it. A recorder would be read out as another source.
+//
+// Everything outside of CONFIG_PASSINGLINK_BULK is free of Zephyr, for tools/plbulk.
+
+enum class BulkSource : uint8_t {
+  MetricsTrace = 1,
+  SchedTrace = 2,
+  Blackbox = 3,
+  MetricsCounters = 4,
+};
+
+enum class BulkOp : uint8_t {
+  Open = 1,
+  Seek = 2,
+  Close = 3,
+};
+
+enum class BulkStatus : uint8_t {
+  Ok = 0,
+
+  // Nothing is open.
+  Closed = 1,
+
+  // The whole snapshot has been read.
+  End = 2,
+};
+
+struct __attribute__((packed)) BulkRequest {
+  uint8_t report_id;
+  uint8_t op;     // BulkOp
+  uint8_t source; // BulkSource, for Open
+  uint32_t offset; // for Seek
+};
+
+struct __attribute__((packed)) BulkResponse {
+  uint8_t report_id;
+  uint8_t status; // BulkStatus
+  uint8_t source;
+  uint32_t offset;
+  uint32_t total;
+  uint16_t length;
+
+  // CRC-32 (IEEE) of this chunk's data.
+  uint32_t crc;
+};
+
+#if defined(CONFIG_PASSINGLINK_BULK)
+#include "types.h"
+
+// The Report Count of the bulk report: everything but the report ID.
+#define PL_BULK_REPORT_COUNT (sizeof(BulkResponse) - 1 + CONFIG_PASSINGLINK_BULK_CHUNK)
+
+bool usb_bulk_request(span<uint8_t> data);
+
+// Fill in the next response, and return it. It stays valid until the next call.
+span<uint8_t> usb_bulk_read(size_t max_length);
+#endif
@@ -3,18 +3,25 @@
 #include <init.h>
 #include <logging/log.h>
 
+#include <shell/shell.h>
 #include <usb/class/usb_hid.h>
 #include <usb/usb_device.h>
 
+#include "background.h"
 #include "bootloader.h"
+#include "input/input.h"
 #include "input/touchpad.h"
+#include "metrics/blackbox.h"
+#include "metrics/budget.h"
 #include "metrics/metrics.h"
+#include "metrics/sched_trace.h"
 #include "output/output.h"
 #include "output/usb/hid.h"
 #include "output/usb/nx/hid.h"
 #include "output/usb/ps4/hid.h"
 #include "output/usb/usb.h"
 #include "provisioning.h"
+#include "recovery.h"
 #include "version.h"
 
 #define LOG_LEVEL LOG_LEVEL_DBG
@@ -23,14 +30,49 @@ LOG_MODULE_REGISTER(hid);
 #include "arch.h"
 #include "profiling.h"
 
-static Hid* hid;
-static const struct device* usb_hid_device;
+// A USB HID interface with its own IN endpoint. There's one per player.
+struct HidInterface {
+  Hid* hid;
+  const struct device* device;
 
-static optional<int64_t> suspend_timestamp;
+  struct k_delayed_work write_work;
 
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
-static struct k_delayed_work delayed_write_work;
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+  optional<uint32_t> last_write_tick;
 #endif
+};
+
+static HidInterface hid_interfaces[PL_PLAYER_COUNT];
+static size_t hid_interface_count;
+
+// Returns nullptr for a device that isn't one of ours, rather than guessing at one.
+static HidInterface* hid_interface(const struct device* device) {
+  for (size_t i = 0; i < hid_interface_count; ++i) {
+    if (hid_interfaces[i].device == device) {
+      return &hid_interfaces[i];
+    }
+  }
+  LOG_ERR("unknown HID device %p", device);
+  return nullptr;
+}
+
+// The endpoint addresses are only assigned when the USB stack is enabled, so look them up in the
+// HID class instance's configuration instead of remembering them.
+static bool hid_interface_has_endpoint(const HidInterface* iface, uint8_t endpoint) {
+  if (!iface->device) {
+    return false;
+  }
+
+  auto cfg = static_cast<const struct usb_cfg_data*>(iface->device->config);
+  for (size_t i = 0; i < cfg->num_endpoints; ++i) {
+    if (cfg->endpoint[i].ep_addr == endpoint) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static optional<int64_t> suspend_timestamp;
 
 // USB transfers works on a host-polled basis: we put data into registers for
 // the hardware to send to the host. When this data gets succesfully sent, we
@@ -43,51 +85,177 @@ static struct k_delayed_work delayed_write_work;
 //
 // TODO: Instead of using work queue timing (with ~100us precision), use a timer
 //       interrupt which is far more precise?
-#if defined(STM32)
-constexpr uint32_t DEFAULT_HID_REPORT_DELAY_TICKS = k_us_to_ticks_ceil32(700);
-#elif defined(NRF52840)
-constexpr uint32_t DEFAULT_HID_REPORT_DELAY_TICKS = 22;
-static_assert(k_ticks_to_us_ceil32(DEFAULT_HID_REPORT_DELAY_TICKS) == 672);
+
+// Round down, so that coarse ticks (e.g. nRF's 32768Hz RTC) never push the write past the target.
+constexpr uint32_t DEFAULT_HID_REPORT_DELAY_TICKS =
+  k_us_to_ticks_floor32(CONFIG_PASSINGLINK_OUTPUT_USB_REPORT_DELAY_US);
+static_assert(DEFAULT_HID_REPORT_DELAY_TICKS <
+              k_ms_to_ticks_ceil32(CONFIG_USB_HID_POLL_INTERVAL_MS));
+
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_TIMING_SWITCH) || \
+  defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED_WORK_QUEUE)
+#define HID_WORK_QUEUE 1
+#endif
+
+static constexpr HidTimingStrategy DEFAULT_HID_TIMING_STRATEGY =
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED_WORK_QUEUE)
+  HidTimingStrategy::DeferredWorkQueue;
+#elif defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
+  HidTimingStrategy::Deferred;
 #else
-#error HID_REPORT_DELAY_US unset
+  HidTimingStrategy::Immediate;
 #endif
 
-static uint32_t hid_report_delay_ticks = DEFAULT_HID_REPORT_DELAY_TICKS;
+// Oversampling is switched on by the poll estimator, so it needs poll awareness as well.
+static constexpr uint8_t HID_TIMING_AVAILABLE_FLAGS =
+  (IS_ENABLED(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE) ? HID_TIMING_POLL_AWARE : 0) |
+  (IS_ENABLED(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE) &&
+       IS_ENABLED(CONFIG_PASSINGLINK_INPUT_OVERSAMPLE)
+     ? HID_TIMING_OVERSAMPLE
+     : 0);
+
+// Only ever modified with interrupts locked, so the USB interrupt always sees a consistent value.
+static HidTiming hid_timing = {
+  .strategy = DEFAULT_HID_TIMING_STRATEGY,
+  .flags = HID_TIMING_AVAILABLE_FLAGS,
+  .delay_ticks = DEFAULT_HID_REPORT_DELAY_TICKS,
+};
 
-static void write_report(struct k_work* item = nullptr);
+// The black box measures stalls against the learned poll interval, so it needs the estimator too.
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE) || defined(CONFIG_PASSINGLINK_BLACKBOX)
+#define HID_POLL_ESTIMATOR 1
+#endif
 
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED_WORK_QUEUE)
-struct k_work_q hid_work_q;
-K_THREAD_STACK_DEFINE(hid_work_q_stack, 2048);
+#if defined(HID_POLL_ESTIMATOR)
+static HidPollEstimator hid_poll(k_ms_to_ticks_ceil32(CONFIG_USB_HID_POLL_INTERVAL_MS));
+
+static void hid_poll_apply() {
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE)
+  input_set_oversampling((hid_timing.flags & HID_TIMING_OVERSAMPLE) && hid_poll.slow());
 #endif
+}
 
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
-static void submit_write() {
-  {
-    ScopedIRQLock lock;
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED_WORK_QUEUE)
-    k_delayed_work_submit_to_queue(&hid_work_q, &delayed_write_work,
-                                   K_TICKS(hid_report_delay_ticks));
+static void hid_poll_reset() {
+  hid_poll.reset();
+  hid_poll_apply();
+}
+
+static void hid_poll_record() {
+  uint32_t previous_ticks = hid_poll.interval_ticks();
+  if (!hid_poll.record(k_uptime_ticks())) {
+    return;
+  }
+
+  if (hid_poll.interval_ticks() != previous_ticks) {
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE)
+    LOG_INF("host poll interval = %u us, delaying writes by %u extra ticks",
+            k_ticks_to_us_floor32(hid_poll.interval_ticks()), hid_poll.extra_delay_ticks());
 #else
-    k_delayed_work_submit(&delayed_write_work, K_TICKS(hid_report_delay_ticks));
+    LOG_INF("host poll interval = %u us", k_ticks_to_us_floor32(hid_poll.interval_ticks()));
 #endif
   }
+  hid_poll_apply();
+}
+#endif
 
-  // Immediately do a touchpad read after submitting, since it's slow.
+static void write_report(HidInterface* iface);
+
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK)
+static BackgroundJob touchpad_job("touchpad", [](BackgroundJob*) {
   input_touchpad_poll();
+  return true;
+});
+#endif
+
+#if defined(HID_WORK_QUEUE)
+// One per interface, so that with two players, neither one's report waits behind the other's.
+static struct k_work_q hid_work_qs[PL_PLAYER_COUNT];
+K_THREAD_STACK_ARRAY_DEFINE(hid_work_q_stacks, PL_PLAYER_COUNT, 2048);
+#endif
+
+static struct k_work_q* hid_timing_work_queue(HidInterface* iface) {
+#if defined(HID_WORK_QUEUE)
+  if (hid_timing.strategy == HidTimingStrategy::DeferredWorkQueue) {
+    return &hid_work_qs[iface - hid_interfaces];
+  }
+#endif
+  return &k_sys_work_q;
 }
+
+// Each interface has its own work item, and with the dedicated work queue strategy, its own
+// queue, so a pending write for one player never holds back the other. On the system work queue,
+// they're run one after the other.
+static void write_report_work(struct k_work* item) {
+  write_report(CONTAINER_OF(item, HidInterface, write_work.work));
+}
+
+// Once a delayed work item has run, Zephyr keeps it attached to its queue, and neither cancelling
+// it nor submitting it elsewhere changes that. Wait for anything that's running on the queue to
+// finish, so that the item can be initialized again.
+struct HidWorkQueueFlush {
+  struct k_work work;
+  struct k_sem done;
+};
+
+static void hid_work_queue_flush(struct k_work_q* queue) {
+  if (k_is_in_isr() || k_current_get() == &queue->thread) {
+    // Nothing else can be running on the queue.
+    return;
+  }
+
+  HidWorkQueueFlush flush;
+  k_sem_init(&flush.done, 0, 1);
+  k_work_init(&flush.work, [](struct k_work* item) {
+    k_sem_give(&CONTAINER_OF(item, HidWorkQueueFlush, work)->done);
+  });
+  k_work_submit_to_queue(queue, &flush.work);
+  k_sem_take(&flush.done, K_FOREVER);
+}
+
+static void submit_write(HidInterface* iface) {
+  int rc;
+  {
+    ScopedIRQLock lock;
+    uint32_t poll_extra_ticks = 0;
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE)
+    poll_extra_ticks = hid_poll.extra_delay_ticks();
 #endif
+    rc = k_delayed_work_submit_to_queue(hid_timing_work_queue(iface), &iface->write_work,
+                                        K_TICKS(hid_timing_write_delay_ticks(hid_timing,
+                                                                             poll_extra_ticks)));
+  }
 
-static void do_write() {
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
-  submit_write();
-#else
-  write_report();
+  if (rc != 0) {
+    // Nothing would ever write the next report otherwise: write this one right away.
+    LOG_ERR("failed to submit report write: rc = %d", rc);
+    write_report(iface);
+    return;
+  }
+
+#if !defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK)
+  // Immediately do a touchpad read after submitting, since it's slow.
+  input_touchpad_poll();
 #endif
 }
 
-static void write_report(struct k_work* item) {
-  metrics_record_input_read();
+static void do_write(HidInterface* iface) {
+  if (hid_timing.strategy == HidTimingStrategy::Immediate) {
+    write_report(iface);
+  } else {
+    submit_write(iface);
+  }
+}
+
+static void write_report(HidInterface* iface) {
+  uint32_t build_tick = k_uptime_ticks();
+  uint32_t build_cycles = get_cycle_count();
+
+  // Latency metrics only follow the first player.
+  if (iface == &hid_interfaces[0]) {
+    metrics_record_input_read();
+  }
+  budget_report_begin();
+  background_report_begin();
 
   uint8_t report_buf[64];
 
@@ -95,21 +263,60 @@ static void write_report(struct k_work* item) {
   {
     PROFILE("Hid::GetReport", 128);
 
-    report_size = hid->GetReport(HidReportType::Input, 1, span(report_buf, sizeof(report_buf)));
+    report_size =
+      iface->hid->GetReport(HidReportType::Input, 1, span(report_buf, sizeof(report_buf)));
     if (report_size < 0) {
+      budget_report_end();
       return;
     }
   }
+  budget_stage_end("hid_pack");
 
   size_t bytes_written = 0;
-  int rc = hid_int_ep_write(usb_hid_device, report_buf, report_size, &bytes_written);
+  int rc = hid_int_ep_write(iface->device, report_buf, report_size, &bytes_written);
+  budget_stage_end("hid_write");
+  budget_report_end();
+
+  if (iface == &hid_interfaces[0]) {
+    uint32_t build_us = static_cast<uint64_t>(get_cycle_count() - build_cycles) * 1'000'000 /
+                        get_cpu_freq();
+    sched_trace_record(SchedTraceEvent::Build, build_tick, min<uint32_t>(build_us, UINT16_MAX));
+  }
+
+  if (rc >= 0 && iface == &hid_interfaces[0]) {
+    recovery_report_written();
+#if defined(CONFIG_PASSINGLINK_BACKGROUND_SLACK)
+    // The touchpad is slow to read, so do it in the slack after the report.
+    background_submit(&touchpad_job);
+#endif
+  }
+  if (rc >= 0) {
+    background_report_written();
+  }
+
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+  uint8_t iface_index = iface - hid_interfaces;
+  uint32_t write_tick = k_uptime_ticks();
+  if (iface->last_write_tick && hid_poll.interval_ticks() != 0) {
+    uint32_t gap_ticks = write_tick - *iface->last_write_tick;
+    if (gap_ticks >= CONFIG_PASSINGLINK_BLACKBOX_STALL_INTERVALS * hid_poll.interval_ticks()) {
+      uint32_t gap_ms = k_ticks_to_ms_floor32(gap_ticks);
+      blackbox_record(BlackboxEvent::Stall, iface_index, min<uint32_t>(gap_ms, UINT16_MAX));
+    }
+  }
+  iface->last_write_tick = write_tick;
+
   if (rc < 0) {
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
-    LOG_ERR("USB write failed, requeuing: rc = %d", rc);
-    submit_write();
-#else
-    return write_report(item);
+    blackbox_record(BlackboxEvent::UsbWriteFailed, iface_index, -rc);
+  }
 #endif
+
+  if (rc < 0) {
+    if (hid_timing.strategy == HidTimingStrategy::Immediate) {
+      return write_report(iface);
+    }
+    LOG_ERR("USB write failed, requeuing: rc = %d", rc);
+    submit_write(iface);
   } else if (bytes_written != static_cast<size_t>(report_size)) {
     LOG_WRN("wrote fewer bytes (%d) than expected (%d): buffer full?", bytes_written, report_size);
   }
@@ -127,12 +334,20 @@ static void write_report(struct k_work* item) {
 }
 
 static void usb_status_cb(enum usb_dc_status_code status, const uint8_t* param) {
+  if (status != USB_DC_SOF) {
+    bool halt = status == USB_DC_SET_HALT || status == USB_DC_CLEAR_HALT;
+    blackbox_record(BlackboxEvent::UsbStatus, status, halt && param ? *param : 0);
+  }
+
   switch (status) {
     case USB_DC_ERROR:
       LOG_INF("USB_DC_ERROR");
       break;
     case USB_DC_RESET:
       LOG_INF("USB_DC_RESET");
+#if defined(HID_POLL_ESTIMATOR)
+      hid_poll_reset();
+#endif
       break;
     case USB_DC_CONNECTED:
       LOG_INF("USB_DC_CONNECTED");
@@ -149,11 +364,11 @@ static void usb_status_cb(enum usb_dc_status_code status, const uint8_t* param)
       break;
     case USB_DC_RESUME:
       LOG_INF("USB_DC_RESUME");
-#if PL_USB_OUTPUT_COUNT > 1
+#if PL_USB_OUTPUT_COUNT > 1 && !defined(CONFIG_PASSINGLINK_OUTPUT_USB_TWO_PLAYER)
       // We may have resumed after having failed to probe.
       // Retry from the beginning if it's been more than a second.
       if (suspend_timestamp) {
-        if (!hid->ProbeResult()) {
+        if (!hid_interfaces[0].hid->ProbeResult()) {
           int64_t now = k_uptime_get();
           if (now - *suspend_timestamp > 1000) {
             LOG_INF("resumed after suspend, retrying probe");
@@ -173,10 +388,15 @@ static void usb_status_cb(enum usb_dc_status_code status, const uint8_t* param)
       break;
     case USB_DC_CLEAR_HALT:
       LOG_INF("USB_DC_CLEAR_HALT(0x%02x)", *param);
-      hid->ClearHalt(*param);
-      if (*param & 0x80) {
-        LOG_WRN("halt cleared on input descriptor, queueing write");
-        do_write();
+      for (size_t i = 0; i < hid_interface_count; ++i) {
+        if (!hid_interface_has_endpoint(&hid_interfaces[i], *param)) {
+          continue;
+        }
+        hid_interfaces[i].hid->ClearHalt(*param);
+        if (*param & 0x80) {
+          LOG_WRN("halt cleared on input descriptor, queueing write");
+          do_write(&hid_interfaces[i]);
+        }
       }
       break;
     case USB_DC_SOF:
@@ -218,7 +438,8 @@ static bool decode_hid_report_value(uint16_t value, optional<HidReportType>* out
 
 static const struct hid_ops ops = {
   .get_report =
-    [](const struct device*, struct usb_setup_packet* setup, int32_t* len, uint8_t** data) {
+    [](const struct device* device, struct usb_setup_packet* setup, int32_t* len,
+       uint8_t** data) {
       optional<HidReportType> report_type;
       uint8_t report_id;
       if (!decode_hid_report_value(setup->wValue, &report_type, &report_id)) {
@@ -226,13 +447,26 @@ static const struct hid_ops ops = {
         return -1;
       }
 
+#if defined(CONFIG_PASSINGLINK_BULK)
+      // Bulk chunks don't fit in the request buffer: point the transfer at the response instead.
+      if (report_type && *report_type == HidReportType::Feature &&
+          report_id == static_cast<uint8_t>(PLReportId::Bulk)) {
+        span<uint8_t> response = usb_bulk_read(*len);
+        *data = response.data();
+        *len = min<int32_t>(*len, response.size());
+        return 0;
+      }
+#endif
+
       int result;
       optional<ssize_t> rc = Hid::GetReportPL(report_type, report_id, span(*data, *len));
 
       if (rc) {
         result = *rc;
+      } else if (HidInterface* iface = hid_interface(device)) {
+        result = iface->hid->GetReport(report_type, report_id, span<uint8_t>(*data, *len));
       } else {
-        result = hid->GetReport(report_type, report_id, span<uint8_t>(*data, *len));
+        result = -1;
       }
 
       if (result != -1) {
@@ -252,7 +486,8 @@ static const struct hid_ops ops = {
       return -1;
     },
   .set_report =
-    [](const struct device*, struct usb_setup_packet* setup, int32_t* len, uint8_t** data) {
+    [](const struct device* device, struct usb_setup_packet* setup, int32_t* len,
+       uint8_t** data) {
       optional<HidReportType> report_type;
       uint8_t report_id;
       if (!decode_hid_report_value(setup->wValue, &report_type, &report_id)) {
@@ -265,12 +500,21 @@ static const struct hid_ops ops = {
         return *pl_result ? 0 : -1;
       }
 
-      bool result = hid->SetReport(report_type, report_id, span<uint8_t>(*data, *len));
+      HidInterface* iface = hid_interface(device);
+      if (!iface) {
+        return -1;
+      }
+      bool result = iface->hid->SetReport(report_type, report_id, span<uint8_t>(*data, *len));
       return result ? 0 : -1;
     },
   .set_idle =
-    [](const struct device*, struct usb_setup_packet* setup, int32_t* len, uint8_t** data) {
-      do_write();
+    [](const struct device* device, struct usb_setup_packet* setup, int32_t* len,
+       uint8_t** data) {
+      HidInterface* iface = hid_interface(device);
+      if (!iface) {
+        return -1;
+      }
+      do_write(iface);
       return 0;
     },
   .set_protocol =
@@ -297,20 +541,34 @@ static const struct hid_ops ops = {
       LOG_ERR("USB HID report 0x%02x idle", report_id);
     },
   .int_in_ready =
-    [](const struct device*) {
-      metrics_record_usb_write();
-      do_write();
+    [](const struct device* device) {
+      HidInterface* iface = hid_interface(device);
+      if (!iface) {
+        return;
+      }
+      if (iface == &hid_interfaces[0]) {
+        sched_trace_record(SchedTraceEvent::Poll, k_uptime_ticks());
+        metrics_record_usb_write();
+#if defined(HID_POLL_ESTIMATOR)
+        hid_poll_record();
+#endif
+      }
+      do_write(iface);
     },
   .int_out_ready =
-    [](const struct device*) {
+    [](const struct device* device) {
+      HidInterface* iface = hid_interface(device);
+      if (!iface) {
+        return;
+      }
       uint8_t input_buf[64];
       size_t bytes_read;
-      int rc = hid_int_ep_read(usb_hid_device, input_buf, sizeof(input_buf), &bytes_read);
+      int rc = hid_int_ep_read(iface->device, input_buf, sizeof(input_buf), &bytes_read);
       if (rc != 0) {
         LOG_ERR("failed to read from interrupt out endpoint: rc = %d", rc);
         return;
       }
-      hid->InterruptOut(span<uint8_t>(input_buf, bytes_read));
+      iface->hid->InterruptOut(span<uint8_t>(input_buf, bytes_read));
     },
 };
 
@@ -337,6 +595,50 @@ optional<ssize_t> Hid::GetReportPL(optional<HidReportType> report_type, uint8_t
         return 1;
     }
 
+#if defined(CONFIG_PASSINGLINK_RUNTIME_PROVISIONING)
+    case PLReportId::FlushProvisioning: {
+      if (buf.size() < 6) {
+        return -1;
+      }
+
+      int rc;
+      buf[0] = static_cast<uint8_t>(PLReportId::FlushProvisioning);
+      buf[1] = static_cast<uint8_t>(provisioning_status(&rc));
+      int32_t rc32 = rc;
+      memcpy(&buf[2], &rc32, sizeof(rc32));
+      return 6;
+    }
+#endif
+
+#if defined(CONFIG_PASSINGLINK_REPORT_BUDGET)
+    case PLReportId::BudgetOverrun:
+      return budget_get_overrun_report(buf);
+#endif
+
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+    case PLReportId::Blackbox:
+      return blackbox_get_report(buf);
+#endif
+
+    case PLReportId::Timing: {
+      if (buf.size() < 6) {
+        return -1;
+      }
+
+      HidTiming timing = usb_hid_get_timing();
+      uint8_t available = 0;
+      for (uint8_t i = 0; i < static_cast<uint8_t>(HidTimingStrategy::Count); ++i) {
+        available |= usb_hid_timing_strategy_available(static_cast<HidTimingStrategy>(i)) << i;
+      }
+
+      buf[0] = static_cast<uint8_t>(PLReportId::Timing);
+      buf[1] = static_cast<uint8_t>(timing.strategy);
+      buf[2] = timing.flags;
+      memcpy(&buf[3], &timing.delay_ticks, sizeof(timing.delay_ticks));
+      buf[5] = available;
+      return 6;
+    }
+
     default:
       return {};
   }
@@ -346,6 +648,11 @@ optional<bool> Hid::SetReportPL(optional<HidReportType> report_type, uint8_t rep
                                 span<uint8_t> data) {
   if (report_type && *report_type == HidReportType::Feature) {
     switch (static_cast<PLReportId>(report_id)) {
+#if defined(CONFIG_PASSINGLINK_BULK)
+      case PLReportId::Bulk:
+        return usb_bulk_request(data);
+#endif
+
       case PLReportId::Reboot: {
         if (data.size() != 2) {
           return false;
@@ -391,6 +698,18 @@ optional<bool> Hid::SetReportPL(optional<HidReportType> report_type, uint8_t rep
       }
 #endif
 
+      case PLReportId::Timing: {
+        if (data.size() < 5 || data[1] >= static_cast<uint8_t>(HidTimingStrategy::Count)) {
+          return false;
+        }
+
+        HidTiming timing;
+        timing.strategy = static_cast<HidTimingStrategy>(data[1]);
+        timing.flags = data[2];
+        memcpy(&timing.delay_ticks, &data[3], sizeof(timing.delay_ticks));
+        return usb_hid_set_timing(timing);
+      }
+
       default:
         return {};
     }
@@ -399,57 +718,237 @@ optional<bool> Hid::SetReportPL(optional<HidReportType> report_type, uint8_t rep
   return {};
 }
 
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
+const char* usb_hid_timing_strategy_name(HidTimingStrategy strategy) {
+  switch (strategy) {
+    case HidTimingStrategy::Immediate:
+      return "immediate";
+    case HidTimingStrategy::Deferred:
+      return "deferred";
+    case HidTimingStrategy::DeferredWorkQueue:
+      return "workqueue";
+    default:
+      return "unknown";
+  }
+}
+
+bool usb_hid_timing_strategy_available(HidTimingStrategy strategy) {
+  switch (strategy) {
+    case HidTimingStrategy::Immediate:
+    case HidTimingStrategy::Deferred:
+      return true;
+    case HidTimingStrategy::DeferredWorkQueue:
+#if defined(HID_WORK_QUEUE)
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return false;
+  }
+}
+
+HidTiming usb_hid_get_timing() {
+  ScopedIRQLock lock;
+  return hid_timing;
+}
+
+bool usb_hid_set_timing(HidTiming timing) {
+  if (!usb_hid_timing_strategy_available(timing.strategy)) {
+    LOG_ERR("timing strategy %s unavailable", usb_hid_timing_strategy_name(timing.strategy));
+    return false;
+  }
+
+  // A delay past the poll interval would just push every report into the next poll.
+  uint32_t max_delay_ticks = usb_hid_get_max_report_delay_ticks();
+  if (timing.delay_ticks > max_delay_ticks) {
+    LOG_WRN("timing: clamping delay of %u ticks to %u", timing.delay_ticks, max_delay_ticks);
+    timing.delay_ticks = max_delay_ticks;
+  }
+  timing.flags &= HID_TIMING_AVAILABLE_FLAGS;
+
+  array<int, PL_PLAYER_COUNT> cancelled = {};
+  array<struct k_work_q*, PL_PLAYER_COUNT> previous_queues = {};
+  {
+    ScopedIRQLock lock;
+    for (size_t i = 0; i < hid_interface_count; ++i) {
+      previous_queues[i] = hid_timing_work_queue(&hid_interfaces[i]);
+    }
+    hid_timing = timing;
+
+    // A write that's pending on the previous strategy's queue would keep a submission to another
+    // queue from going through: pull it, and reschedule it with the new strategy once the lock is
+    // released, since with the immediate strategy, that means writing the report right away.
+    for (size_t i = 0; i < hid_interface_count; ++i) {
+      cancelled[i] = k_delayed_work_cancel(&hid_interfaces[i].write_work);
+    }
+
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_POLL_AWARE)
+    // Apply (or drop) oversampling for the current poll interval right away.
+    hid_poll_apply();
+#endif
+
+    // Reset the metrics along with the switch, so that no report is counted against the wrong
+    // strategy.
+    metrics_set_timing(timing.tag(), timing.delay_ticks);
+  }
+
+  for (size_t i = 0; i < hid_interface_count; ++i) {
+    HidInterface* iface = &hid_interfaces[i];
+    if (cancelled[i] == -EALREADY && hid_timing_work_queue(iface) != previous_queues[i]) {
+      // The write already ran (or is running) on the previous queue, which it's still attached
+      // to. Until it's initialized again, every submission to the new queue fails, so nothing
+      // else can have touched it in the meantime.
+      hid_work_queue_flush(previous_queues[i]);
+      ScopedIRQLock lock;
+      k_delayed_work_init(&iface->write_work, write_report_work);
+    } else if (cancelled[i] == 0) {
+      do_write(iface);
+    }
+  }
+
+  LOG_INF("timing: %s, delay %u ticks, flags 0x%02x", usb_hid_timing_strategy_name(timing.strategy),
+          timing.delay_ticks, timing.flags);
+  return true;
+}
+
 uint32_t usb_hid_get_report_delay_ticks() {
-  return hid_report_delay_ticks;
+  HidTiming timing = usb_hid_get_timing();
+  return timing.strategy == HidTimingStrategy::Immediate ? 0 : timing.delay_ticks;
 }
 
-void usb_hid_set_report_delay_ticks(uint32_t ticks) {
-  hid_report_delay_ticks = ticks;
+uint32_t usb_hid_get_max_report_delay_ticks() {
+  return usb_hid_get_poll_interval_ticks();
 }
 
+uint32_t usb_hid_get_poll_interval_ticks() {
+#if defined(HID_POLL_ESTIMATOR)
+  if (hid_poll.interval_ticks() != 0) {
+    return hid_poll.interval_ticks();
+  }
 #endif
+  return k_ms_to_ticks_ceil32(CONFIG_USB_HID_POLL_INTERVAL_MS);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_timing(const struct shell* shell, size_t argc, char** argv) {
+  HidTiming timing = usb_hid_get_timing();
+  if (argc == 1) {
+    shell_print(shell, "timing: %s, delay %u ticks (%u us), poll aware %s, oversample %s",
+                usb_hid_timing_strategy_name(timing.strategy), timing.delay_ticks,
+                k_ticks_to_us_ceil32(timing.delay_ticks),
+                timing.flags & HID_TIMING_POLL_AWARE ? "on" : "off",
+                timing.flags & HID_TIMING_OVERSAMPLE ? "on" : "off");
+    for (uint8_t i = 0; i < static_cast<uint8_t>(HidTimingStrategy::Count); ++i) {
+      auto strategy = static_cast<HidTimingStrategy>(i);
+      if (usb_hid_timing_strategy_available(strategy)) {
+        shell_print(shell, "  available: %s", usb_hid_timing_strategy_name(strategy));
+      }
+    }
+    return 0;
+  }
+
+  if (argc == 3 && (strcmp(argv[1], "poll_aware") == 0 || strcmp(argv[1], "oversample") == 0)) {
+    uint8_t flag = argv[1][0] == 'p' ? HID_TIMING_POLL_AWARE : HID_TIMING_OVERSAMPLE;
+    if (strcmp(argv[2], "on") == 0) {
+      timing.flags |= flag;
+    } else if (strcmp(argv[2], "off") == 0) {
+      timing.flags &= ~flag;
+    } else {
+      shell_print(shell, "timing: expected on or off");
+      return 0;
+    }
+    usb_hid_set_timing(timing);
+    return 0;
+  }
+
+  bool found = false;
+  for (uint8_t i = 0; i < static_cast<uint8_t>(HidTimingStrategy::Count); ++i) {
+    auto strategy = static_cast<HidTimingStrategy>(i);
+    if (strcmp(argv[1], usb_hid_timing_strategy_name(strategy)) == 0) {
+      timing.strategy = strategy;
+      found = true;
+    }
+  }
+  if (!found || argc > 3) {
+    shell_print(shell,
+                "usage: timing [STRATEGY [DELAY_TICKS] | poll_aware on|off | oversample on|off]");
+    return 0;
+  }
+  if (argc == 3) {
+    timing.delay_ticks = strtoul(argv[2], nullptr, 10);
+  }
+
+  if (!usb_hid_set_timing(timing)) {
+    shell_print(shell, "timing: %s isn't available", argv[1]);
+  }
+  return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(timing, NULL, "Show or switch the report timing strategy", cmd_timing, 1, 2);
+#endif
+
 namespace passinglink {
 
 int usb_hid_init(Hid* hid_impl) {
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED_WORK_QUEUE)
+  Hid* hids[] = { hid_impl };
+  return usb_hid_init(hids);
+}
+
+int usb_hid_init(span<Hid*> hids) {
+#if defined(HID_WORK_QUEUE)
   static bool hid_work_q_running = false;
   if (!hid_work_q_running) {
-    k_work_q_start(&hid_work_q, hid_work_q_stack, K_THREAD_STACK_SIZEOF(hid_work_q_stack),
-                   -CONFIG_NUM_COOP_PRIORITIES);
+    for (size_t i = 0; i < PL_PLAYER_COUNT; ++i) {
+      k_work_q_start(&hid_work_qs[i], hid_work_q_stacks[i],
+                     K_THREAD_STACK_SIZEOF(hid_work_q_stacks[i]), -CONFIG_NUM_COOP_PRIORITIES);
+    }
     hid_work_q_running = true;
   }
 #endif
+  metrics_set_timing(hid_timing.tag(), hid_timing.delay_ticks);
 
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
-  k_delayed_work_init(&delayed_write_work, write_report);
-#endif
+  if (hids.size() > ARRAY_SIZE(hid_interfaces)) {
+    LOG_ERR("too many HID interfaces requested: %zu", hids.size());
+    return -EINVAL;
+  }
 
-  hid = hid_impl;
+  hid_interface_count = 0;
+  for (size_t i = 0; i < hids.size(); ++i) {
+    HidInterface* iface = &hid_interfaces[i];
+    iface->hid = hids[i];
+    iface->hid->SetPlayer(i);
 
-  LOG_INF("initializing USB HID as %s", hid->Name());
-  int rc = hid->Init();
-  if (rc != 0) {
-    LOG_ERR("HID initialization failed: rc = %d", rc);
-    return rc;
-  }
+    k_delayed_work_init(&iface->write_work, write_report_work);
 
-  usb_hid_device = device_get_binding("HID_0");
-  if (usb_hid_device == NULL) {
-    LOG_ERR("failed to acquire USB HID device");
-    return -ENODEV;
-  }
+    LOG_INF("initializing USB HID %zu as %s", i, iface->hid->Name());
+    int rc = iface->hid->Init();
+    if (rc != 0) {
+      LOG_ERR("HID initialization failed: rc = %d", rc);
+      return rc;
+    }
 
-  span<const uint8_t> report_descriptor = hid->ReportDescriptor();
-  usb_hid_register_device(usb_hid_device, report_descriptor.data(), report_descriptor.size(), &ops);
+    char name[] = "HID_0";
+    name[sizeof(name) - 2] += i;
+    iface->device = device_get_binding(name);
+    if (iface->device == NULL) {
+      LOG_ERR("failed to acquire USB HID device %s", name);
+      return -ENODEV;
+    }
 
-  rc = usb_hid_init(usb_hid_device);
-  if (rc != 0) {
-    LOG_ERR("failed to initialize USB hid: rc = %d", rc);
-    return rc;
+    span<const uint8_t> report_descriptor = iface->hid->ReportDescriptor();
+    usb_hid_register_device(iface->device, report_descriptor.data(), report_descriptor.size(),
+                            &ops);
+
+    rc = usb_hid_init(iface->device);
+    if (rc != 0) {
+      LOG_ERR("failed to initialize USB hid: rc = %d", rc);
+      return rc;
+    }
+
+    ++hid_interface_count;
   }
 
-  rc = usb_enable(usb_status_cb);
+  int rc = usb_enable(usb_status_cb);
   if (rc != 0) {
     LOG_ERR("failed to initialize USB");
     return rc;
@@ -459,13 +958,17 @@ int usb_hid_init(Hid* hid_impl) {
 }
 
 void usb_hid_uninit() {
-#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_DEFERRED)
-  k_delayed_work_cancel(&delayed_write_work);
-#endif
+  for (size_t i = 0; i < hid_interface_count; ++i) {
+    k_delayed_work_cancel(&hid_interfaces[i].write_work);
+  }
 
   usb_disable();
-  usb_hid_unregister_device(usb_hid_device);
-  hid->Deinit();
+  for (size_t i = 0; i < hid_interface_count; ++i) {
+    HidInterface* iface = &hid_interfaces[i];
+    usb_hid_unregister_device(iface->device);
+    iface->hid->Deinit();
+  }
+  hid_interface_count = 0;
 
   metrics_reset();
 }
@@ -2,6 +2,8 @@
 
 #include <sys/types.h>
 
+#include "output/usb/bulk.h"
+#include "output/usb/timing.h"
 #include "types.h"
 
 enum class HidReportType {
@@ -34,8 +36,58 @@ enum class PLReportId : uint8_t {
   // struct {
   //   uint32_t magic; // 0x1209214c
   // };
+  //
+  // The flush finishes after the SetReport does: read the report back until it's no longer
+  // flushing to find out whether it made it to flash.
+  // struct {
+  //   uint8_t report_id;
+  //   uint8_t status; // ProvisioningStatus
+  //   int32_t rc; // flash API error, if it failed
+  // };
   FlushProvisioning = 0x44,
 
+#if defined(CONFIG_PASSINGLINK_REPORT_BUDGET)
+  // Read the next entry of the report budget overrun log.
+  // struct {
+  //   uint8_t report_id;
+  //   uint8_t index;
+  //   uint8_t count;
+  //   uint32_t tick;
+  //   uint32_t budget_cycles;
+  //   uint32_t total_cycles;
+  //   uint32_t stage_cycles;
+  //   RawInputState input;
+  //   char stage[16];
+  // };
+  BudgetOverrun = 0x45,
+#endif
+
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+  // Read the next page of the black box event log, oldest first.
+  // struct {
+  //   uint8_t report_id;
+  //   uint16_t index; // of the first entry in this page
+  //   uint16_t count; // of entries in the log
+  //   BlackboxEntry entries[7];
+  // };
+  Blackbox = 0x46,
+#endif
+
+  // Read the report timing strategy, or switch to another one. Switching resets the latency
+  // metrics. Strategies that weren't compiled in are rejected.
+  // struct {
+  //   uint8_t report_id;
+  //   uint8_t strategy; // HidTimingStrategy
+  //   uint8_t flags; // HidTimingFlags
+  //   uint16_t delay_ticks;
+  //   uint8_t available; // bitmask of available strategies, ignored when switching
+  // };
+  Timing = 0x47,
+
+  // Bulk readout of diagnostics, in chunks of up to CONFIG_PASSINGLINK_BULK_CHUNK bytes: see
+  // output/usb/bulk.h.
+  Bulk = 0x48,
+
   PS4Auth = 0xf0,
 };
 
@@ -60,7 +112,48 @@ enum class PLReportId : uint8_t {
     0x85, 0x44,       /*   Report ID (68) */                   \
     0x0A, 0x44, 0x42, /*   Usage (0x4244) */                   \
     0xB1, 0x02,       /*   Feature(...) */                     \
+    PL_HID_BUDGET_REPORT_DESCRIPTOR                            \
+    PL_HID_BLACKBOX_REPORT_DESCRIPTOR                          \
+    0x85, 0x47,       /*   Report ID (71) */                   \
+    0x0A, 0x47, 0x42, /*   Usage (0x4247) */                   \
+    0xB1, 0x02,       /*   Feature(...) */                     \
+    0xC0,             /* End Collection */
+
+// Reports that only exist when their feature is compiled in.
+#if defined(CONFIG_PASSINGLINK_REPORT_BUDGET)
+#define PL_HID_BUDGET_REPORT_DESCRIPTOR                    \
+  0x85, 0x45,         /*   Report ID (69) */               \
+    0x0A, 0x45, 0x42, /*   Usage (0x4245) */               \
+    0xB1, 0x02,       /*   Feature(...) */
+#else
+#define PL_HID_BUDGET_REPORT_DESCRIPTOR
+#endif
+
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+#define PL_HID_BLACKBOX_REPORT_DESCRIPTOR                  \
+  0x85, 0x46,         /*   Report ID (70) */               \
+    0x0A, 0x46, 0x42, /*   Usage (0x4246) */               \
+    0xB1, 0x02,       /*   Feature(...) */
+#else
+#define PL_HID_BLACKBOX_REPORT_DESCRIPTOR
+#endif
+
+// The bulk report is much larger than the others, so it isn't part of the descriptor above: it's
+// appended in a collection of its own, which only exists with CONFIG_PASSINGLINK_BULK.
+#if defined(CONFIG_PASSINGLINK_BULK)
+#define PL_HID_BULK_REPORT_DESCRIPTOR                                                  \
+  0x06, 0x42, 0xFF,   /* Usage Page (Vendor Defined 0xFF42) */                         \
+    0x09, 0x02,       /* Usage (0x02) */                                               \
+    0xA1, 0x01,       /* Collection (Application) */                                   \
+    0x75, 0x08,       /*   Report Size (8) */                                          \
+    0x96, PL_BULK_REPORT_COUNT & 0xFF, PL_BULK_REPORT_COUNT >> 8, /*   Report Count */ \
+    0x85, 0x48,       /*   Report ID (72) */                                           \
+    0x0A, 0x48, 0x42, /*   Usage (0x4248) */                                           \
+    0xB1, 0x02,       /*   Feature(...) */                                             \
     0xC0,             /* End Collection */
+#else
+#define PL_HID_BULK_REPORT_DESCRIPTOR
+#endif
 
 class Hid {
  public:
@@ -89,12 +182,40 @@ class Hid {
 
   virtual k_timeout_t ProbeDelay() = 0;
   virtual bool ProbeResult() { return false; }
+
+  // The player whose input this Hid reports.
+  size_t Player() const { return player_; }
+  void SetPlayer(size_t player) { player_ = player; }
+
+ protected:
+  size_t player_ = 0;
 };
 
+const char* usb_hid_timing_strategy_name(HidTimingStrategy strategy);
+bool usb_hid_timing_strategy_available(HidTimingStrategy strategy);
+
+HidTiming usb_hid_get_timing();
+
+// Switch strategies, and reset the latency metrics so that they only cover the new one. Returns
+// false if the strategy isn't available. The delay is clamped to
+// usb_hid_get_max_report_delay_ticks(), and flags for features that weren't compiled in are
+// dropped.
+bool usb_hid_set_timing(HidTiming timing);
+
+// The delay between the host collecting a report and the next one being built: 0 if writes aren't
+// deferred.
 uint32_t usb_hid_get_report_delay_ticks();
-void usb_hid_set_report_delay_ticks(uint32_t ticks);
+
+// The interval at which the host polls: the learned one if there is one, or the nominal one.
+uint32_t usb_hid_get_poll_interval_ticks();
+
+// The longest report delay that usb_hid_set_timing() accepts.
+uint32_t usb_hid_get_max_report_delay_ticks();
 
 namespace passinglink {
 int usb_hid_init(Hid* hid_impl);
+
+// Initialize a composite device with one HID interface per Hid, fed by consecutive players.
+int usb_hid_init(span<Hid*> hids);
 void usb_hid_uninit();
 }  // namespace passinglink
@@ -62,6 +62,7 @@ const uint8_t kNXReportDescriptor[] = {
   0xC0,              // End Collection
 
   PL_HID_REPORT_DESCRIPTOR
+  PL_HID_BULK_REPORT_DESCRIPTOR
 };
 // clang-format on
 
@@ -124,7 +125,7 @@ ssize_t NXHid::GetInputReport(uint8_t report_id, span<uint8_t> buf) {
       }
 
       InputState input;
-      if (!input_get_state(&input)) {
+      if (!input_get_state(&input, player_)) {
         LOG_ERR("failed to get InputState");
         return -1;
       }
@@ -0,0 +1,75 @@
+#include "output/usb/probe_sim.h"
+
+#include <zephyr.h>
+
+#include <logging/log.h>
+
+#include "types.h"
+
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(probe_sim);
+
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM_NX)
+static optional<ProbeType> sim_console = ProbeType::NX;
+static constexpr const char* sim_console_name = "Switch";
+#elif defined(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM_PS3)
+static optional<ProbeType> sim_console = ProbeType::PS3;
+static constexpr const char* sim_console_name = "PS3";
+#else
+// The PS4 doesn't do anything that we probe for, so it's detected by every other probe failing.
+static optional<ProbeType> sim_console;
+static constexpr const char* sim_console_name = "PS4";
+#endif
+
+static k_delayed_work sim_work;
+static ProbeType sim_probe_type;
+static Hid* sim_hid;
+
+static void probe_sim_respond(k_work*) {
+  if (!sim_hid) {
+    return;
+  }
+
+  switch (sim_probe_type) {
+    case ProbeType::NX:
+      // The Switch clears the halt on both interrupt endpoints after configuration.
+      LOG_INF("simulated %s: clearing endpoint halts", sim_console_name);
+      sim_hid->ClearHalt(0x81);
+      sim_hid->ClearHalt(0x01);
+      break;
+
+    case ProbeType::PS3: {
+      // The PS3 assigns a controller number via an output report.
+      LOG_INF("simulated %s: setting controller number", sim_console_name);
+      uint8_t report[8] = { 0x01, 0x00, 0x02 };
+      sim_hid->InterruptOut(span<uint8_t>(report, sizeof(report)));
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void probe_sim_start(ProbeType probe_type, Hid* hid) {
+  static bool initialized = false;
+  if (!initialized) {
+    k_delayed_work_init(&sim_work, probe_sim_respond);
+    initialized = true;
+  }
+
+  sim_probe_type = probe_type;
+  sim_hid = hid;
+
+  if (!sim_console || *sim_console != probe_type) {
+    LOG_INF("simulated %s: ignoring %s", sim_console_name, hid->Name());
+    return;
+  }
+
+  k_delayed_work_submit(&sim_work, K_MSEC(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM_DELAY_MS));
+}
+
+void probe_sim_stop() {
+  k_delayed_work_cancel(&sim_work);
+  sim_hid = nullptr;
+}
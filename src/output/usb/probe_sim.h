@@ -0,0 +1,17 @@
+#pragma once
+
+#include "output/usb/hid.h"
+#include "output/usb/probe_type.h"
+
+// Simulated console for exercising USB probing without a console attached.
+//
+// After a Hid is brought up for probing, the simulated console replays the host behavior that the
+// probe checks for (halt clears for the Switch, the LED output report for the PS3), but only for the
+// Hid that the selected console would actually talk to. This allows measuring time-to-correct-mode
+// for every probe configuration with just a PC on the other end.
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM)
+
+void probe_sim_start(ProbeType probe_type, Hid* hid);
+void probe_sim_stop();
+
+#endif
@@ -7,3 +7,6 @@ enum class ProbeType : uint64_t {
   PS3 = 0xA0A0A0A0A0A0A0A0,
   PS4 = 0x5555555555555555,
 };
+
+// The values are chosen so that they're unlikely to show up in uninitialized memory.
+bool ProbeTypeIsValid(ProbeType probe_type);
@@ -87,6 +87,7 @@ const uint8_t kPS3ReportDescriptor[] = {
   0xC0,              // End Collection
 
   PL_HID_REPORT_DESCRIPTOR
+  PL_HID_BULK_REPORT_DESCRIPTOR
 };
 // clang-format on
 
@@ -152,7 +153,7 @@ ssize_t PS3Hid::GetInputReport(uint8_t report_id, span<uint8_t> buf) {
       }
 
       InputState input;
-      if (!input_get_state(&input)) {
+      if (!input_get_state(&input, player_)) {
         LOG_ERR("failed to get InputState");
         return -1;
       }
@@ -246,21 +247,17 @@ void PS3Hid::InterruptOut(span<uint8_t> buf) {
   if (buf.size() == 8) {
     controller_number_ = buf[2];
 
-    led_off(Led::P1);
-    led_off(Led::P2);
-    led_off(Led::P3);
-    led_off(Led::P4);
-    if (controller_number_ & 1) {
-      led_on(Led::P1);
-    }
-    if (controller_number_ & 2) {
-      led_on(Led::P2);
-    }
-    if (controller_number_ & 4) {
-      led_on(Led::P3);
-    }
-    if (controller_number_ & 8) {
-      led_on(Led::P4);
+    // With two players, each interface is assigned its own controller number: only touch the
+    // LEDs that this one turned on, and leave the other's alone.
+    static constexpr Led leds[] = {Led::P1, Led::P2, Led::P3, Led::P4};
+    for (size_t i = 0; i < ARRAY_SIZE(leds); ++i) {
+      bool on = controller_number_ & (1 << i);
+      if (on && !led_counters_[i]) {
+        led_counters_[i] = led_on(leds[i]);
+      } else if (!on && led_counters_[i]) {
+        led_off(leds[i], *led_counters_[i]);
+        led_counters_[i].reset();
+      }
     }
   }
 }
@@ -24,4 +24,7 @@ class PS3Hid : public Hid {
 
  private:
   uint8_t controller_number_ = 0xFF;
+
+  // The counters of the player LEDs that we turned on.
+  array<optional<uint32_t>, 4> led_counters_;
 };
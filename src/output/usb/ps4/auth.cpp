@@ -11,6 +11,7 @@
 #include <mbedtls/rsa.h>
 #include <mbedtls/sha256.h>
 
+#include "metrics/blackbox.h"
 #include "panic.h"
 #include "provisioning.h"
 
@@ -31,10 +32,46 @@ static uint8_t nonce_signature[256];
 
 K_WORK_DEFINE(k_work_sign, sign_nonce);
 
+// Exchange the auth state, recording changes of state type in the black box.
+static bool auth_state_exchange(AuthState current_state, AuthState new_state) {
+  if (!auth_state.cas(current_state, new_state)) {
+    return false;
+  }
+
+  if (current_state.type != new_state.type) {
+    blackbox_record(BlackboxEvent::AuthState, static_cast<uint8_t>(new_state.type),
+                    new_state.nonce_id);
+  }
+  return true;
+}
+
 AuthState get_auth_state() {
   return auth_state.load();
 }
 
+void auth_reset() {
+  // A signature that's still being computed gets dropped when its final exchange fails.
+  AuthState current_state;
+  AuthState new_state;
+  do {
+    current_state = auth_state.load();
+    new_state = current_state;
+    new_state.type = AuthStateType::ReceivingNonce;
+    new_state.next_part = 0;
+  } while (!auth_state_exchange(current_state, new_state));
+}
+
+#if defined(CONFIG_PASSINGLINK_CHECK_MAIN_STACK_HWM)
+size_t auth_get_main_stack_hwm() {
+  const uint8_t* main_stack = reinterpret_cast<const uint8_t*>(&z_main_stack);
+  const uint8_t* main_stack_hwm = main_stack;
+  while (*main_stack_hwm == 0xAA) {
+    ++main_stack_hwm;
+  }
+  return CONFIG_MAIN_STACK_SIZE - (main_stack_hwm - main_stack);
+}
+#endif
+
 static void sign_nonce(struct k_work*) {
   LOG_INF("sign_nonce: started");
   const ProvisioningData* pd = provisioning_data_get();
@@ -47,7 +84,7 @@ static void sign_nonce(struct k_work*) {
 
   AuthState new_state = current_state;
   new_state.type = AuthStateType::Signing;
-  if (!auth_state.cas(current_state, new_state)) {
+  if (!auth_state_exchange(current_state, new_state)) {
     LOG_ERR("sign_nonce: failed to exchange initial auth state");
     return;
   }
@@ -77,19 +114,14 @@ static void sign_nonce(struct k_work*) {
   LOG_INF("sign_nonce: finished signing");
 
 #if defined(CONFIG_PASSINGLINK_CHECK_MAIN_STACK_HWM)
-  const uint8_t* main_stack = reinterpret_cast<const uint8_t*>(&z_main_stack);
-  const uint8_t* main_stack_hwm = main_stack;
-  while (*main_stack_hwm == 0xAA) {
-    ++main_stack_hwm;
-  }
-  LOG_INF("main stack hwm: %zd bytes", CONFIG_MAIN_STACK_SIZE - (main_stack_hwm - main_stack));
+  LOG_INF("main stack hwm: %zu bytes", auth_get_main_stack_hwm());
 #endif
 
   current_state = new_state;
   new_state.type = AuthStateType::SendingSignature;
   new_state.next_part = 0;
 
-  if (!auth_state.cas(current_state, new_state)) {
+  if (!auth_state_exchange(current_state, new_state)) {
     LOG_ERR("sign_nonce: failed to exchange final auth state");
   }
 }
@@ -141,7 +173,7 @@ bool set_nonce(uint8_t nonce_id, uint8_t nonce_part, span<uint8_t> data) {
     }
   }
 
-  bool cas_result = auth_state.cas(current_state, new_state);
+  bool cas_result = auth_state_exchange(current_state, new_state);
   if (!cas_result) {
     LOG_ERR("auth state changed while receiving nonce?");
     return false;
@@ -244,7 +276,7 @@ bool get_next_signature_chunk(span<uint8_t> buf) {
     new_state.next_part = 0;
   }
 
-  if (!auth_state.cas(current_state, new_state)) {
+  if (!auth_state_exchange(current_state, new_state)) {
     LOG_ERR("get_next_signature_chunk: failed to update current state");
     return false;
   }
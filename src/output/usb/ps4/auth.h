@@ -30,5 +30,13 @@ struct alignas(1) AuthState {
 static_assert(sizeof(AuthState) == 4);
 
 AuthState get_auth_state();
+
+// Abandon the handshake in progress, if any, and wait for a new nonce.
+void auth_reset();
 bool set_nonce(uint8_t nonce_id, uint8_t nonce_part, span<uint8_t> data);
 bool get_next_signature_chunk(span<uint8_t> buf);
+
+#if defined(CONFIG_PASSINGLINK_CHECK_MAIN_STACK_HWM)
+// Peak usage of the main thread's stack, which signing runs on.
+size_t auth_get_main_stack_hwm();
+#endif
@@ -0,0 +1,215 @@
+#include <zephyr.h>
+
+#include <shell/shell.h>
+#include <sys/crc.h>
+
+#include <mbedtls/rsa.h>
+#include <mbedtls/sha256.h>
+
+#include "arch.h"
+#include "output/usb/ps4/auth.h"
+#include "output/usb/ps4/hid.h"
+#include "types.h"
+
+// Simulated PS4 for exercising authentication without a console attached.
+//
+// The `ps4_auth_sim` shell command plays the console's side of the handshake against a PS4Hid:
+// five 0xF0 nonce parts, 0xF2 polls until the signature is ready, then nineteen 0xF1 signature
+// chunks. The reassembled signature is verified against the public key that came along with it,
+// and the time taken by each step is reported, so that signing speed can be compared between
+// boards and caught when it regresses.
+//
+// This shares the auth state with the real PS4Hid, so don't run it while a console is attached.
+
+extern "C" size_t allocator_get_hwm();
+
+static constexpr size_t AUTH_NONCE_PARTS = 5;
+static constexpr size_t AUTH_SIGNATURE_CHUNKS = 19;
+static constexpr size_t AUTH_CHUNK_SIZE = 56;
+
+// Layout of the reassembled signature chunks.
+struct __attribute__((packed)) AuthSignature {
+  uint8_t signature[256];
+  uint8_t serial[16];
+  uint8_t n[256];
+  uint8_t e[256];
+  uint8_t ca_signature[256];
+  uint8_t padding[24];
+};
+
+static_assert(sizeof(AuthSignature) == AUTH_SIGNATURE_CHUNKS * AUTH_CHUNK_SIZE);
+
+struct AuthSimTiming {
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint64_t total = 0;
+  size_t count = 0;
+
+  void add(uint32_t cycles) {
+    min = ::min(min, cycles);
+    max = ::max(max, cycles);
+    total += cycles;
+    ++count;
+  }
+
+  uint32_t average() const { return count ? total / count : 0; }
+};
+
+static uint32_t cycles_to_us(uint32_t cycles) {
+  return static_cast<uint64_t>(cycles) * 1'000'000 / get_cpu_freq();
+}
+
+static void auth_sim_print_timing(const struct shell* shell, const char* name,
+                                  const AuthSimTiming& timing) {
+  shell_print(shell, "  %-8s x%-3zu min %6u us, avg %6u us, max %6u us", name, timing.count,
+              cycles_to_us(timing.min), cycles_to_us(timing.average()), cycles_to_us(timing.max));
+}
+
+static bool auth_sim_verify(const struct shell* shell, const uint8_t* nonce,
+                            const AuthSignature& signature) {
+  uint8_t hashed_nonce[32];
+  if (mbedtls_sha256_ret(nonce, 256, hashed_nonce, 0) != 0) {
+    shell_print(shell, "ps4_auth_sim: failed to hash nonce");
+    return false;
+  }
+
+  static mbedtls_rsa_context rsa;
+  mbedtls_rsa_init(&rsa, MBEDTLS_RSA_PKCS_V21, MBEDTLS_MD_SHA256);
+  int rc = mbedtls_rsa_import_raw(&rsa, signature.n, sizeof(signature.n), nullptr, 0, nullptr, 0,
+                                  nullptr, 0, signature.e, sizeof(signature.e));
+  if (rc == 0) {
+    rc = mbedtls_rsa_complete(&rsa);
+  }
+  if (rc == 0) {
+    rc = mbedtls_rsa_rsassa_pss_verify(&rsa, nullptr, nullptr, MBEDTLS_RSA_PUBLIC,
+                                       MBEDTLS_MD_SHA256, sizeof(hashed_nonce), hashed_nonce,
+                                       signature.signature);
+  }
+  mbedtls_rsa_free(&rsa);
+
+  if (rc != 0) {
+    shell_print(shell, "ps4_auth_sim: signature verification failed: mbed error = %d", rc);
+    return false;
+  }
+  return true;
+}
+
+// Returns false if the handshake didn't make it to the end, which leaves the auth state partway
+// through it.
+static bool auth_sim_run(const struct shell* shell, uint8_t nonce_id) {
+  static PS4Hid hid;
+  static uint8_t nonce[AUTH_NONCE_PARTS * AUTH_CHUNK_SIZE];
+  static AuthSignature signature;
+
+  uint32_t seed = k_cycle_get_32();
+  for (uint8_t& byte : nonce) {
+    seed = seed * 1103515245 + 12345;
+    byte = seed >> 24;
+  }
+
+  AuthSimTiming nonce_timing;
+  AuthSimTiming poll_timing;
+  AuthSimTiming chunk_timing;
+
+  // Send the nonce, 56 bytes at a time. The last part is padded with 24 bytes.
+  uint32_t nonce_sent_cycle = 0;
+  for (size_t part = 0; part < AUTH_NONCE_PARTS; ++part) {
+    uint8_t report[64] = { 0xF0, nonce_id, static_cast<uint8_t>(part), 0 };
+    memcpy(&report[4], &nonce[part * AUTH_CHUNK_SIZE], AUTH_CHUNK_SIZE);
+    uint32_t crc = crc32_ieee(report, sizeof(report) - sizeof(crc));
+    memcpy(&report[sizeof(report) - sizeof(crc)], &crc, sizeof(crc));
+
+    uint32_t begin = get_cycle_count();
+    bool result = hid.SetReport(HidReportType::Feature, 0xF0, span(report, sizeof(report)));
+    nonce_sent_cycle = get_cycle_count();
+    nonce_timing.add(nonce_sent_cycle - begin);
+
+    if (!result) {
+      shell_print(shell, "ps4_auth_sim: nonce part %zu rejected", part);
+      return false;
+    }
+  }
+
+  // Poll for the signature. The console does this every few hundred milliseconds, but we want to
+  // know how long signing actually takes, so poll every tick.
+  int64_t nonce_sent_ms = k_uptime_get();
+  uint32_t ready_cycles = 0;
+  while (true) {
+    uint8_t report[16];
+    uint32_t begin = get_cycle_count();
+    ssize_t rc = hid.GetFeatureReport(0xF2, span(report, sizeof(report)));
+    uint32_t end = get_cycle_count();
+    poll_timing.add(end - begin);
+
+    if (rc < 0) {
+      shell_print(shell, "ps4_auth_sim: state poll failed");
+      return false;
+    } else if (report[2] == 0) {
+      ready_cycles = end - nonce_sent_cycle;
+      break;
+    } else if (k_uptime_get() - nonce_sent_ms > 60'000) {
+      shell_print(shell, "ps4_auth_sim: timed out waiting for signature");
+      return false;
+    }
+
+    k_sleep(K_TICKS(1));
+  }
+  int64_t ready_ms = k_uptime_get() - nonce_sent_ms;
+
+  // Read out the signature, along with the key and its certificate.
+  uint8_t* signature_bytes = reinterpret_cast<uint8_t*>(&signature);
+  for (size_t chunk = 0; chunk < AUTH_SIGNATURE_CHUNKS; ++chunk) {
+    uint8_t report[64];
+    uint32_t begin = get_cycle_count();
+    ssize_t rc = hid.GetFeatureReport(0xF1, span(report, sizeof(report)));
+    chunk_timing.add(get_cycle_count() - begin);
+
+    if (rc != 64) {
+      shell_print(shell, "ps4_auth_sim: signature chunk %zu failed", chunk);
+      return false;
+    }
+
+    uint32_t crc = crc32_ieee(report, rc - sizeof(crc));
+    if (memcmp(&crc, &report[rc - sizeof(crc)], sizeof(crc)) != 0 || report[1] != nonce_id ||
+        report[2] != chunk) {
+      shell_print(shell, "ps4_auth_sim: signature chunk %zu malformed", chunk);
+      return false;
+    }
+    memcpy(&signature_bytes[chunk * AUTH_CHUNK_SIZE], &report[4], AUTH_CHUNK_SIZE);
+  }
+
+  if (!auth_sim_verify(shell, nonce, signature)) {
+    return false;
+  }
+
+  shell_print(shell, "ps4_auth_sim: signature verified, nonce to ready in %u us (%lld ms uptime)",
+              cycles_to_us(ready_cycles), ready_ms);
+  auth_sim_print_timing(shell, "0xF0", nonce_timing);
+  auth_sim_print_timing(shell, "0xF2", poll_timing);
+  auth_sim_print_timing(shell, "0xF1", chunk_timing);
+
+#if defined(CONFIG_PASSINGLINK_ALLOCATOR)
+  shell_print(shell, "  heap hwm: %zu bytes", allocator_get_hwm());
+#endif
+#if defined(CONFIG_PASSINGLINK_CHECK_MAIN_STACK_HWM)
+  shell_print(shell, "  main stack hwm: %zu bytes", auth_get_main_stack_hwm());
+#endif
+  return true;
+}
+
+static int cmd_ps4_auth_sim(const struct shell* shell, size_t argc, char** argv) {
+  AuthState initial_state = get_auth_state();
+  if (initial_state.type != AuthStateType::ReceivingNonce || initial_state.next_part != 0) {
+    shell_print(shell, "ps4_auth_sim: authentication already in progress");
+    return 0;
+  }
+
+  if (!auth_sim_run(shell, initial_state.nonce_id + 1)) {
+    // Don't leave the next run, or a console, to pick up where this one failed.
+    auth_reset();
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(ps4_auth_sim, NULL, "Run a simulated PS4 authentication handshake",
+                   cmd_ps4_auth_sim);
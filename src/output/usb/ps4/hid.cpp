@@ -282,7 +282,7 @@ ssize_t PS4Hid::GetInputReport(uint8_t report_id, span<uint8_t> buf) {
       }
 
       InputState input;
-      if (!input_get_state(&input)) {
+      if (!input_get_state(&input, player_)) {
         LOG_ERR("failed to get InputState");
         return -1;
       }
@@ -347,7 +347,7 @@ ssize_t PS4Hid::GetInputReport(uint8_t report_id, span<uint8_t> buf) {
       output.left_trigger = 0;
       output.right_trigger = 0;
 
-      output.touchpad_data = touchpad_data;
+      output.touchpad_data = touchpad_data.load();
 
       memcpy(buf.data(), &output, buf.size());
 
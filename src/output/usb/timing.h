@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Report scheduling policy. This is kept free of Zephyr (and of types.h), so that tools/schedsim
+// can replay traces recorded on the device against exactly the code that runs on it.
+
+// How reports get scheduled after the host collects the previous one. Every available strategy
+// can be switched to at runtime, to compare them against each other without reflashing.
+enum class HidTimingStrategy : uint8_t {
+  // Build and write the next report right away, from the USB interrupt.
+  Immediate = 0,
+
+  // Build and write it from the system work queue, after the report delay.
+  Deferred = 1,
+
+  // Build and write it from a dedicated cooperative work queue, after the report delay.
+  DeferredWorkQueue = 2,
+
+  Count,
+};
+
+enum HidTimingFlags : uint8_t {
+  // Push deferred writes back by however much slower than nominal the host polls.
+  HID_TIMING_POLL_AWARE = 1 << 0,
+
+  // Sample inputs from a timer between reports when the host polls slowly.
+  HID_TIMING_OVERSAMPLE = 1 << 1,
+};
+
+struct HidTiming {
+  HidTimingStrategy strategy;
+  uint8_t flags;
+  uint16_t delay_ticks;
+
+  // Identifies the strategy and flags in metrics, in a single byte.
+  uint8_t tag() const { return static_cast<uint8_t>(strategy) | flags << 4; }
+};
+
+// The report delay is tuned for a host that polls at the interval in our endpoint descriptor, but
+// hosts are free to poll slower than that: PS3 and Switch class consoles poll every 4-8ms. With a
+// fixed delay, the report gets built right after the previous one was collected, and then sits in
+// the endpoint for most of the interval.
+//
+// Learn the real interval from the spacing of collections, so that writes can be pushed back by
+// however much longer than nominal it is. The minimum over a window is used, since a write that
+// misses a poll doubles the gap.
+class HidPollEstimator {
+ public:
+  static constexpr size_t WINDOW = 32;
+
+  explicit constexpr HidPollEstimator(uint32_t nominal_ticks) : nominal_ticks_(nominal_ticks) {}
+
+  // Record the host collecting a report. Returns true at the end of every window, when the
+  // interval estimate has been updated.
+  bool record(uint32_t now) {
+    bool updated = false;
+    if (have_last_) {
+      uint32_t gap = now - last_tick_;
+      window_min_ = gap < window_min_ ? gap : window_min_;
+      if (++window_count_ == WINDOW) {
+        interval_ticks_ = window_min_;
+        window_min_ = UINT32_MAX;
+        window_count_ = 0;
+        updated = true;
+      }
+    }
+    have_last_ = true;
+    last_tick_ = now;
+    return updated;
+  }
+
+  void reset() {
+    have_last_ = false;
+    window_min_ = UINT32_MAX;
+    window_count_ = 0;
+    interval_ticks_ = 0;
+  }
+
+  uint32_t nominal_ticks() const { return nominal_ticks_; }
+
+  // The learned interval, or 0 if there isn't one yet.
+  uint32_t interval_ticks() const { return interval_ticks_; }
+
+  uint32_t extra_delay_ticks() const {
+    return interval_ticks_ > nominal_ticks_ ? interval_ticks_ - nominal_ticks_ : 0;
+  }
+
+  // Whether the host polls slowly enough for oversampling to be worth it.
+  bool slow() const { return interval_ticks_ != 0 && interval_ticks_ >= 2 * nominal_ticks_; }
+
+ private:
+  uint32_t nominal_ticks_;
+  bool have_last_ = false;
+  uint32_t last_tick_ = 0;
+  uint32_t window_min_ = UINT32_MAX;
+  size_t window_count_ = 0;
+  uint32_t interval_ticks_ = 0;
+};
+
+// Ticks between the host collecting a report and the next one being built, given how much slower
+// than nominal the host was found to poll.
+inline uint32_t hid_timing_write_delay_ticks(const HidTiming& timing, uint32_t poll_extra_ticks) {
+  if (timing.strategy == HidTimingStrategy::Immediate) {
+    return 0;
+  }
+
+  uint32_t delay_ticks = timing.delay_ticks;
+  if (timing.flags & HID_TIMING_POLL_AWARE) {
+    delay_ticks += poll_extra_ticks;
+  }
+  return delay_ticks;
+}
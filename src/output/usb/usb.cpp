@@ -6,6 +6,7 @@
 
 #include <init.h>
 #include <logging/log.h>
+#include <shell/shell.h>
 
 #include <usb/class/usb_hid.h>
 #include <usb/usb_device.h>
@@ -13,13 +14,16 @@
 #include "arch.h"
 #include "display/display.h"
 #include "input/input.h"
+#include "metrics/blackbox.h"
 #include "output/led.h"
 #include "output/output.h"
 #include "output/usb/hid.h"
 #include "output/usb/nx/hid.h"
+#include "output/usb/probe_sim.h"
 #include "output/usb/probe_type.h"
 #include "output/usb/ps3/hid.h"
 #include "output/usb/ps4/hid.h"
+#include "recovery.h"
 
 #define LOG_LEVEL LOG_LEVEL_DBG
 LOG_MODULE_REGISTER(usb);
@@ -42,6 +46,10 @@ static PS3Hid ps3_hid;
 static PS4Hid ps4_hid;
 #endif
 
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_TWO_PLAYER)
+static PS3Hid ps3_hid_p2;
+#endif
+
 #if defined(CONFIG_PASSINGLINK_OUTPUT_USB_FORCE_PROBE_REBOOT) || defined(CONFIG_USB_DC_STM32)
 #define REBOOT_PROBE
 #endif
@@ -126,6 +134,14 @@ Hid* ProbeTypeHid(ProbeType probe_type) {
 #if defined(REBOOT_PROBE)
 static ProbeType boot_probe_type __attribute__((section(".noinit")));
 
+// Time spent and attempts made by probes before rebooting, only valid with boot_probe_type.
+static uint32_t boot_probe_elapsed_ms __attribute__((section(".noinit")));
+static uint32_t boot_probe_attempts __attribute__((section(".noinit")));
+
+// Reboots done by the probe so far, and how long the boots took until probing resumed.
+static uint32_t boot_probe_reboots __attribute__((section(".noinit")));
+static uint32_t boot_probe_boot_ms __attribute__((section(".noinit")));
+
 optional<ProbeType> get_boot_probe() {
   if (ProbeTypeIsValid(boot_probe_type)) {
     return boot_probe_type;
@@ -146,6 +162,53 @@ void set_boot_probe(optional<ProbeType> probe) {
 #if PL_USB_OUTPUT_COUNT > 1
 static optional<ProbeType> current_probe;
 
+// Statistics about the probe, for measuring time-to-correct-mode.
+struct ProbeStats {
+  // Milliseconds spent probing before the current boot.
+  uint32_t previous_elapsed_ms;
+
+  // Uptime at which probing started in the current boot.
+  int64_t start_ms;
+
+  // Number of Hids tried.
+  uint32_t attempts;
+
+  // Number of reboots between Hids, and the time from each reboot's kernel start until probing
+  // resumed, which is included in the total. The reset and the bootloader come before the kernel
+  // starts keeping time, so they aren't.
+  uint32_t reboots;
+  uint32_t boot_ms;
+
+  // Total time from the first probe to the final selection.
+  optional<uint32_t> result_ms;
+};
+
+static ProbeStats probe_stats;
+
+static void probe_stats_begin(bool resuming) {
+  probe_stats.start_ms = k_uptime_get();
+  probe_stats.previous_elapsed_ms = 0;
+  probe_stats.attempts = 0;
+  probe_stats.reboots = 0;
+  probe_stats.boot_ms = 0;
+  probe_stats.result_ms.reset();
+
+#if defined(REBOOT_PROBE)
+  if (resuming) {
+    // Count this boot from the start of the kernel, rather than from when probing resumed.
+    probe_stats.start_ms = 0;
+    probe_stats.previous_elapsed_ms = boot_probe_elapsed_ms;
+    probe_stats.attempts = boot_probe_attempts;
+    probe_stats.reboots = boot_probe_reboots;
+    probe_stats.boot_ms = boot_probe_boot_ms + k_uptime_get();
+  }
+#endif
+}
+
+static uint32_t probe_stats_elapsed_ms() {
+  return probe_stats.previous_elapsed_ms + (k_uptime_get() - probe_stats.start_ms);
+}
+
 static k_delayed_work probe_check_work;
 static void usb_probe_start();
 static void usb_probe_check(k_work*);
@@ -153,6 +216,15 @@ static void usb_probe_check(k_work*);
 static int usb_probe() {
   k_delayed_work_init(&probe_check_work, usb_probe_check);
 
+  // Come straight back up in the previous mode after a fault. The display isn't up yet in this
+  // case, main takes care of it after we're done.
+  if (auto recovered = recovery_get_probe()) {
+    LOG_WRN("recovering %s", ProbeTypeHid(*recovered)->Name());
+    probe_stats.result_ms = 0;
+    current_probe = recovered;
+    return passinglink::usb_hid_init(ProbeTypeHid(*recovered));
+  }
+
   optional<ProbeType> probe;
 #if defined(REBOOT_PROBE)
   probe = get_boot_probe();
@@ -162,6 +234,7 @@ static int usb_probe() {
     LOG_INF("boot probe found: %s", ProbeTypeHid(*probe)->Name());
   }
 #endif
+  probe_stats_begin(probe.valid());
 
   // Check to see if the user is overriding detection after we check if we already probed, so
   // inadvertent button presses don't override probing.
@@ -175,6 +248,7 @@ static int usb_probe() {
       if (!input.mode_ps3) {
         LOG_WRN("PS4 mode switch set, selecting PS4");
         DISPLAY_PROBE(false, ProbeType::PS4);
+        recovery_set_probe(ProbeType::PS4);
         return passinglink::usb_hid_init(&ps4_hid);
       }
 #endif
@@ -183,6 +257,7 @@ static int usb_probe() {
       if (input.button_west) {
         LOG_WRN("Switch mode selected via button");
         DISPLAY_PROBE(false, ProbeType::NX);
+        recovery_set_probe(ProbeType::NX);
         return passinglink::usb_hid_init(&nx_hid);
       }
 #endif
@@ -191,6 +266,7 @@ static int usb_probe() {
       if (input.button_north) {
         LOG_WRN("PS3 mode selected via button");
         DISPLAY_PROBE(false, ProbeType::PS3);
+        recovery_set_probe(ProbeType::PS3);
         return passinglink::usb_hid_init(&ps3_hid);
       }
 #endif
@@ -199,6 +275,7 @@ static int usb_probe() {
       if (input.button_r1) {
         LOG_WRN("PS4 mode selected via button");
         DISPLAY_PROBE(false, ProbeType::PS4);
+        recovery_set_probe(ProbeType::PS4);
         return passinglink::usb_hid_init(&ps4_hid);
       }
 #endif
@@ -227,8 +304,14 @@ static void usb_probe_start() {
 
   probe_led_counter = led_on(*ProbeTypeLed(*current_probe));
   Hid* current_hid = ProbeTypeHid(*current_probe);
+  ++probe_stats.attempts;
+  blackbox_record(BlackboxEvent::ProbeStart, static_cast<uint8_t>(*current_probe));
   passinglink::usb_hid_init(current_hid);
 
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM)
+  probe_sim_start(*current_probe, current_hid);
+#endif
+
   k_delayed_work_submit(&probe_check_work, current_hid->ProbeDelay());
 }
 
@@ -246,6 +329,17 @@ static void usb_probe_selected() {
 #if defined(REBOOT_PROBE)
   set_boot_probe({});
 #endif
+
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM)
+  probe_sim_stop();
+#endif
+
+  recovery_set_probe(*current_probe);
+  probe_stats.result_ms = probe_stats_elapsed_ms();
+  blackbox_record(BlackboxEvent::ProbeSelected, static_cast<uint8_t>(*current_probe));
+  LOG_INF("probe selected %s after %u ms (%u attempts, %u reboots taking %u ms)",
+          ProbeTypeHid(*current_probe)->Name(), *probe_stats.result_ms, probe_stats.attempts,
+          probe_stats.reboots, probe_stats.boot_ms);
 }
 
 static void usb_probe_check(k_work*) {
@@ -266,9 +360,17 @@ static void usb_probe_check(k_work*) {
 
   LOG_ERR("%s Hid reports failure, continuing", current_hid->Name());
 
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_PROBE_SIM)
+  probe_sim_stop();
+#endif
+
 #if defined(REBOOT_PROBE)
   // usb_disable isn't implemented for STM32, so we need to stash our result and reboot.
   set_boot_probe(next_probe);
+  boot_probe_elapsed_ms = probe_stats_elapsed_ms();
+  boot_probe_attempts = probe_stats.attempts;
+  boot_probe_reboots = probe_stats.reboots + 1;
+  boot_probe_boot_ms = probe_stats.boot_ms;
   reboot();
 #else
   passinglink::usb_hid_uninit();
@@ -276,12 +378,40 @@ static void usb_probe_check(k_work*) {
   usb_probe_start();
 #endif
 }
+
+#if defined(CONFIG_SHELL)
+static int cmd_probe(const struct shell* shell, size_t argc, char** argv) {
+  if (!current_probe) {
+    shell_print(shell, "probe: not started");
+  } else if (!probe_stats.result_ms) {
+    shell_print(shell, "probe: trying %s, %u ms elapsed (%u attempts)",
+                ProbeTypeHid(*current_probe)->Name(), probe_stats_elapsed_ms(),
+                probe_stats.attempts);
+  } else {
+    shell_print(shell, "probe: selected %s after %u ms (%u attempts)",
+                ProbeTypeHid(*current_probe)->Name(), *probe_stats.result_ms,
+                probe_stats.attempts);
+  }
+  if (probe_stats.reboots != 0) {
+    shell_print(shell, "probe: %u reboots, %u ms from kernel start to probing",
+                probe_stats.reboots, probe_stats.boot_ms);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(probe, NULL, "Show USB probe timing", cmd_probe);
+#endif
 #endif  // PL_USB_OUTPUT_COUNT > 1
 
 namespace passinglink {
 
 int usb_init() {
-#if PL_USB_OUTPUT_COUNT > 1
+#if defined(CONFIG_PASSINGLINK_OUTPUT_USB_TWO_PLAYER)
+  // Probing relies on the console talking to a single interface, so two player mode is always
+  // PS3, which PCs also see as a generic gamepad.
+  Hid* hids[] = { &ps3_hid, &ps3_hid_p2 };
+  return passinglink::usb_hid_init(hids);
+#elif PL_USB_OUTPUT_COUNT > 1
   return usb_probe();
 #elif defined(CONFIG_PASSINGLINK_OUTPUT_USB_PS3)
   return passinglink::usb_hid_init(&ps3_hid);
@@ -1,7 +1,16 @@
 #pragma once
 
+#if defined(CONFIG_PASSINGLINK_BLACKBOX)
+// Defined in metrics/blackbox.cpp, which can't be included here since it depends on types.h.
+void blackbox_record_panic();
+#define PANIC_RECORD() blackbox_record_panic()
+#else
+#define PANIC_RECORD() (void)0
+#endif
+
 #define PANIC(...)       \
   ({                     \
+    PANIC_RECORD();      \
     printk(__VA_ARGS__); \
     k_panic();           \
   })
@@ -4,6 +4,8 @@
 
 #include <storage/flash_map.h>
 
+#include "flash_queue.h"
+
 #include <logging/log.h>
 #define LOG_LEVEL LOG_LEVEL_DBG
 LOG_MODULE_REGISTER(provisioning);
@@ -44,9 +46,19 @@ const ProvisioningData* provisioning_data_get() {
 static char provisioning_buffer[4096];
 static size_t provisioning_length;
 
+// Set while a flush is queued, to keep the buffer from being modified under it.
+static atomic_t provisioning_flushing;
+
+static ProvisioningStatus provisioning_state = ProvisioningStatus::Idle;
+static int provisioning_rc;
+
 bool provisioning_write(const void* data, size_t length, size_t offset) {
   LOG_INF("provisioning_write: [%zu, %zu)", offset, offset + length);
 
+  if (atomic_get(&provisioning_flushing)) {
+    LOG_ERR("flush in progress, aborting");
+    return false;
+  }
   if (length + offset > sizeof(provisioning_buffer)) {
     LOG_ERR("overflow, aborting");
     return false;
@@ -56,21 +68,77 @@ bool provisioning_write(const void* data, size_t length, size_t offset) {
   return true;
 }
 
+static void provisioning_flush_finish(int rc) {
+  {
+    ScopedIRQLock lock;
+    provisioning_rc = rc;
+    provisioning_state = rc == 0 ? ProvisioningStatus::Done : ProvisioningStatus::Failed;
+  }
+  atomic_set(&provisioning_flushing, 0);
+}
+
+// The write is queued after the erase, so it still runs (and fails) if the erase does: keep the
+// erase's error, since it's the cause.
+static void provisioning_erase_done(int rc, void*) {
+  if (rc != 0) {
+    ScopedIRQLock lock;
+    provisioning_rc = rc;
+  }
+}
+
+static void provisioning_flush_done(int rc, void*) {
+  int erase_rc;
+  {
+    ScopedIRQLock lock;
+    erase_rc = provisioning_rc;
+  }
+  if (erase_rc != 0) {
+    rc = erase_rc;
+  }
+
+  if (rc == 0) {
+    LOG_INF("provisioning_flush: done");
+  } else {
+    LOG_ERR("provisioning_flush: failed: rc = %d", rc);
+  }
+  provisioning_flush_finish(rc);
+}
+
+// The erase and write are handed off to the flash queue, so that they don't stall report writes.
 bool provisioning_flush() {
   LOG_INF("provisioning_flush: %zu bytes", provisioning_length);
-  const struct flash_area* flash_area;
-  if (flash_area_open(FLASH_AREA_ID(provisioning), &flash_area) != 0) {
-    LOG_ERR("provisioning_flush: failed to open flash area");
+  if (!atomic_cas(&provisioning_flushing, 0, 1)) {
+    LOG_ERR("provisioning_flush: flush already in progress");
     return false;
   }
-  if (flash_area_erase(flash_area, 0, FLASH_AREA_SIZE(provisioning)) != 0) {
-    LOG_ERR("provisioning_flush: failed to erase flash area");
+
+  {
+    ScopedIRQLock lock;
+    provisioning_rc = 0;
+    provisioning_state = ProvisioningStatus::Flushing;
+  }
+
+  if (!flash_queue_erase(FLASH_AREA_ID(provisioning), 0, FLASH_AREA_SIZE(provisioning),
+                         provisioning_erase_done)) {
+    LOG_ERR("provisioning_flush: failed to queue erase");
+    provisioning_flush_finish(-ENOMEM);
     return false;
   }
-  if (flash_area_write(flash_area, 0, &provisioning_buffer, provisioning_length) != 0) {
-    LOG_ERR("provisioning_flush: failed to write flash area");
+  if (!flash_queue_write(FLASH_AREA_ID(provisioning), 0, &provisioning_buffer,
+                         provisioning_length, provisioning_flush_done)) {
+    // The erase is already queued, so the partition is gone either way.
+    LOG_ERR("provisioning_flush: failed to queue write");
+    provisioning_flush_finish(-ENOMEM);
     return false;
   }
   return true;
 }
+
+ProvisioningStatus provisioning_status(int* rc) {
+  ScopedIRQLock lock;
+  if (rc) {
+    *rc = provisioning_rc;
+  }
+  return provisioning_state;
+}
 #endif
@@ -6,5 +6,18 @@
 void provisioning_init();
 const ProvisioningData* provisioning_data_get();
 
+enum class ProvisioningStatus : uint8_t {
+  Idle = 0,
+  Flushing = 1,
+  Done = 2,
+  Failed = 3,
+};
+
 bool provisioning_write(const void* data, size_t length, size_t offset);
+
+// Queue the accumulated writes to be flushed to flash. Returns false if they couldn't be queued:
+// whether the flush itself succeeded is reported by provisioning_status() once it's done.
 bool provisioning_flush();
+
+// The state of the latest flush, and the flash API's error if it failed.
+ProvisioningStatus provisioning_status(int* rc = nullptr);
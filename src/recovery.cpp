@@ -0,0 +1,184 @@
+#include "recovery.h"
+
+#include <zephyr.h>
+
+#include <fatal.h>
+#include <logging/log_ctrl.h>
+#include <power/reboot.h>
+#include <shell/shell.h>
+
+#include "arch.h"
+#include "input/profile.h"
+#include "metrics/blackbox.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(recovery);
+
+static constexpr uint32_t RECOVERY_MAGIC = 0x504c5243;    // PLRC
+static constexpr uint32_t RECOVERY_PENDING = 0x46415554;  // FAUT
+
+struct RecoveryState {
+  uint32_t magic;
+
+  // RECOVERY_PENDING if a fault happened and the next boot should recover.
+  uint32_t pending;
+
+  ProbeType probe;
+  uint32_t profile;
+
+  // Recoveries in a row that faulted again before sending a report.
+  uint32_t attempts;
+
+  // Successful recoveries, and the time to first report of the latest one.
+  uint32_t count;
+  uint32_t last_ms;
+};
+
+static RecoveryState recovery_state __attribute__((section(".noinit")));
+
+static bool recovering;
+static bool awaiting_report = true;
+
+// Set when this boot follows too many faults in a row without a report. Another fault before the
+// first report halts instead of rebooting, so that a fault at boot can't turn into a reboot loop.
+static bool exhausted;
+
+bool recovery_init() {
+  if (recovery_state.magic != RECOVERY_MAGIC) {
+    memset(&recovery_state, 0, sizeof(recovery_state));
+    recovery_state.magic = RECOVERY_MAGIC;
+    return false;
+  }
+
+  // Forget the previous mode, so that only a mode selected during this boot can be resumed.
+  ProbeType probe = recovery_state.probe;
+  memset(&recovery_state.probe, 0, sizeof(recovery_state.probe));
+
+  if (recovery_state.pending != RECOVERY_PENDING) {
+    return false;
+  }
+  recovery_state.pending = 0;
+
+  if (recovery_state.attempts > CONFIG_PASSINGLINK_FAULT_RECOVERY_MAX_ATTEMPTS) {
+    LOG_ERR("giving up after %u failed recoveries, starting from scratch and halting on the next "
+            "fault", recovery_state.attempts - 1);
+    exhausted = true;
+    return false;
+  }
+
+  recovering = true;
+  awaiting_report = true;
+  recovery_state.probe = probe;
+  if (recovery_state.profile < input_profile_count()) {
+    input_profile_activate(recovery_state.profile);
+  }
+
+  LOG_WRN("recovering from fault (attempt %u)", recovery_state.attempts);
+  return true;
+}
+
+void recovery_set_probe(ProbeType probe) {
+  recovery_state.probe = probe;
+}
+
+optional<ProbeType> recovery_get_probe() {
+  if (recovering && ProbeTypeIsValid(recovery_state.probe)) {
+    return recovery_state.probe;
+  }
+  return {};
+}
+
+bool recovery_pending() {
+  return recovery_state.pending == RECOVERY_PENDING;
+}
+
+// Stash everything needed to come back up. This runs from the fatal error handler, so it has to
+// be safe to call with interrupts locked in any context.
+static void recovery_prepare() {
+  recovery_state.profile = input_profile_get_active();
+  ++recovery_state.attempts;
+  recovery_state.pending = RECOVERY_PENDING;
+}
+
+// Out of attempts: stop where we are, with the logs flushed, like the default handler does. A
+// reset boots normally once more.
+[[noreturn]] static void recovery_halt(unsigned int reason) {
+  LOG_ERR("fault with no recovery attempts left, halting");
+  LOG_PANIC();
+  k_fatal_halt(reason);
+}
+
+void recovery_reboot() {
+  if (exhausted) {
+    recovery_halt(K_ERR_KERNEL_OOPS);
+  }
+  recovery_prepare();
+  reboot();
+}
+
+void recovery_report_written() {
+  if (!awaiting_report) {
+    return;
+  }
+  awaiting_report = false;
+
+  // Reports are going out, so whatever faulted before isn't fatal at boot: recover from the next
+  // fault as usual.
+  recovery_state.attempts = 0;
+  exhausted = false;
+  if (!recovering) {
+    return;
+  }
+
+  uint32_t elapsed_ms = k_uptime_get_32();
+  recovery_state.last_ms = elapsed_ms;
+  ++recovery_state.count;
+  blackbox_record(BlackboxEvent::Recovered, 0, min<uint32_t>(elapsed_ms, UINT16_MAX));
+
+  if (elapsed_ms > CONFIG_PASSINGLINK_FAULT_RECOVERY_BUDGET_MS) {
+    LOG_WRN("recovered in %u ms, over budget of %u ms", elapsed_ms,
+            CONFIG_PASSINGLINK_FAULT_RECOVERY_BUDGET_MS);
+  } else {
+    LOG_INF("recovered in %u ms", elapsed_ms);
+  }
+}
+
+// Overrides the default handler, which halts the system.
+void k_sys_fatal_error_handler(unsigned int reason, const z_arch_esf_t*) {
+  blackbox_record(BlackboxEvent::Fault, reason);
+  if (exhausted) {
+    recovery_halt(reason);
+  }
+  recovery_prepare();
+
+  // The system work queue might be what faulted, so reboot() can't be used. Skip LOG_PANIC,
+  // which would synchronously flush the log backends.
+  sys_reboot(SYS_REBOOT_WARM);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_recovery(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 2 && strcmp(argv[1], "fault") == 0) {
+    k_oops();
+    return 0;
+  } else if (argc == 2 && strcmp(argv[1], "reboot") == 0) {
+    recovery_reboot();
+    return 0;
+  } else if (argc != 1) {
+    shell_print(shell, "usage: recovery [fault | reboot]");
+    return 0;
+  }
+
+  if (recovery_state.count == 0) {
+    shell_print(shell, "recovery: no recoveries");
+  } else {
+    shell_print(shell, "recovery: %u recoveries, last took %u ms (budget %u ms)",
+                recovery_state.count, recovery_state.last_ms,
+                CONFIG_PASSINGLINK_FAULT_RECOVERY_BUDGET_MS);
+  }
+  return 0;
+}
+
+SHELL_CMD_REGISTER(recovery, NULL, "Show or test fault recovery", cmd_recovery);
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "output/usb/probe_type.h"
+#include "types.h"
+
+// Fast recovery from faults.
+//
+// The selected console mode and active profile are kept in .noinit RAM. When a fault happens,
+// the fatal error handler marks them as pending and reboots immediately, without waiting for
+// logs to be flushed. The next boot skips probing and comes straight back up in the same mode.
+// Faults that keep happening before the first report are given up on after
+// CONFIG_PASSINGLINK_FAULT_RECOVERY_MAX_ATTEMPTS: one more boot starts from scratch, and if that
+// faults too, the system halts rather than rebooting forever.
+//
+// Recovery time is measured from boot to the first report written, and reported against
+// CONFIG_PASSINGLINK_FAULT_RECOVERY_BUDGET_MS. Time spent in reset and in the bootloader isn't
+// visible to us and isn't included.
+#if defined(CONFIG_PASSINGLINK_FAULT_RECOVERY)
+
+// Consume the state left behind by a fault. Returns true if this boot is a recovery.
+bool recovery_init();
+
+// Remember the console mode that's been selected, to return to it after a fault.
+void recovery_set_probe(ProbeType probe);
+
+// The console mode to resume, if this boot is a recovery.
+optional<ProbeType> recovery_get_probe();
+
+// Whether a fault has been recorded, and the next boot will be a recovery.
+bool recovery_pending();
+
+// Reboot after a fault detected in thread context.
+void recovery_reboot();
+
+// Called after every report written, to measure the time to the first one after a recovery.
+void recovery_report_written();
+
+#else
+
+inline bool recovery_init() {
+  return false;
+}
+
+inline void recovery_set_probe(ProbeType) {}
+
+inline optional<ProbeType> recovery_get_probe() {
+  return {};
+}
+
+inline bool recovery_pending() {
+  return false;
+}
+
+inline void recovery_reboot() {}
+
+inline void recovery_report_written() {}
+
+#endif
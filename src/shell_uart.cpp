@@ -0,0 +1,270 @@
+#include "shell_uart.h"
+
+#include <zephyr.h>
+
+#include <drivers/uart.h>
+#include <shell/shell.h>
+#include <sys/ring_buffer.h>
+
+#include "types.h"
+
+#include <logging/log.h>
+#define LOG_LEVEL LOG_LEVEL_INF
+LOG_MODULE_REGISTER(shell_uart);
+
+// A shell transport on top of the asynchronous UART API.
+//
+// Output is copied into a ring buffer, and sent from there by DMA, up to
+// CONFIG_PASSINGLINK_SHELL_UART_TX_CHUNK bytes per transfer. When the ring is full, the shell
+// thread waits for a transfer to finish instead of spinning. Input is received by DMA into a pair
+// of small buffers, and copied into a ring that the shell thread reads from.
+//
+// Nothing in here may log, since log output comes back through the transport.
+
+#define SHELL_UART_RX_CHUNK 16
+#define SHELL_UART_RX_TIMEOUT_MS 10
+
+static const struct device* uart_device;
+static shell_transport_handler_t shell_handler;
+static void* shell_context;
+
+RING_BUF_DECLARE(tx_ring, CONFIG_PASSINGLINK_SHELL_UART_TX_BUFFER_SIZE);
+RING_BUF_DECLARE(rx_ring, CONFIG_PASSINGLINK_SHELL_UART_RX_BUFFER_SIZE);
+
+// Length of the transfer in flight, or 0 if the UART is idle.
+static size_t tx_length;
+
+// Once the log switches to panic mode, output is written synchronously.
+static bool tx_blocking;
+
+K_SEM_DEFINE(tx_idle, 0, 1);
+
+static uint8_t rx_buffers[2][SHELL_UART_RX_CHUNK];
+static size_t rx_next_buffer;
+
+static struct {
+  uint32_t tx_bytes;
+  uint32_t tx_transfers;
+  uint32_t tx_full;
+  uint32_t rx_bytes;
+  uint32_t rx_dropped;
+} stats;
+
+// Called with interrupts locked.
+static void shell_uart_tx_start() {
+  if (tx_length != 0 || tx_blocking) {
+    return;
+  }
+
+  uint8_t* data;
+  size_t length = ring_buf_get_claim(&tx_ring, &data, CONFIG_PASSINGLINK_SHELL_UART_TX_CHUNK);
+  if (length == 0) {
+    k_sem_give(&tx_idle);
+    return;
+  }
+
+  if (uart_tx(uart_device, data, length, SYS_FOREVER_MS) != 0) {
+    // Drop the output rather than retrying it forever.
+    ring_buf_get_finish(&tx_ring, length);
+    k_sem_give(&tx_idle);
+    return;
+  }
+  tx_length = length;
+  ++stats.tx_transfers;
+}
+
+static void shell_uart_rx_start() {
+  rx_next_buffer = 1;
+  uart_rx_enable(uart_device, rx_buffers[0], sizeof(rx_buffers[0]), SHELL_UART_RX_TIMEOUT_MS);
+}
+
+static void shell_uart_callback(const struct device*, struct uart_event* event, void*) {
+  switch (event->type) {
+    case UART_TX_DONE:
+    case UART_TX_ABORTED: {
+      ScopedIRQLock lock;
+      if (tx_length == 0) {
+        // A transfer that was abandoned when switching to blocking mode.
+        break;
+      }
+      ring_buf_get_finish(&tx_ring, tx_length);
+      stats.tx_bytes += tx_length;
+      tx_length = 0;
+      shell_uart_tx_start();
+      shell_handler(SHELL_TRANSPORT_EVT_TX_RDY, shell_context);
+      break;
+    }
+
+    case UART_RX_RDY: {
+      size_t length = event->data.rx.len;
+      size_t written = ring_buf_put(&rx_ring, event->data.rx.buf + event->data.rx.offset, length);
+      stats.rx_bytes += written;
+      stats.rx_dropped += length - written;
+      shell_handler(SHELL_TRANSPORT_EVT_RX_RDY, shell_context);
+      break;
+    }
+
+    case UART_RX_BUF_REQUEST:
+      uart_rx_buf_rsp(uart_device, rx_buffers[rx_next_buffer], sizeof(rx_buffers[0]));
+      rx_next_buffer ^= 1;
+      break;
+
+    case UART_RX_DISABLED:
+      // Reception stops on errors (e.g. a break from the other end): start it back up.
+      shell_uart_rx_start();
+      break;
+
+    default:
+      break;
+  }
+}
+
+static int shell_uart_init(const struct shell_transport*, const void* config,
+                           shell_transport_handler_t handler, void* context) {
+  uart_device = static_cast<const struct device*>(config);
+  shell_handler = handler;
+  shell_context = context;
+
+  int rc = uart_callback_set(uart_device, shell_uart_callback, nullptr);
+  if (rc != 0) {
+    return rc;
+  }
+  shell_uart_rx_start();
+  return 0;
+}
+
+static int shell_uart_uninit(const struct shell_transport*) {
+  uart_rx_disable(uart_device);
+  return 0;
+}
+
+static int shell_uart_enable(const struct shell_transport*, bool blocking_tx) {
+  if (!blocking_tx) {
+    return 0;
+  }
+
+  // Abandon the transfer in flight, and send everything that's still queued (including whatever
+  // part of that transfer was already sent) synchronously, so that it isn't lost if we're about to
+  // go down.
+  ScopedIRQLock lock;
+  tx_blocking = true;
+  if (tx_length != 0) {
+    uart_tx_abort(uart_device);
+    ring_buf_get_finish(&tx_ring, 0);
+    tx_length = 0;
+  }
+
+  uint8_t c;
+  while (ring_buf_get(&tx_ring, &c, 1) == 1) {
+    uart_poll_out(uart_device, c);
+  }
+  return 0;
+}
+
+static int shell_uart_write(const struct shell_transport*, const void* data, size_t length,
+                            size_t* count) {
+  if (tx_blocking) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i) {
+      uart_poll_out(uart_device, p[i]);
+    }
+    *count = length;
+    return 0;
+  }
+
+  ScopedIRQLock lock;
+  *count = ring_buf_put(&tx_ring, static_cast<const uint8_t*>(data), length);
+  stats.tx_full += *count < length;
+  if (*count != 0) {
+    k_sem_reset(&tx_idle);
+    shell_uart_tx_start();
+  }
+  return 0;
+}
+
+static int shell_uart_read(const struct shell_transport*, void* data, size_t length,
+                           size_t* count) {
+  ScopedIRQLock lock;
+  *count = ring_buf_get(&rx_ring, static_cast<uint8_t*>(data), length);
+  return 0;
+}
+
+static const struct shell_transport_api shell_uart_api = {
+  .init = shell_uart_init,
+  .uninit = shell_uart_uninit,
+  .enable = shell_uart_enable,
+  .write = shell_uart_write,
+  .read = shell_uart_read,
+  .update = nullptr,
+};
+
+static struct shell_transport shell_uart_transport = {
+  .api = &shell_uart_api,
+  .ctx = nullptr,
+};
+
+SHELL_DEFINE(shell_uart_async, "uart:~$ ", &shell_uart_transport,
+             CONFIG_PASSINGLINK_SHELL_UART_LOG_QUEUE_SIZE, 0, SHELL_FLAG_OLF_CRLF);
+
+bool shell_uart_flush(k_timeout_t timeout) {
+  {
+    ScopedIRQLock lock;
+    if (tx_length == 0 && ring_buf_is_empty(&tx_ring)) {
+      return true;
+    }
+  }
+  return k_sem_take(&tx_idle, timeout) == 0;
+}
+
+static int shell_uart_enable_shell(const struct device*) {
+  const struct device* device = device_get_binding(DT_LABEL(DT_CHOSEN(zephyr_shell_uart)));
+  if (!device) {
+    return -ENODEV;
+  }
+
+#if defined(CONFIG_LOG)
+  bool log_backend = true;
+  uint32_t log_level = CONFIG_LOG_MAX_LEVEL;
+#else
+  bool log_backend = false;
+  uint32_t log_level = 0;
+#endif
+  int rc = shell_init(&shell_uart_async, device, true, log_backend, log_level);
+  if (rc != 0) {
+    return rc;
+  }
+
+  // Keep shell sessions and log formatting from preempting anything else.
+  k_thread_priority_set(shell_uart_async.ctx->tid, K_LOWEST_APPLICATION_THREAD_PRIO);
+  return 0;
+}
+
+SYS_INIT(shell_uart_enable_shell, POST_KERNEL, 0);
+
+// Log a burst of messages, to see how streaming logs affects report timing (e.g. with the metrics
+// latency histogram), and show how the transport kept up.
+static int cmd_shell_uart(const struct shell* shell, size_t argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "stream") == 0) {
+    uint32_t count = strtoul(argv[2], nullptr, 10);
+    for (uint32_t i = 0; i < count; ++i) {
+      LOG_INF("shell_uart stream: message %u of %u", i + 1, count);
+    }
+    return 0;
+  } else if (argc != 1) {
+    shell_print(shell, "usage: shell_uart [stream COUNT]");
+    return 0;
+  }
+
+  decltype(stats) copy;
+  {
+    ScopedIRQLock lock;
+    copy = stats;
+  }
+  shell_print(shell, "shell_uart: tx %u bytes in %u transfers, buffer full %u times", copy.tx_bytes,
+              copy.tx_transfers, copy.tx_full);
+  shell_print(shell, "  rx %u bytes, %u dropped", copy.rx_bytes, copy.rx_dropped);
+  return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(shell_uart, NULL, "Show async UART shell statistics, or stream logs",
+                       cmd_shell_uart, 1, 2);
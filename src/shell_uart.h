@@ -0,0 +1,13 @@
+#pragma once
+
+#include <kernel.h>
+
+#if defined(CONFIG_PASSINGLINK_SHELL_UART_ASYNC)
+// Wait for everything written to the shell so far to go out over the wire. Returns false if the
+// timeout expired first.
+bool shell_uart_flush(k_timeout_t timeout);
+#else
+inline bool shell_uart_flush(k_timeout_t) {
+  return true;
+}
+#endif
@@ -59,6 +59,49 @@ struct atomic_u32 {
   atomic_t value_ = 0;
 };
 
+// Single-writer sequence lock, for values that are too large for atomic_u32.
+//
+// The value is double buffered: store() fills in the slot that readers aren't being pointed at,
+// and then bumps the sequence number to publish it. Neither side ever blocks or takes a lock, so
+// a reader can safely preempt the writer (or vice versa). A load() only retries if a store()
+// completed while it was copying, which can only happen if the writer preempted the reader.
+//
+// store() must only ever be called from one context at a time.
+template <typename T>
+struct seqlock {
+  static_assert(__is_trivially_copyable(T));
+  static_assert(__has_trivial_destructor(T));
+
+  seqlock() : sequence_(0), values_() {}
+  explicit seqlock(const T& t) : sequence_(0), values_{t, t} {}
+
+  T load() const {
+    while (true) {
+      uint32_t sequence = atomic_get(&sequence_);
+      T result;
+      memcpy(&result, &values_[sequence & 1], sizeof(T));
+
+      // Don't let the copy get reordered past the second read of the sequence number.
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (static_cast<uint32_t>(atomic_get(&sequence_)) == sequence) {
+        return result;
+      }
+    }
+  }
+
+  void store(const T& value) {
+    uint32_t sequence = atomic_get(&sequence_) + 1;
+    memcpy(&values_[sequence & 1], &value, sizeof(T));
+
+    // atomic_set is sequentially consistent, so the copy above is visible before the sequence.
+    atomic_set(&sequence_, sequence);
+  }
+
+ private:
+  atomic_t sequence_;
+  T values_[2];
+};
+
 template <typename T>
 struct __attribute__((packed)) optional {
   optional() {}
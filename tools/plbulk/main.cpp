@@ -0,0 +1,212 @@
+// Reads a diagnostics source out of a device over the bulk feature report (CONFIG_PASSINGLINK_BULK,
+// see output/usb/bulk.h), through Linux hidraw.
+//
+// Every chunk is checked against its CRC, and read again with a Seek if it doesn't match. The
+// snapshot is written out as is, except for the scheduling trace, which can be converted into the
+// text format that tools/schedsim reads with --schedsim.
+//
+// Usage: plbulk [--schedsim] [--chunk BYTES] /dev/hidrawN metrics|counters|sched|blackbox OUTPUT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/hidraw.h>
+#include <sys/ioctl.h>
+
+#include <string>
+#include <vector>
+
+#include "metrics/sched_trace.h"
+#include "output/usb/bulk.h"
+
+static constexpr uint8_t BULK_REPORT_ID = 0x48;
+static constexpr int MAX_RETRIES = 8;
+
+static uint32_t crc32_ieee(const uint8_t* data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static bool bulk_set(int fd, BulkOp op, BulkSource source, uint32_t offset) {
+  BulkRequest request = {};
+  request.report_id = BULK_REPORT_ID;
+  request.op = static_cast<uint8_t>(op);
+  request.source = static_cast<uint8_t>(source);
+  request.offset = offset;
+  if (ioctl(fd, HIDIOCSFEATURE(sizeof(request)), &request) < 0) {
+    fprintf(stderr, "plbulk: set feature report failed: %s\n", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool usage() {
+  fprintf(stderr,
+          "usage: plbulk [--schedsim] [--chunk BYTES] /dev/hidrawN "
+          "metrics|counters|sched|blackbox OUTPUT\n");
+  return false;
+}
+
+static bool write_schedsim(FILE* out, const std::vector<uint8_t>& data) {
+  SchedTraceHeader header;
+  if (data.size() < sizeof(header)) {
+    fprintf(stderr, "plbulk: scheduling trace is missing its header\n");
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (data.size() != sizeof(header) + header.count * sizeof(SchedTraceEntry)) {
+    fprintf(stderr, "plbulk: scheduling trace has %zu bytes, expected %u entries\n", data.size(),
+            header.count);
+    return false;
+  }
+
+  fprintf(out, "# passinglink sched_trace\n");
+  fprintf(out, "rate %u\n", header.rate);
+  fprintf(out, "nominal %u\n", header.nominal_ticks);
+  fprintf(out, "timing %u %u %u\n", header.strategy, header.flags, header.delay_ticks);
+  for (uint32_t i = 0; i < header.count; ++i) {
+    SchedTraceEntry entry;
+    memcpy(&entry, data.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+    if (entry.event == SchedTraceEvent::Build) {
+      fprintf(out, "%c %u %u\n", static_cast<char>(entry.event), entry.tick, entry.value);
+    } else {
+      fprintf(out, "%c %u\n", static_cast<char>(entry.event), entry.tick);
+    }
+  }
+  return true;
+}
+
+static bool run(int argc, char** argv) {
+  bool schedsim = false;
+  size_t chunk = 4096;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--schedsim") == 0) {
+      schedsim = true;
+    } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+      chunk = strtoul(argv[++i], nullptr, 0);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  if (args.size() != 3) {
+    return usage();
+  }
+
+  BulkSource source;
+  if (args[1] == "metrics") {
+    source = BulkSource::MetricsTrace;
+  } else if (args[1] == "counters") {
+    source = BulkSource::MetricsCounters;
+  } else if (args[1] == "sched") {
+    source = BulkSource::SchedTrace;
+  } else if (args[1] == "blackbox") {
+    source = BulkSource::Blackbox;
+  } else {
+    return usage();
+  }
+  if (schedsim && source != BulkSource::SchedTrace) {
+    fprintf(stderr, "plbulk: --schedsim only applies to the scheduling trace\n");
+    return false;
+  }
+
+  int fd = open(args[0].c_str(), O_RDWR);
+  if (fd < 0) {
+    fprintf(stderr, "plbulk: failed to open %s: %s\n", args[0].c_str(), strerror(errno));
+    return false;
+  }
+
+  if (!bulk_set(fd, BulkOp::Open, source, 0)) {
+    close(fd);
+    return false;
+  }
+
+  // The kernel caps the transfer at our buffer, and the device at its chunk size: ask for as much
+  // as either could hold.
+  std::vector<uint8_t> buf(sizeof(BulkResponse) + chunk);
+  std::vector<uint8_t> data;
+  int retries = 0;
+  bool ok = false;
+  while (true) {
+    buf[0] = BULK_REPORT_ID;
+    int rc = ioctl(fd, HIDIOCGFEATURE(buf.size()), buf.data());
+    if (rc < 0) {
+      fprintf(stderr, "plbulk: get feature report failed: %s\n", strerror(errno));
+      break;
+    }
+
+    BulkResponse response;
+    if (static_cast<size_t>(rc) < sizeof(response)) {
+      fprintf(stderr, "plbulk: short response (%d bytes)\n", rc);
+      break;
+    }
+    memcpy(&response, buf.data(), sizeof(response));
+
+    BulkStatus status = static_cast<BulkStatus>(response.status);
+    if (status == BulkStatus::Closed) {
+      fprintf(stderr, "plbulk: device closed the readout\n");
+      break;
+    } else if (status == BulkStatus::End) {
+      ok = data.size() == response.total;
+      if (!ok) {
+        fprintf(stderr, "plbulk: ended at %zu of %u bytes\n", data.size(), response.total);
+      }
+      break;
+    }
+
+    const uint8_t* chunk_data = buf.data() + sizeof(response);
+    bool valid = response.offset == data.size() &&
+                 sizeof(response) + response.length <= static_cast<size_t>(rc) &&
+                 crc32_ieee(chunk_data, response.length) == response.crc;
+    if (!valid) {
+      if (++retries > MAX_RETRIES) {
+        fprintf(stderr, "plbulk: giving up on the chunk at offset %zu\n", data.size());
+        break;
+      }
+      fprintf(stderr, "plbulk: bad chunk at offset %u, retrying\n", response.offset);
+      if (!bulk_set(fd, BulkOp::Seek, source, data.size())) {
+        break;
+      }
+      continue;
+    }
+
+    retries = 0;
+    data.insert(data.end(), chunk_data, chunk_data + response.length);
+    fprintf(stderr, "\rplbulk: %zu/%u bytes", data.size(), response.total);
+  }
+  fprintf(stderr, "\n");
+
+  bulk_set(fd, BulkOp::Close, source, 0);
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+
+  FILE* out = fopen(args[2].c_str(), schedsim ? "w" : "wb");
+  if (!out) {
+    fprintf(stderr, "plbulk: failed to open %s: %s\n", args[2].c_str(), strerror(errno));
+    return false;
+  }
+  if (schedsim) {
+    ok = write_schedsim(out, data);
+  } else {
+    ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+  }
+  fclose(out);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  return run(argc, argv) ? 0 : 1;
+}
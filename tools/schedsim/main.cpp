@@ -0,0 +1,439 @@
+// Replays a report scheduling trace captured on the device (CONFIG_PASSINGLINK_SCHED_TRACE,
+// `sched_trace dump`) against candidate scheduling policies, and ranks them by the latency from a
+// button edge to the host collecting the first report that includes it.
+//
+// The policies are the firmware's own: output/usb/timing.h decides when each report gets built,
+// and learns the host's poll interval, exactly as it does on the device. The trace supplies
+// everything else:
+//   - host polls: when the host collected a report. Polls that the device missed aren't visible in
+//     the trace, so they're filled back in on the grid of the fastest observed interval.
+//   - edges: when a button changed state, sampled on a timer of its own rather than when reports
+//     were built, so that they don't favor the recorded policy. They're upper bounds: the change
+//     happened up to one sampling interval (CONFIG_PASSINGLINK_SCHED_TRACE_EDGE_US) earlier, which
+//     adds the same amount to every policy's latencies on average.
+//   - builds: how long each report took to build, replayed in order, and how late deferred builds
+//     started relative to their scheduled time (work queue wakeup latency).
+//
+// Usage: schedsim [--policy POLICY]... [--wake-us US] [--top N] [--histogram] TRACE
+//   POLICY is `immediate`, or `deferred:TICKS` with an optional `:poll_aware` suffix. Without any,
+//   immediate and every deferred delay from 0 to the nominal poll interval are tried, with and
+//   without poll awareness.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "output/usb/timing.h"
+
+struct Trace {
+  uint32_t rate = 0;
+  uint32_t nominal_ticks = 0;
+  HidTiming timing = {};
+
+  // Unwrapped k_uptime_ticks().
+  std::vector<uint64_t> polls;
+  std::vector<uint64_t> edges;
+
+  struct Build {
+    uint64_t tick;
+    uint32_t us;
+  };
+  std::vector<Build> builds;
+};
+
+struct Replay {
+  // Host poll times, including the ones that the device missed, in microseconds.
+  std::vector<double> polls;
+  std::vector<double> edges;
+  std::vector<double> build_us;
+  std::vector<double> wake_us;
+  double host_interval_us = 0;
+};
+
+struct Policy {
+  std::string name;
+  HidTiming timing;
+};
+
+struct Result {
+  const Policy* policy;
+  std::vector<double> latencies_us;
+
+  // missed_polls[n]: number of reports that went out after missing n polls, with the last bucket
+  // holding everything from there on.
+  std::vector<uint32_t> missed_polls = std::vector<uint32_t>(4);
+  uint32_t total_missed = 0;
+
+  double mean() const {
+    double sum = 0;
+    for (double latency : latencies_us) {
+      sum += latency;
+    }
+    return latencies_us.empty() ? 0 : sum / latencies_us.size();
+  }
+
+  double percentile(double p) const {
+    if (latencies_us.empty()) {
+      return 0;
+    }
+    size_t index = std::min(latencies_us.size() - 1, static_cast<size_t>(p * latencies_us.size()));
+    return latencies_us[index];
+  }
+};
+
+static bool parse_trace(const char* path, Trace* trace) {
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "schedsim: failed to open %s\n", path);
+    return false;
+  }
+
+  uint32_t last_tick = 0;
+  uint64_t epoch = 0;
+  bool first = true;
+  auto unwrap = [&](uint32_t tick) {
+    if (!first && tick < last_tick && last_tick - tick > UINT32_MAX / 2) {
+      epoch += uint64_t(1) << 32;
+    }
+    first = false;
+    last_tick = tick;
+    return epoch + tick;
+  };
+
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    ++line_number;
+
+    // Tolerate whatever the terminal put around the shell output.
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos || line[begin] == '#') {
+      continue;
+    }
+    std::istringstream fields(line.substr(begin));
+    std::string type;
+    fields >> type;
+
+    bool ok = true;
+    if (type == "rate") {
+      ok = static_cast<bool>(fields >> trace->rate);
+    } else if (type == "nominal") {
+      ok = static_cast<bool>(fields >> trace->nominal_ticks);
+    } else if (type == "timing") {
+      unsigned strategy, flags, delay_ticks;
+      ok = static_cast<bool>(fields >> strategy >> flags >> delay_ticks);
+      trace->timing.strategy = static_cast<HidTimingStrategy>(strategy);
+      trace->timing.flags = flags;
+      trace->timing.delay_ticks = delay_ticks;
+    } else if (type == "P" || type == "E") {
+      uint32_t tick;
+      ok = static_cast<bool>(fields >> tick);
+      (type == "P" ? trace->polls : trace->edges).push_back(unwrap(tick));
+    } else if (type == "B") {
+      uint32_t tick, us;
+      ok = static_cast<bool>(fields >> tick >> us);
+      trace->builds.push_back({unwrap(tick), us});
+    } else {
+      continue;
+    }
+
+    if (!ok) {
+      fprintf(stderr, "schedsim: %s:%zu: malformed line: %s\n", path, line_number, line.c_str());
+      return false;
+    }
+  }
+
+  if (trace->rate == 0 || trace->nominal_ticks == 0) {
+    fprintf(stderr, "schedsim: %s: missing rate or nominal interval\n", path);
+    return false;
+  }
+  if (trace->polls.size() < 2 || trace->builds.empty()) {
+    fprintf(stderr, "schedsim: %s: not enough polls or builds to replay\n", path);
+    return false;
+  }
+  return true;
+}
+
+static Replay prepare_replay(const Trace& trace) {
+  Replay replay;
+  auto to_us = [&](uint64_t ticks) { return ticks * 1e6 / trace.rate; };
+
+  uint64_t min_gap = UINT64_MAX;
+  for (size_t i = 1; i < trace.polls.size(); ++i) {
+    if (trace.polls[i] > trace.polls[i - 1]) {
+      min_gap = std::min(min_gap, trace.polls[i] - trace.polls[i - 1]);
+    }
+  }
+  replay.host_interval_us = to_us(min_gap);
+
+  replay.polls.push_back(to_us(trace.polls[0]));
+  for (size_t i = 1; i < trace.polls.size(); ++i) {
+    double begin = to_us(trace.polls[i - 1]);
+    double end = to_us(trace.polls[i]);
+    size_t missed = static_cast<size_t>((end - begin) / replay.host_interval_us + 0.5);
+    for (size_t j = 1; j < missed; ++j) {
+      replay.polls.push_back(begin + (end - begin) * j / missed);
+    }
+    replay.polls.push_back(end);
+  }
+
+  for (uint64_t edge : trace.edges) {
+    replay.edges.push_back(to_us(edge));
+  }
+
+  // Work out how late each deferred build started, by running the recorded policy over the
+  // recorded polls.
+  HidPollEstimator poll(trace.nominal_ticks);
+  size_t next_poll = 0;
+  uint64_t scheduled = 0;
+  for (const Trace::Build& build : trace.builds) {
+    replay.build_us.push_back(build.us);
+
+    bool polled = false;
+    while (next_poll < trace.polls.size() && trace.polls[next_poll] <= build.tick) {
+      poll.record(static_cast<uint32_t>(trace.polls[next_poll]));
+      scheduled = trace.polls[next_poll] +
+                  hid_timing_write_delay_ticks(trace.timing, poll.extra_delay_ticks());
+      polled = true;
+      ++next_poll;
+    }
+
+    if (polled && trace.timing.strategy != HidTimingStrategy::Immediate) {
+      replay.wake_us.push_back(build.tick > scheduled ? to_us(build.tick - scheduled) : 0);
+    }
+  }
+  return replay;
+}
+
+static Result simulate(const Replay& replay, const Policy& policy, uint32_t rate,
+                       uint32_t nominal_ticks, double wake_override_us) {
+  Result result;
+  result.policy = &policy;
+
+  auto to_us = [&](uint32_t ticks) { return ticks * 1e6 / rate; };
+  auto to_ticks = [&](double us) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(us * rate / 1e6));
+  };
+
+  HidPollEstimator poll(nominal_ticks);
+  size_t next_build = 0;
+  size_t next_wake = 0;
+  size_t next_edge = 0;
+
+  double sample_us = 0;
+  double ready_us = 0;
+  double previous_sample_us = replay.polls[0];
+  uint32_t missed = 0;
+
+  auto schedule = [&](double now_us) {
+    double start_us = now_us;
+    if (policy.timing.strategy != HidTimingStrategy::Immediate) {
+      start_us += to_us(hid_timing_write_delay_ticks(policy.timing, poll.extra_delay_ticks()));
+      if (wake_override_us >= 0) {
+        start_us += wake_override_us;
+      } else if (!replay.wake_us.empty()) {
+        start_us += replay.wake_us[next_wake++ % replay.wake_us.size()];
+      }
+    }
+    sample_us = start_us;
+    ready_us = start_us + replay.build_us[next_build++ % replay.build_us.size()];
+  };
+
+  while (next_edge < replay.edges.size() && replay.edges[next_edge] <= previous_sample_us) {
+    ++next_edge;
+  }
+
+  poll.record(to_ticks(replay.polls[0]));
+  schedule(replay.polls[0]);
+  for (size_t i = 1; i < replay.polls.size(); ++i) {
+    double poll_us = replay.polls[i];
+    if (ready_us > poll_us) {
+      ++missed;
+      ++result.total_missed;
+      continue;
+    }
+
+    while (next_edge < replay.edges.size() && replay.edges[next_edge] <= sample_us) {
+      result.latencies_us.push_back(poll_us - replay.edges[next_edge]);
+      ++next_edge;
+    }
+    previous_sample_us = sample_us;
+    ++result.missed_polls[std::min<size_t>(missed, result.missed_polls.size() - 1)];
+    missed = 0;
+
+    poll.record(to_ticks(poll_us));
+    schedule(poll_us);
+  }
+
+  std::sort(result.latencies_us.begin(), result.latencies_us.end());
+  return result;
+}
+
+static bool parse_policy(const char* arg, Policy* out) {
+  out->name = arg;
+  out->timing = {};
+  if (strcmp(arg, "immediate") == 0) {
+    out->timing.strategy = HidTimingStrategy::Immediate;
+    return true;
+  }
+
+  unsigned delay_ticks;
+  char suffix[16] = {};
+  int n = sscanf(arg, "deferred:%u:%15s", &delay_ticks, suffix);
+  if (n < 1 || (n == 2 && strcmp(suffix, "poll_aware") != 0) || delay_ticks > UINT16_MAX) {
+    return false;
+  }
+  out->timing.strategy = HidTimingStrategy::Deferred;
+  out->timing.delay_ticks = delay_ticks;
+  out->timing.flags = n == 2 ? HID_TIMING_POLL_AWARE : 0;
+  return true;
+}
+
+static std::string policy_name(const HidTiming& timing) {
+  if (timing.strategy == HidTimingStrategy::Immediate) {
+    return "immediate";
+  }
+  std::string name = "deferred:" + std::to_string(timing.delay_ticks);
+  if (timing.flags & HID_TIMING_POLL_AWARE) {
+    name += ":poll_aware";
+  }
+  return name;
+}
+
+static void print_histogram(const Result& result) {
+  // Powers of two in microseconds, like the firmware's latency histogram is in ticks.
+  std::vector<uint32_t> buckets(16);
+  for (double latency : result.latencies_us) {
+    size_t bucket = 0;
+    for (uint64_t us = static_cast<uint64_t>(latency); us != 0 && bucket < buckets.size() - 1;
+         us >>= 1) {
+      ++bucket;
+    }
+    ++buckets[bucket];
+  }
+
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    if (buckets[i] == 0) {
+      continue;
+    }
+    uint32_t low = i == 0 ? 0 : 1u << (i - 1);
+    printf("    [%6u, %6u) us: %u\n", low, 1u << i, buckets[i]);
+  }
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: schedsim [--policy POLICY]... [--wake-us US] [--top N] [--histogram] TRACE\n"
+          "  POLICY: immediate | deferred:TICKS[:poll_aware]\n");
+}
+
+int main(int argc, char** argv) {
+  std::vector<Policy> policies;
+  const char* trace_path = nullptr;
+  double wake_override_us = -1;
+  size_t top = 10;
+  bool histogram = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+      Policy policy;
+      if (!parse_policy(argv[++i], &policy)) {
+        fprintf(stderr, "schedsim: invalid policy: %s\n", argv[i]);
+        usage();
+        return 1;
+      }
+      policies.push_back(policy);
+    } else if (strcmp(argv[i], "--wake-us") == 0 && i + 1 < argc) {
+      wake_override_us = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      top = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--histogram") == 0) {
+      histogram = true;
+    } else if (argv[i][0] != '-' && !trace_path) {
+      trace_path = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (!trace_path) {
+    usage();
+    return 1;
+  }
+
+  Trace trace;
+  if (!parse_trace(trace_path, &trace)) {
+    return 1;
+  }
+
+  if (policies.empty()) {
+    policies.push_back({"immediate", {HidTimingStrategy::Immediate, 0, 0}});
+    for (uint32_t delay = 0; delay <= trace.nominal_ticks; ++delay) {
+      for (uint8_t flags : {uint8_t(0), uint8_t(HID_TIMING_POLL_AWARE)}) {
+        HidTiming timing = {HidTimingStrategy::Deferred, flags, static_cast<uint16_t>(delay)};
+        policies.push_back({policy_name(timing), timing});
+      }
+    }
+  }
+
+  Replay replay = prepare_replay(trace);
+
+  std::vector<double> build_us = replay.build_us;
+  std::sort(build_us.begin(), build_us.end());
+  printf("trace: %zu host polls (%zu missed by the device), %zu edges, %zu builds\n",
+         replay.polls.size(), replay.polls.size() - trace.polls.size(), replay.edges.size(),
+         replay.build_us.size());
+  printf("host interval: %.0f us, build: median = %.0f us, max = %.0f us\n",
+         replay.host_interval_us, build_us[build_us.size() / 2], build_us.back());
+  if (wake_override_us >= 0) {
+    printf("deferred wakeup latency: %.0f us (--wake-us)\n", wake_override_us);
+  } else if (!replay.wake_us.empty()) {
+    std::vector<double> wake_us = replay.wake_us;
+    std::sort(wake_us.begin(), wake_us.end());
+    printf("deferred wakeup latency: median = %.0f us, max = %.0f us\n",
+           wake_us[wake_us.size() / 2], wake_us.back());
+  } else {
+    printf("deferred wakeup latency: unknown (the trace wasn't deferred), assuming 0\n");
+  }
+  printf("recorded with: %s\n\n", policy_name(trace.timing).c_str());
+
+  if (replay.edges.empty()) {
+    fprintf(stderr, "schedsim: no edges in the trace, nothing to rank by\n");
+    return 1;
+  }
+
+  std::vector<Result> results;
+  for (const Policy& policy : policies) {
+    results.push_back(simulate(replay, policy, trace.rate, trace.nominal_ticks, wake_override_us));
+  }
+  std::stable_sort(results.begin(), results.end(), [](const Result& a, const Result& b) {
+    return a.mean() < b.mean();
+  });
+
+  printf("%-26s %8s %8s %8s %8s %8s  %s\n", "policy", "mean", "p50", "p99", "max", "missed",
+         "reports by polls missed (0/1/2/3+)");
+  std::string recorded = policy_name(trace.timing);
+  for (size_t i = 0; i < results.size() && i < top; ++i) {
+    const Result& result = results[i];
+    std::string name = result.policy->name;
+    if (name == recorded) {
+      name += " *";
+    }
+    printf("%-26s %8.0f %8.0f %8.0f %8.0f %8u  %u/%u/%u/%u\n", name.c_str(), result.mean(),
+           result.percentile(0.5), result.percentile(0.99), result.percentile(1.0),
+           result.total_missed, result.missed_polls[0], result.missed_polls[1],
+           result.missed_polls[2], result.missed_polls[3]);
+    if (histogram) {
+      print_histogram(result);
+    }
+  }
+  return 0;
+}